@@ -0,0 +1,793 @@
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "transport.h"
+#include "babe.h"
+#include "certz.h"
+#include "common.h"
+#include "connection.h"
+#include "flash.h"
+#include "loader.h"
+#include "serial.h"
+#include "sha1.h"
+#include "action.h"
+#include "vkp.h"
+
+// seftool-bench: runs the real actions against seftool-emu (or a device on
+// --port) and prints one CSV row per run, so changes to the host side can be
+// compared by the numbers instead of by feel.
+//
+// Every run is a full session: connect, loader upload, action, shutdown.
+// "seconds" is the whole session, i.e. the time a handset spends on the cable.
+// Latency is taken from the first unanswered host write to the first byte
+// that comes back, so with --window > 1 it includes the queued packets.
+
+int loader_type = 0;
+
+#define BENCH_FLASH_ADDR 0x44100000 // clear of the boot area on the emulator
+#define BENCH_LAT_MAX 0x40000
+
+// --- timing shim between the actions and the real transport ---
+
+static const struct transport_ops *bench_real;
+
+static struct
+{
+    double pending; // time of the first unanswered write, 0 = none
+    float *lat;     // ms
+    size_t nlat;
+    size_t tx_bytes;
+    size_t rx_bytes;
+    size_t writes;
+} bench_stat;
+
+static int bench_open(struct transport *t)
+{
+    return bench_real->open(t);
+}
+
+static int bench_read(struct transport *t, uint8_t *buf, size_t len, int timeout_ms)
+{
+    int n = bench_real->read(t, buf, len, timeout_ms);
+    if (n > 0)
+    {
+        if (bench_stat.pending > 0 && bench_stat.nlat < BENCH_LAT_MAX)
+            bench_stat.lat[bench_stat.nlat++] = (float)((get_time_sec() - bench_stat.pending) * 1000);
+        bench_stat.pending = 0;
+        bench_stat.rx_bytes += n;
+    }
+    return n;
+}
+
+static int bench_write(struct transport *t, const struct transport_iov *iov, int count)
+{
+    if (bench_stat.pending == 0)
+        bench_stat.pending = get_time_sec();
+
+    int n = bench_real->write(t, iov, count);
+    if (n > 0)
+    {
+        bench_stat.tx_bytes += n;
+        bench_stat.writes++;
+    }
+    return n;
+}
+
+static int bench_wait(struct transport *t, int timeout_ms)
+{
+    return bench_real->wait(t, timeout_ms);
+}
+
+static int bench_set_baud(struct transport *t, int baudrate)
+{
+    return bench_real->set_baud(t, baudrate);
+}
+
+static int bench_close(struct transport *t)
+{
+    return bench_real->close(t);
+}
+
+static void bench_release(struct transport *t)
+{
+    if (bench_real->release)
+        bench_real->release(t);
+}
+
+static const struct transport_ops bench_ops = {
+    "bench",
+    bench_open,
+    bench_read,
+    bench_write,
+    bench_wait,
+    bench_set_baud,
+    bench_close,
+    bench_release,
+};
+
+static int cmp_float(const void *a, const void *b)
+{
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static double percentile(float *v, size_t n, double p)
+{
+    if (n == 0)
+        return 0;
+    size_t i = (size_t)(p * (n - 1) + 0.5);
+    return v[i];
+}
+
+// --- generated inputs ---
+
+// signed BABE of 'size' bytes at BENCH_FLASH_ADDR, stamped for certz[0] so it
+// passes the same CHECKFULL as a real firmware file
+static int bench_make_babe(const char *fname, size_t size)
+{
+    uint8_t *raw = malloc(size);
+    if (!raw)
+        return -1;
+
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < size; i++)
+    {
+        x = x * 1103515245 + 12345;
+        raw[i] = x >> 24;
+    }
+
+    size_t babe_size;
+    uint8_t *babe = flash_convert_raw_to_babe(raw, size, BENCH_FLASH_ADDR, &babe_size);
+    free(raw);
+    if (!babe)
+        return -1;
+
+    struct babehdr_t *hdr = (struct babehdr_t *)babe;
+    hdr->platform = certz[0].platform;
+    hdr->cid = certz[0].cid;
+    hdr->color = certz[0].color;
+
+    // running hash over header, certificate and blocks, last byte per block
+    SHA1_CTX sha, blk;
+    uint8_t hash[20];
+    sha1_init(&sha);
+    sha1_update(&sha, babe, 0x3C);
+    sha1_update(&sha, certz[0].cert, 0x1E8);
+    sha1_update(&sha, babe + 0x224, 0x300 - 0x224);
+
+    size_t pos = sizeof(struct babehdr_t) + hdr->payloadsize1;
+    for (uint32_t b = 0; b < hdr->payloadsize1; b++)
+    {
+        uint32_t bsize = get_word(babe + pos + 4);
+        sha1_update(&sha, babe + pos, 8 + bsize);
+        pos += 8 + bsize;
+
+        memcpy(&blk, &sha, sizeof(blk));
+        sha1_final(&blk, hash);
+        babe[0x380 + b] = hash[19];
+    }
+
+    // the emulator doesn't check the RSA signature, but flash refuses a
+    // zero one (unsigned) on the signed loader the emulated phone gets
+    memset(hdr->hash2, 0x5A, sizeof(hdr->hash2));
+
+    FILE *f = fopen(fname, "wb");
+    if (!f || fwrite(babe, 1, babe_size, f) != babe_size)
+    {
+        fprintf(stderr, "Error: Cannot write %s\n", fname);
+        if (f)
+            fclose(f);
+        free(babe);
+        return -1;
+    }
+    fclose(f);
+    free(babe);
+    return 0;
+}
+
+// one patched word per 64 KB block, over erased (0xFF) flash
+static int bench_make_vkp(const char *fname, size_t size)
+{
+    FILE *f = fopen(fname, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Error: Cannot write %s\n", fname);
+        return -1;
+    }
+
+    fprintf(f, "; seftool-bench\n");
+    for (size_t off = 0; off < size; off += BLOCK_SIZE)
+        fprintf(f, "%08X: FFFF %04X\n", (uint32_t)(BENCH_FLASH_ADDR + off), (unsigned)(off >> 16) & 0xFFFF);
+
+    fclose(f);
+    return 0;
+}
+
+// --- VKP parser, no session ---
+
+// a font-sized patch in memory: 16 bytes per line, erased flash underneath
+static char *bench_vkp_text(size_t bytes, size_t *len)
+{
+    size_t lines = (bytes + 15) / 16;
+    char *text = malloc(lines * 80 + 32);
+    if (!text)
+        return NULL;
+
+    char *p = text + sprintf(text, "; seftool-bench\r\n+0\r\n");
+    for (size_t i = 0; i < lines; i++)
+    {
+        p += sprintf(p, "%08X: FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF ", (uint32_t)(BENCH_FLASH_ADDR + i * 16));
+        for (int j = 0; j < 16; j++)
+            p += sprintf(p, "%02X", (unsigned)((i * 16 + j) * 7 & 0xFF));
+        p += sprintf(p, "\r\n");
+    }
+    *len = p - text;
+    return text;
+}
+
+static int bench_vkp_parse(size_t bytes, int repeat, FILE *out)
+{
+    size_t len;
+    char *text = bench_vkp_text(bytes, &len);
+    if (!text)
+        return 1;
+
+    const char *header = "action,patch_bytes,text_bytes,seconds,mb_per_s,ok\n";
+    fputs(header, stdout);
+    if (out)
+        fputs(header, out);
+
+    int rc = 0;
+    for (int k = 0; k < repeat; k++)
+    {
+        vkp_patch_t patch;
+        vkp_patch_init(&patch);
+
+        double start = get_time_sec();
+        int ok = vkp_dovkp(&patch, text, (uint32_t)len) == 0 && patch.patch.count == (bytes + 15) / 16 * 16;
+        double elapsed = get_time_sec() - start;
+        vkp_patch_free(&patch);
+
+        char row[128];
+        snprintf(row, sizeof(row), "vkp-parse,%zu,%zu,%.4f,%.1f,%d\n", bytes, len, elapsed,
+                 elapsed > 0 ? len / elapsed / (1024 * 1024) : 0.0, ok);
+        fputs(row, stdout);
+        if (out)
+            fputs(row, out);
+        if (!ok)
+            rc = 1;
+    }
+
+    free(text);
+    return rc;
+}
+
+// --- emulator process ---
+
+static pid_t bench_emu_start(const char *emu, const char *link_path, int latency, int emu_baud)
+{
+    char lat[16], baud[16];
+    snprintf(lat, sizeof(lat), "%d", latency);
+    snprintf(baud, sizeof(baud), "%d", emu_baud);
+
+    unlink(link_path);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+            dup2(null, STDOUT_FILENO);
+
+        if (emu_baud >= 0)
+            execl(emu, emu, "--color", "brown", "--cid", "49", "--link", link_path,
+                  "--latency", lat, "--baud", baud, (char *)NULL);
+        else
+            execl(emu, emu, "--color", "brown", "--cid", "49", "--link", link_path,
+                  "--latency", lat, (char *)NULL);
+        fprintf(stderr, "Error: Cannot run %s\n", emu);
+        _exit(127);
+    }
+
+    // the link shows up once the pty is ready
+    for (int i = 0; i < 500; i++)
+    {
+        struct stat st;
+        if (lstat(link_path, &st) == 0)
+            return pid;
+
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid)
+            break;
+
+        struct timespec ts = {0, 10000000};
+        nanosleep(&ts, NULL);
+    }
+
+    fprintf(stderr, "Error: %s did not come up\n", emu);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static void bench_emu_stop(pid_t pid)
+{
+    if (pid <= 0)
+        return;
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+// --- one run ---
+
+enum bench_action
+{
+    BENCH_FLASH,
+    BENCH_READ,
+    BENCH_GDFS,
+    BENCH_VKP,
+};
+
+static const char *bench_action_names[] = {"flash", "read", "gdfs", "vkp"};
+
+struct bench_run
+{
+    enum bench_action action;
+    int baud;
+    int chunk;
+    int payload;
+};
+
+struct bench_opts
+{
+    const char *port; // real device, NULL = spawn seftool-emu
+    const char *emu;
+    const char *link; // emulator pty symlink
+    const char *pty;  // the same as a port name
+    int latency;
+    int emu_baud;
+    int window;
+    size_t size;
+    int verbose;
+    FILE *out;
+};
+
+static int bench_session(const struct bench_opts *o, const struct bench_run *r)
+{
+    struct transport *port;
+    if (transport_get_by_name(o->port ? o->port : o->pty, &port) != 0)
+        return -1;
+
+    bench_real = port->ops;
+    port->ops = &bench_ops;
+
+    struct phone_info phone = {0};
+    phone.baudrate = r->baud;
+
+    int rc = connection_open(port, &phone);
+    if (rc == 0)
+    {
+        const char *vkp = "bench.vkp";
+        switch (r->action)
+        {
+        case BENCH_FLASH:
+            rc = action_flash_fw(port, &phone, "bench.babe", NULL);
+            break;
+        case BENCH_READ:
+            rc = action_read_flash(port, &phone, BENCH_FLASH_ADDR, o->size);
+            break;
+        case BENCH_GDFS:
+            rc = action_backup_gdfs(port, &phone);
+            break;
+        case BENCH_VKP:
+            rc = action_exec_scripts(port, &phone, 1, &vkp);
+            break;
+        }
+    }
+
+    if (rc == 0)
+        rc = loader_shutdown(port);
+
+    transport_free(port);
+    return rc;
+}
+
+static int bench_one(const struct bench_opts *o, const struct bench_run *r)
+{
+    pid_t emu = 0;
+    if (!o->port)
+    {
+        emu = bench_emu_start(o->emu, o->link, o->latency, o->emu_baud);
+        if (emu < 0)
+            return -1;
+    }
+
+    bench_stat.pending = 0;
+    bench_stat.nlat = 0;
+    bench_stat.tx_bytes = 0;
+    bench_stat.rx_bytes = 0;
+    bench_stat.writes = 0;
+
+    // flash_babe() drops to stop-and-wait after a failed window, start every run fresh
+    flash_window = o->window;
+    serial_chunk_size = r->chunk;
+    flash_packet_size = r->payload ? r->payload : FLASH_PACKET_SIZE;
+
+    // the actions talk a lot, keep the CSV readable
+    int saved = -1;
+    fflush(stdout);
+    if (!o->verbose)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        saved = dup(STDOUT_FILENO);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    double start = get_time_sec();
+    int rc = bench_session(o, r);
+    double elapsed = get_time_sec() - start;
+
+    fflush(stdout);
+    if (saved >= 0)
+    {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+
+    bench_emu_stop(emu);
+
+    qsort(bench_stat.lat, bench_stat.nlat, sizeof(float), cmp_float);
+    size_t bytes = bench_stat.tx_bytes + bench_stat.rx_bytes;
+
+    char row[256];
+    snprintf(row, sizeof(row), "%s,%d,%d,%d,%zu,%.3f,%.0f,%zu,%.1f,%.2f,%.2f,%d\n",
+             bench_action_names[r->action], r->baud, r->chunk, r->payload,
+             bytes, elapsed, bytes / elapsed, bench_stat.writes, bench_stat.writes / elapsed,
+             percentile(bench_stat.lat, bench_stat.nlat, 0.50), percentile(bench_stat.lat, bench_stat.nlat, 0.99),
+             rc == 0);
+    fputs(row, stdout);
+    fflush(stdout);
+    if (o->out)
+    {
+        fputs(row, o->out);
+        fflush(o->out);
+    }
+
+    return rc;
+}
+
+// --- setup ---
+
+static int parse_list(const char *s, int *out, int max)
+{
+    int n = 0;
+    while (*s && n < max)
+    {
+        char *end;
+        long v = strtol(s, &end, 0);
+        if (end == s)
+            return -1;
+        out[n++] = (int)v;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static int rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+static void bench_usage(const char *prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("Runs seftool actions against seftool-emu and prints CSV timings\n\n");
+    printf("Options:\n");
+    printf("  --actions <list>    flash,read,gdfs,vkp (default all)\n");
+    printf("  --bauds <list>      Line speeds, or 'all' for S0..S7\n");
+    printf("                      (default 115200,230400,460800,921600)\n");
+    printf("  --chunks <list>     serial_write_chunks() sizes, 0 = as coded (default 0)\n");
+    printf("  --payloads <list>   Flash data packet sizes, flash/vkp only (default 0x800)\n");
+    printf("  --size <bytes>      Flash/read/vkp size (default 0x40000)\n");
+    printf("  --window <n>        Data packets in flight while flashing\n");
+    printf("  --repeat <n>        Runs per combination (default 1)\n");
+    printf("  --latency <ms>      Emulator turnaround per reply (default 0)\n");
+    printf("  --emu-baud <rate>   Pace the emulator at a fixed rate, 0 = unpaced\n");
+    printf("  --emu <path>        seftool-emu binary (default: next to this one)\n");
+    printf("  --loader <dir>      Loader directory (default: next to this one)\n");
+    printf("  --port <name>       Use this device instead of the emulator (read, gdfs)\n");
+    printf("  --out <file>        Also write the CSV here\n");
+    printf("  --vkp-parse <bytes> Only time the VKP parser on a patch this big\n");
+    printf("  -v                  Show action output\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const int all_bauds[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+    int bauds[16] = {115200, 230400, 460800, 921600};
+    int nbauds = 4;
+    int chunks[16] = {0};
+    int nchunks = 1;
+    int payloads[16] = {FLASH_PACKET_SIZE};
+    int npayloads = 1;
+    int actions[4] = {1, 1, 1, 1};
+    int repeat = 1;
+    const char *emu = NULL;
+    const char *loader = NULL;
+    const char *out = NULL;
+    size_t parse_bytes = 0;
+
+    struct bench_opts o = {0};
+    o.size = 0x40000;
+    o.emu_baud = -1;
+    o.window = FLASH_WINDOW_DEFAULT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *opt = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(opt, "-h") == 0 || strcmp(opt, "--help") == 0)
+        {
+            bench_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(opt, "-v") == 0)
+        {
+            o.verbose = 1;
+            continue;
+        }
+        if (!val)
+        {
+            fprintf(stderr, "Unknown or incomplete option %s\n", opt);
+            bench_usage(argv[0]);
+            return 1;
+        }
+        i++;
+
+        if (strcmp(opt, "--actions") == 0)
+        {
+            memset(actions, 0, sizeof(actions));
+            char *list = strdup(val);
+            for (char *a = strtok(list, ","); a; a = strtok(NULL, ","))
+            {
+                int found = 0;
+                for (int j = 0; j < 4; j++)
+                {
+                    if (strcmp(a, bench_action_names[j]) == 0)
+                        actions[j] = found = 1;
+                }
+                if (!found)
+                {
+                    fprintf(stderr, "Unknown action %s\n", a);
+                    return 1;
+                }
+            }
+            free(list);
+        }
+        else if (strcmp(opt, "--bauds") == 0)
+        {
+            if (strcmp(val, "all") == 0)
+            {
+                memcpy(bauds, all_bauds, sizeof(all_bauds));
+                nbauds = 8;
+            }
+            else
+                nbauds = parse_list(val, bauds, 16);
+        }
+        else if (strcmp(opt, "--chunks") == 0)
+            nchunks = parse_list(val, chunks, 16);
+        else if (strcmp(opt, "--payloads") == 0)
+            npayloads = parse_list(val, payloads, 16);
+        else if (strcmp(opt, "--size") == 0)
+            o.size = strtoul(val, NULL, 0);
+        else if (strcmp(opt, "--window") == 0)
+            o.window = atoi(val);
+        else if (strcmp(opt, "--repeat") == 0)
+            repeat = atoi(val);
+        else if (strcmp(opt, "--latency") == 0)
+            o.latency = atoi(val);
+        else if (strcmp(opt, "--emu-baud") == 0)
+            o.emu_baud = atoi(val);
+        else if (strcmp(opt, "--emu") == 0)
+            emu = val;
+        else if (strcmp(opt, "--loader") == 0)
+            loader = val;
+        else if (strcmp(opt, "--port") == 0)
+            o.port = val;
+        else if (strcmp(opt, "--out") == 0)
+            out = val;
+        else if (strcmp(opt, "--vkp-parse") == 0)
+            parse_bytes = strtoul(val, NULL, 0);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            bench_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (parse_bytes > 0)
+    {
+        FILE *csv = out ? fopen(out, "w") : NULL;
+        if (out && !csv)
+        {
+            fprintf(stderr, "Error: Cannot write %s\n", out);
+            return 1;
+        }
+        int rc = bench_vkp_parse(parse_bytes, repeat, csv);
+        if (csv)
+            fclose(csv);
+        return rc;
+    }
+
+    if (nbauds <= 0 || nchunks <= 0 || npayloads <= 0)
+    {
+        fprintf(stderr, "Error: bad --bauds, --chunks or --payloads list\n");
+        return 1;
+    }
+    for (int i = 0; i < nbauds; i++)
+    {
+        if (!get_speed_chars(bauds[i]))
+        {
+            fprintf(stderr, "Error: %d is not one of the S0..S7 rates\n", bauds[i]);
+            return 1;
+        }
+    }
+    for (int i = 0; i < npayloads; i++)
+    {
+        if (payloads[i] < 1 || payloads[i] > FLASH_PACKET_SIZE)
+        {
+            fprintf(stderr, "Error: payload size must be 1..0x%X\n", FLASH_PACKET_SIZE);
+            return 1;
+        }
+    }
+    if (o.window < 1 || o.window > FLASH_WINDOW_MAX)
+    {
+        fprintf(stderr, "Error: --window requires a value between 1 and %d\n", FLASH_WINDOW_MAX);
+        return 1;
+    }
+    if (o.port && (actions[BENCH_FLASH] || actions[BENCH_VKP]))
+    {
+        // generated data at BENCH_FLASH_ADDR would brick a real phone
+        fprintf(stderr, "Error: --port only runs read and gdfs, flash and vkp write test data\n");
+        return 1;
+    }
+    if (o.size == 0 || o.size % BLOCK_SIZE != 0)
+    {
+        fprintf(stderr, "Error: --size must be a multiple of 0x%X\n", BLOCK_SIZE);
+        return 1;
+    }
+
+    // emulator and loaders default to the build tree this binary lives in
+    char dir[PATH_MAX - 16], exe[PATH_MAX], emu_path[PATH_MAX], loader_path[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", dir, sizeof(dir) - 1);
+    dir[n > 0 ? n : 0] = '\0';
+    char *slash = strrchr(dir, '/');
+    if (slash)
+        *slash = '\0';
+
+    snprintf(emu_path, sizeof(emu_path), "%s/seftool-emu", dir);
+    if (emu && !realpath(emu, emu_path))
+    {
+        fprintf(stderr, "Error: Cannot find %s\n", emu);
+        return 1;
+    }
+    snprintf(exe, sizeof(exe), "%s/loader", dir);
+    if (!realpath(loader ? loader : exe, loader_path))
+    {
+        fprintf(stderr, "Error: Cannot find loader directory %s\n", loader ? loader : exe);
+        return 1;
+    }
+
+    FILE *csv = NULL;
+    if (out)
+    {
+        csv = fopen(out, "w");
+        if (!csv)
+        {
+            fprintf(stderr, "Error: Cannot write %s\n", out);
+            return 1;
+        }
+    }
+
+    // scratch directory: loaders, inputs and whatever the actions write
+    char work[] = "/tmp/seftool-bench.XXXXXX";
+    if (!mkdtemp(work))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    char link_path[sizeof(work) + 16], pty_name[sizeof(link_path) + 4];
+    snprintf(link_path, sizeof(link_path), "%s/phone", work);
+    snprintf(pty_name, sizeof(pty_name), "pty:%s", link_path);
+
+    int rc = 1;
+    if (chdir(work) != 0 || symlink(loader_path, "loader") != 0 || mkdir("backup", 0755) != 0)
+    {
+        perror(work);
+        goto exit;
+    }
+    if ((actions[BENCH_FLASH] && bench_make_babe("bench.babe", o.size) != 0) ||
+        (actions[BENCH_VKP] && bench_make_vkp("bench.vkp", o.size) != 0))
+        goto exit;
+
+    bench_stat.lat = malloc(BENCH_LAT_MAX * sizeof(float));
+    if (!bench_stat.lat)
+        goto exit;
+
+    o.emu = emu_path;
+    o.link = link_path;
+    o.pty = pty_name;
+    o.out = csv;
+
+    // the actions read y/n answers from stdin, never wait for one here
+    int null = open("/dev/null", O_RDONLY);
+    if (null >= 0)
+    {
+        dup2(null, STDIN_FILENO);
+        close(null);
+    }
+
+    const char *header = "action,baud,chunk,payload,bytes,seconds,bytes_per_s,"
+                         "packets,packets_per_s,p50_ms,p99_ms,ok\n";
+    fputs(header, stdout);
+    if (csv)
+        fputs(header, csv);
+
+    rc = 0;
+    for (int a = 0; a < 4; a++)
+    {
+        if (!actions[a])
+            continue;
+
+        // packet size only matters where 0x01 data packets are sent
+        int flashes = a == BENCH_FLASH || a == BENCH_VKP;
+        int np = flashes ? npayloads : 1;
+
+        for (int b = 0; b < nbauds; b++)
+            for (int c = 0; c < nchunks; c++)
+                for (int p = 0; p < np; p++)
+                    for (int k = 0; k < repeat; k++)
+                    {
+                        struct bench_run r = {a, bauds[b], chunks[c], flashes ? payloads[p] : 0};
+                        if (bench_one(&o, &r) != 0)
+                            rc = 1;
+                    }
+    }
+
+    free(bench_stat.lat);
+
+exit:
+    if (chdir("/") != 0)
+        perror("chdir");
+    nftw(work, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (csv)
+        fclose(csv);
+    return rc;
+}
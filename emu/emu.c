@@ -0,0 +1,1311 @@
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "babe.h"
+#include "common.h"
+#include "cmd.h"
+
+// seftool-emu: a virtual phone on a pty, for running seftool without hardware.
+//
+// Speaks enough EMP to get through identify, read-flash, flash, GDFS backup,
+// restore and scripts: the EROM '?' / IC* / Sx / QH00 QA00 QD00 exchange,
+// 0x3C loader uploads, the flash loader commands and the csloader GDFS server.
+// Loaders are not executed; the hello text is taken from the uploaded image.
+// Flash and GDFS live in memory, the line is paced like a real UART.
+//
+// Replies whose ID the host does not check echo the command ID.
+
+#define EMU_IN_MAX 0x20000
+#define EMU_FRAME_MAX 0x800 // data per 0x33 frame, and GDFS backup frame target
+
+enum emu_state
+{
+    EMU_OFF,    // no host, or phone shut down
+    EMU_EROM,   // boot ROM, raw commands
+    EMU_QH,     // receiving the 0x380 byte loader header
+    EMU_QA,     // receiving the prologue
+    EMU_QD,     // receiving the payload
+    EMU_LOADER, // a loader is running, framed commands
+};
+
+struct emu_var
+{
+    uint8_t block;
+    uint8_t lo;
+    uint8_t hi;
+    uint32_t size;
+    uint8_t *data;
+};
+
+static struct
+{
+    // phone identity
+    uint16_t chip_id;
+    uint16_t flash_id;
+    int cid;
+    int color; // IC30 / 0x57 domain bits: 1 blue, 2 brown, 4 red, 8 black
+    char imei[15];
+
+    uint32_t flash_base;
+    uint32_t flash_size;
+    uint8_t *flash;
+
+    struct emu_var *vars;
+    size_t nvars;
+
+    int latency_ms; // turnaround before every reply
+    int corrupt;    // every nth 0x33 frame goes out with a bad checksum, 0 = never
+    int fixed_baud; // -1 = follow S0..S7, 0 = unpaced
+    int verbose;
+
+    // line
+    int fd;
+    int connected;
+    int baud;
+    double rx_clock; // when the last byte read would have arrived on a real wire
+    double tx_clock; // when the last byte written would have left
+
+    // protocol
+    enum emu_state state;
+    uint8_t in[EMU_IN_MAX];
+    size_t in_len;
+    int acked; // current command came with an 06 prefix
+
+    uint8_t qh[sizeof(struct babehdr_t)];
+    uint32_t expect;
+    uint32_t got;
+
+    uint8_t *upload; // loader image as received, for the hello text
+    size_t upload_len;
+    size_t upload_cap;
+    int upload_parts;  // finished 0x3C transfers (header, prologue, payload)
+    int start_pending; // bare ACK starts the uploaded loader
+
+    uint32_t wr_addr; // 0x10 block in progress
+    uint32_t wr_left;
+
+    int rd_active; // 0x32 stream, next frame on bare ACK
+    uint32_t rd_addr;
+    uint32_t rd_end;
+
+    int gd_active; // csloader GDFS backup stream
+    size_t gd_next;
+
+    uint8_t last[EMU_FRAME_MAX + 0x20 + 5]; // last stream frame, resent on NAK
+    size_t last_len;
+
+    // session counters
+    double t_open;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    unsigned blocks_written;
+    unsigned frames_read;
+} emu;
+
+static volatile sig_atomic_t emu_quit;
+
+static void emu_on_signal(int sig)
+{
+    (void)sig;
+    emu_quit = 1;
+}
+
+static void emu_sleep_until(double t)
+{
+    double d = t - get_time_sec();
+    if (d <= 0)
+        return;
+
+    struct timespec ts = {(time_t)d, (long)((d - (time_t)d) * 1e9)};
+    nanosleep(&ts, NULL);
+}
+
+static int emu_line_baud(void)
+{
+    return emu.fixed_baud >= 0 ? emu.fixed_baud : emu.baud;
+}
+
+// time n bytes take at 8N1 on top of what is already on the wire
+static double emu_wire(double *clock, size_t n)
+{
+    int baud = emu_line_baud();
+    double now = get_time_sec();
+
+    if (*clock < now)
+        *clock = now;
+    if (baud > 0)
+        *clock += n * 10.0 / baud;
+    return *clock;
+}
+
+// ------------- line output -------------
+
+static int emu_send(const uint8_t *buf, size_t len)
+{
+    if (!emu.connected)
+        return -1;
+
+    emu_sleep_until(emu_wire(&emu.tx_clock, len));
+
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = write(emu.fd, buf + done, len - done);
+        if (r > 0)
+        {
+            done += r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        struct pollfd pfd = {emu.fd, POLLOUT, 0};
+        if (r < 0 && errno == EAGAIN && poll(&pfd, 1, 10 * TIMEOUT) > 0 && !(pfd.revents & POLLHUP))
+            continue;
+
+        fprintf(stderr, "emu: write failed, host gone?\n");
+        return -1;
+    }
+
+    emu.bytes_out += len;
+    return 0;
+}
+
+static void emu_turnaround(void)
+{
+    if (emu.latency_ms <= 0)
+        return;
+
+    struct timespec ts = {emu.latency_ms / 1000, (emu.latency_ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+static void emu_send_byte(uint8_t b)
+{
+    emu_turnaround();
+    emu_send(&b, 1);
+}
+
+static size_t emu_build(int ack, uint8_t cmd, const uint8_t *data, size_t len, uint8_t *out)
+{
+    size_t n = 0;
+    if (ack)
+        out[n++] = SERIAL_ACK;
+    return n + cmd_encode_binary_packet(cmd, data, (int)len, out + n);
+}
+
+static void emu_reply(uint8_t cmd, const uint8_t *data, size_t len)
+{
+    uint8_t *frame = malloc(len + 6);
+    if (!frame)
+        return;
+
+    size_t n = emu_build(emu.acked, cmd, data, len, frame);
+    emu_turnaround();
+    emu_send(frame, n);
+    free(frame);
+}
+
+// frames of a multi-frame answer, kept around for a NAK
+static void emu_stream_frame(uint8_t cmd, const uint8_t *data, size_t len)
+{
+    emu.last_len = emu_build(0, cmd, data, len, emu.last);
+    emu_turnaround();
+
+    // a line error: the NAK that follows gets the good copy from last[]
+    if (cmd == 0x33 && emu.corrupt > 0 && emu.frames_read % emu.corrupt == 0)
+    {
+        emu.last[emu.last_len - 1] ^= 0xFF;
+        emu_send(emu.last, emu.last_len);
+        emu.last[emu.last_len - 1] ^= 0xFF;
+        return;
+    }
+    emu_send(emu.last, emu.last_len);
+}
+
+// ------------- flash -------------
+
+static void emu_flash_write(uint32_t addr, const uint8_t *data, size_t len)
+{
+    if (addr < emu.flash_base || addr - emu.flash_base + len > emu.flash_size)
+    {
+        if (emu.verbose)
+            printf("emu: write %08X+%zX outside flash, dropped\n", addr, len);
+        return;
+    }
+
+    memcpy(emu.flash + (addr - emu.flash_base), data, len);
+}
+
+// erased (0xFF) outside the emulated range, like unmapped flash on the loader
+static void emu_flash_read(uint32_t addr, uint8_t *out, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        uint32_t a = addr + i;
+        out[i] = (a >= emu.flash_base && a - emu.flash_base < emu.flash_size)
+                     ? emu.flash[a - emu.flash_base]
+                     : 0xFF;
+    }
+}
+
+// ------------- GDFS -------------
+
+static struct emu_var *emu_var_find(uint8_t block, uint8_t lo, uint8_t hi)
+{
+    for (size_t i = 0; i < emu.nvars; i++)
+    {
+        if (emu.vars[i].block == block && emu.vars[i].lo == lo && emu.vars[i].hi == hi)
+            return &emu.vars[i];
+    }
+    return NULL;
+}
+
+static int emu_var_set(uint8_t block, uint8_t lo, uint8_t hi, const uint8_t *data, uint32_t size)
+{
+    uint8_t *copy = malloc(size ? size : 1);
+    if (!copy)
+        return -1;
+    memcpy(copy, data, size);
+
+    struct emu_var *v = emu_var_find(block, lo, hi);
+    if (!v)
+    {
+        struct emu_var *vars = realloc(emu.vars, (emu.nvars + 1) * sizeof(*vars));
+        if (!vars)
+        {
+            free(copy);
+            return -1;
+        }
+        emu.vars = vars;
+        v = &emu.vars[emu.nvars++];
+        v->block = block;
+        v->lo = lo;
+        v->hi = hi;
+        v->data = NULL;
+    }
+
+    free(v->data);
+    v->data = copy;
+    v->size = size;
+    return 0;
+}
+
+static void emu_var_str(uint8_t block, uint8_t lo, uint8_t hi, const char *s)
+{
+    emu_var_set(block, lo, hi, (const uint8_t *)s, strlen(s) + 1);
+}
+
+// what seftool identify and the csloader check look at, plus filler units
+// so a backup has something to move
+static void emu_gdfs_seed(int fill)
+{
+    uint8_t buf[0x100];
+
+    // phone name is UTF-16LE, DB2020/PNX5230 and DB20x0 location
+    const char *name = "K800i";
+    size_t n = 0;
+    for (const char *p = name; *p; p++)
+    {
+        buf[n++] = *p;
+        buf[n++] = 0;
+    }
+    buf[n++] = 0;
+    buf[n++] = 0;
+    emu_var_set(0x02, 0xBB, 0x0D, buf, n);
+    emu_var_set(0x02, 0x8F, 0x0C, buf, n);
+
+    emu_var_str(0x02, 0xE5, 0x0D, "SonyEricsson");
+    emu_var_str(0x02, 0x15, 0x0E, "CXC1122528");
+    emu_var_str(0x02, 0x16, 0x0E, "R8BA024");
+    emu_var_str(0x02, 0xE7, 0x0D, "CDA102475/20 R1A");
+    emu_var_str(0x02, 0xE8, 0x0D, "CDA102475/20");
+    emu_var_str(0x02, 0xE9, 0x0D, "R1A");
+    emu_var_str(0x02, 0xEA, 0x0D, "CDA102475/20");
+    emu_var_str(0x02, 0xEB, 0x0D, "R1A");
+
+    // security units: no simlock, usercode 0000
+    memset(buf, 0, sizeof(buf));
+    emu_var_set(0x00, 0x06, 0x00, buf, 0x40);
+    buf[0x61] = 4;
+    emu_var_set(0x00, 0x0E, 0x00, buf, 0x70);
+    memset(buf, 0, sizeof(buf));
+    for (int i = 0; i < 0x40; i++)
+        buf[i] = (uint8_t)(i * 7);
+    emu_var_set(0x00, 0x13, 0x00, buf, 0x40);
+    emu_var_set(0x00, 0x18, 0x00, buf, 0x40);
+    emu_var_set(0x00, 0xAA, 0x00, buf, 0x40);
+
+    uint32_t seed = 0x2545F491;
+    for (int i = 0; i < fill; i++)
+    {
+        uint32_t size = 16 + (i * 37) % 200;
+        for (uint32_t j = 0; j < size; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            buf[j] = seed >> 24;
+        }
+        emu_var_set(0x03, i & 0xFF, 0x10 + (i >> 8), buf, size);
+    }
+}
+
+// GDFS_<name>_<imei>.bin from seftool backup-gdfs: varcount, then
+// {block, lo, hi, size(4), data} records
+static int emu_gdfs_load(const char *path)
+{
+    size_t size;
+    uint8_t *buf = load_file(path, &size);
+    if (!buf)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return -1;
+    }
+
+    size_t pos = 4;
+    unsigned count = 0;
+    while (pos + 7 <= size)
+    {
+        uint32_t varsize = get_word(&buf[pos + 3]);
+        if (pos + 7 + varsize > size)
+            break;
+        if (emu_var_set(buf[pos], buf[pos + 1], buf[pos + 2], &buf[pos + 7], varsize) != 0)
+            break;
+        pos += 7 + varsize;
+        count++;
+    }
+
+    free(buf);
+    printf("GDFS: %u units from %s\n", count, path);
+    return 0;
+}
+
+// ------------- loader upload -------------
+
+static int emu_upload_append(const uint8_t *data, size_t len)
+{
+    if (emu.upload_len + len > emu.upload_cap)
+    {
+        size_t cap = emu.upload_cap ? emu.upload_cap : 0x10000;
+        while (cap < emu.upload_len + len)
+            cap *= 2;
+        uint8_t *p = realloc(emu.upload, cap);
+        if (!p)
+            return -1;
+        emu.upload = p;
+        emu.upload_cap = cap;
+    }
+
+    memcpy(emu.upload + emu.upload_len, data, len);
+    emu.upload_len += len;
+    return 0;
+}
+
+static int emu_is_name_char(uint8_t c)
+{
+    return isupper(c) || isdigit(c) || c == '_';
+}
+
+// the loader announces itself with its build name, e.g.
+// ESGCXC1329129_DB2020_FLASHLOADER_R2A015; seftool picks the loader type from it
+static void emu_send_hello(void)
+{
+    static const char *marks[] = {"LOADER", "PATCHER"};
+    const char *hello = "EMU_FLASHLOADER";
+    size_t start = 0, len = 0;
+
+    for (size_t i = 0; i + 6 <= emu.upload_len && !len; i++)
+    {
+        for (size_t m = 0; m < sizeof(marks) / sizeof(marks[0]); m++)
+        {
+            size_t ml = strlen(marks[m]);
+            if (i + ml > emu.upload_len || memcmp(emu.upload + i, marks[m], ml) != 0)
+                continue;
+
+            start = i;
+            while (start > 0 && emu_is_name_char(emu.upload[start - 1]))
+                start--;
+            size_t end = i + ml;
+            while (end < emu.upload_len && emu_is_name_char(emu.upload[end]))
+                end++;
+            len = end - start;
+            break;
+        }
+    }
+
+    if (len)
+        hello = (const char *)emu.upload + start;
+    else
+        len = strlen(hello);
+    if (len > 200)
+        len = 200;
+
+    printf("emu: loader started: %.*s\n", (int)len, hello);
+
+    uint8_t frame[256];
+    size_t n = emu_build(0, 0x3E, (const uint8_t *)hello, len, frame);
+    emu_turnaround();
+    emu_send(frame, n);
+
+    emu.upload_len = 0;
+    emu.upload_parts = 0;
+    emu.start_pending = 0;
+    emu.state = EMU_LOADER;
+}
+
+// ------------- EROM -------------
+
+static void emu_erom_ic(const uint8_t *p)
+{
+    uint8_t resp[32] = {p[2], p[3]};
+    size_t n = 2;
+
+    if (memcmp(p, "IC10", 4) == 0)
+    {
+        const char *cert = emu.color == 2 ? "EMU_BROWN_CERT" : "EMU_RED_CERT";
+        n += snprintf((char *)resp + 2, sizeof(resp) - 2, "%s", cert) + 1;
+    }
+    else if (memcmp(p, "IC30", 4) == 0)
+    {
+        resp[n++] = emu.color;
+    }
+    else if (memcmp(p, "IC40", 4) == 0)
+    {
+        set_word(&resp[n], emu.cid);
+        n += 4;
+    }
+    else if (memcmp(p, "ICO0", 4) == 0)
+    {
+        resp[n++] = 0;              // status
+        resp[n++] = 1;              // locked
+        set_half(&resp[n], emu.cid);
+        n += 2;
+        resp[n++] = 1;              // paf
+        memcpy(&resp[n], emu.imei, 14);
+        n += 14;
+    }
+    else
+    {
+        if (emu.verbose)
+            printf("emu: unknown EROM command %.4s\n", p);
+        return;
+    }
+
+    emu_turnaround();
+    emu_send(resp, n);
+}
+
+// ICG1 block lo hi: PNX5230 GDFS read straight from the EROM
+static void emu_erom_icg1(const uint8_t *p)
+{
+    struct emu_var *v = emu_var_find(p[4], p[5], p[6]);
+    uint8_t hdr[7] = {p[4], p[5], p[6]};
+    set_word(&hdr[3], v ? v->size : 0);
+
+    emu_turnaround();
+    emu_send(hdr, sizeof(hdr));
+    if (v && v->size)
+        emu_send(v->data, v->size);
+}
+
+// raw loader body bytes for QH00 / QA00 / QD00
+static size_t emu_erom_body(const uint8_t *p, size_t n)
+{
+    size_t take = emu.expect - emu.got;
+    if (take > n)
+        take = n;
+
+    if (emu.state == EMU_QH)
+        memcpy(emu.qh + emu.got, p, take);
+    else
+        emu_upload_append(p, take);
+    emu.got += take;
+
+    if (emu.got < emu.expect)
+        return take;
+
+    switch (emu.state)
+    {
+    case EMU_QH:
+        emu.state = EMU_EROM;
+        emu_turnaround();
+        emu_send((const uint8_t *)"EhM", 3);
+        break;
+    case EMU_QA:
+        emu.state = EMU_EROM;
+        emu_turnaround();
+        emu_send((const uint8_t *)"EaTEbS", 6);
+        break;
+    default:
+        emu_turnaround();
+        emu_send((const uint8_t *)"EdQ", 3);
+        emu_send_hello();
+        break;
+    }
+
+    return take;
+}
+
+static size_t emu_erom(const uint8_t *p, size_t n)
+{
+    if (emu.state != EMU_EROM)
+        return emu_erom_body(p, n);
+
+    switch (p[0])
+    {
+    case '?':
+    {
+        uint8_t resp[8] = {emu.chip_id >> 8, emu.chip_id & 0xFF, 3, 1, 0, 0, 0, 0};
+        emu_turnaround();
+        emu_send(resp, sizeof(resp));
+        return 1;
+    }
+
+    case 'S':
+        if (n < 2)
+            return 0;
+        if (p[1] >= '0' && p[1] <= '7')
+        {
+            static const int speeds[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+            emu.baud = speeds[p[1] - '0'];
+            if (emu.verbose)
+                printf("emu: line at %d\n", emu.baud);
+        }
+        return 2;
+
+    case 'I':
+    case 'Q':
+        if (n < 4)
+            return 0;
+        break;
+
+    default:
+        if (emu.verbose)
+            printf("emu: EROM skipping 0x%02X\n", p[0]);
+        return 1;
+    }
+
+    if (memcmp(p, "ICG1", 4) == 0)
+    {
+        if (n < 7)
+            return 0;
+        emu_erom_icg1(p);
+        return 7;
+    }
+
+    struct babehdr_t *hdr = (struct babehdr_t *)emu.qh;
+    emu.got = 0;
+
+    if (memcmp(p, "QH00", 4) == 0)
+    {
+        emu.state = EMU_QH;
+        emu.expect = sizeof(emu.qh);
+        emu.upload_len = 0;
+        emu_turnaround();
+        emu_send((const uint8_t *)"EsB", 3);
+    }
+    else if (memcmp(p, "QA00", 4) == 0)
+    {
+        emu.state = EMU_QA;
+        emu.expect = hdr->prologuesize1;
+    }
+    else if (memcmp(p, "QD00", 4) == 0)
+    {
+        emu.state = EMU_QD;
+        emu.expect = hdr->payloadsize1;
+    }
+    else
+    {
+        emu_erom_ic(p);
+    }
+
+    return 4;
+}
+
+// ------------- loader commands -------------
+
+static void emu_read_next(void)
+{
+    uint8_t payload[6 + EMU_FRAME_MAX];
+    uint32_t n = emu.rd_end - emu.rd_addr;
+    if (n > EMU_FRAME_MAX)
+        n = EMU_FRAME_MAX;
+
+    set_half(payload, n);
+    set_word(&payload[2], emu.rd_addr);
+    emu_flash_read(emu.rd_addr, &payload[6], n);
+
+    emu.rd_addr += n;
+    emu.rd_active = emu.rd_addr < emu.rd_end;
+    emu.frames_read++;
+    emu_stream_frame(0x33, payload, 6 + n);
+}
+
+// backup frames: [02 00] (+ varcount in the first one) + whole records,
+// a record never straddles two frames
+static void emu_backup_next(void)
+{
+    size_t cap = 6 + EMU_FRAME_MAX + 0x10000;
+    uint8_t *payload = malloc(cap);
+    if (!payload)
+        return;
+
+    size_t n = 0;
+    payload[n++] = 0x02;
+    payload[n++] = 0x00;
+    if (emu.gd_next == 0)
+    {
+        set_word(&payload[n], emu.nvars);
+        n += 4;
+    }
+
+    size_t records = 0;
+    while (emu.gd_next < emu.nvars)
+    {
+        struct emu_var *v = &emu.vars[emu.gd_next];
+        if (records && n + 7 + v->size > EMU_FRAME_MAX)
+            break;
+        if (n + 7 + v->size > 0xFFFF)
+            break;
+
+        payload[n++] = v->block;
+        payload[n++] = v->lo;
+        payload[n++] = v->hi;
+        set_word(&payload[n], v->size);
+        n += 4;
+        memcpy(&payload[n], v->data, v->size);
+        n += v->size;
+        emu.gd_next++;
+        records++;
+    }
+
+    emu.gd_active = emu.gd_next < emu.nvars;
+
+    uint8_t *frame = malloc(n + 5);
+    if (frame)
+    {
+        size_t len = cmd_encode_binary_packet(0x04, payload, (int)n, frame);
+        if (len <= sizeof(emu.last))
+        {
+            memcpy(emu.last, frame, len);
+            emu.last_len = len;
+        }
+        emu_turnaround();
+        emu_send(frame, len);
+        free(frame);
+    }
+    free(payload);
+}
+
+static void emu_csloader(const uint8_t *d, size_t len)
+{
+    uint8_t resp[0x10000];
+    uint8_t sub = len ? d[0] : 0;
+    resp[0] = sub;
+    resp[1] = 0x00;
+
+    switch (sub)
+    {
+    case 0x01: // read unit
+    {
+        struct emu_var *v = len >= 4 ? emu_var_find(d[1], d[2], d[3]) : NULL;
+        size_t n = 2;
+        if (v)
+        {
+            memcpy(&resp[2], v->data, v->size < sizeof(resp) - 2 ? v->size : sizeof(resp) - 2);
+            n += v->size;
+        }
+        else
+        {
+            resp[1] = 0x01;
+        }
+        emu.acked = 1; // seftool insists on the 06 here
+        emu_reply(0x04, resp, n);
+        return;
+    }
+
+    case 0x02: // backup everything
+        emu.gd_next = 0;
+        emu_send_byte(SERIAL_ACK);
+        emu_backup_next();
+        return;
+
+    case 0x03: // write unit
+        if (len >= 8)
+        {
+            uint32_t size = get_word((uint8_t *)&d[4]);
+            if (size > len - 8)
+                size = len - 8;
+            emu_var_set(d[1], d[2], d[3], &d[8], size);
+        }
+        emu_reply(0x04, resp, 2);
+        return;
+
+    default: // 05 = start GDFS server
+        emu_reply(0x04, resp, 2);
+        return;
+    }
+}
+
+static void emu_command(uint8_t cmd, const uint8_t *d, size_t len)
+{
+    uint8_t resp[0x100];
+
+    if (emu.verbose && cmd != 0x01 && cmd != 0x3C)
+        printf("emu: cmd %02X len %zu\n", cmd, len);
+
+    // any new command ends a stream the host gave up on
+    if (cmd != 0x01)
+    {
+        emu.rd_active = 0;
+        emu.gd_active = 0;
+    }
+
+    switch (cmd)
+    {
+    case 0x01:
+        if (emu.wr_left)
+        {
+            size_t n = len < emu.wr_left ? len : emu.wr_left;
+            emu_flash_write(emu.wr_addr, d, n);
+            emu.wr_addr += n;
+            emu.wr_left -= n;
+            emu_send_byte(SERIAL_ACK);
+            if (!emu.wr_left)
+            {
+                resp[0] = 0x00;
+                emu.acked = 0;
+                emu.blocks_written++;
+                emu_reply(0x13, resp, 1);
+            }
+            return;
+        }
+
+        // csloader control: 09 activate, 0D unlock, 08 terminate
+        resp[0] = len ? d[0] : 0;
+        resp[1] = 0x00;
+        emu.acked = 1;
+        emu_reply(0x01, resp, 2);
+        return;
+
+    case 0x04:
+        emu_csloader(d, len);
+        return;
+
+    case 0x0D: // flash id
+        resp[0] = emu.flash_id >> 8;
+        resp[1] = emu.flash_id & 0xFF;
+        emu_reply(0x0A, resp, 2);
+        return;
+
+    case 0x0E: // BABE header chunk
+        resp[0] = 0x00;
+        emu_reply(0x0F, resp, 1);
+        return;
+
+    case 0x10: // block header
+        if (len >= 8)
+        {
+            emu.wr_addr = get_word((uint8_t *)&d[0]);
+            emu.wr_left = get_word((uint8_t *)&d[4]);
+        }
+        emu_send_byte(SERIAL_ACK);
+        if (!emu.wr_left)
+        {
+            resp[0] = 0x00;
+            emu.acked = 0;
+            emu_reply(0x13, resp, 1);
+        }
+        return;
+
+    case 0x11: // finalize
+        resp[0] = 0x00;
+        emu_reply(0x12, resp, 1);
+        return;
+
+    case 0x14: // shutdown
+        emu_reply(0x14, NULL, 0);
+        emu.state = EMU_OFF;
+        printf("emu: phone shut down\n");
+        return;
+
+    case 0x20: // GDFS write
+        if (len >= 3)
+            emu_var_set(d[0], d[1], d[2], &d[3], len - 3);
+        resp[0] = 0x00;
+        emu_reply(0x20, resp, 1);
+        return;
+
+    case 0x21: // GDFS read
+    {
+        struct emu_var *v = len >= 3 ? emu_var_find(d[0], d[1], d[2]) : NULL;
+        uint8_t *out = malloc(1 + (v ? v->size : 0));
+        if (!out)
+            return;
+        out[0] = v ? 0x00 : 0x01;
+        if (v)
+            memcpy(out + 1, v->data, v->size);
+        emu_reply(0x21, out, 1 + (v ? v->size : 0));
+        free(out);
+        return;
+    }
+
+    case 0x22: // GDFS activate
+        resp[0] = 0x00;
+        emu_reply(0x1D, resp, 1);
+        return;
+
+    case 0x24: // OTP
+        resp[0] = 0x00;            // status
+        resp[1] = 0x01;            // locked
+        set_half(&resp[2], emu.cid);
+        resp[4] = 0x01;            // paf
+        memcpy(&resp[5], emu.imei, 14);
+        emu_reply(0x24, resp, 19);
+        return;
+
+    case 0x32: // read flash range
+        if (len < 8)
+            break;
+        emu.rd_addr = get_word((uint8_t *)&d[0]);
+        emu.rd_end = get_word((uint8_t *)&d[4]);
+        emu_send_byte(SERIAL_ACK);
+        if (emu.rd_end > emu.rd_addr)
+            emu_read_next();
+        return;
+
+    case 0x3C: // loader upload, first byte = more to come
+        if (len < 1)
+            break;
+        emu_upload_append(d + 1, len - 1);
+        if (d[0])
+        {
+            emu_send_byte(SERIAL_ACK);
+            return;
+        }
+        resp[0] = 0x00;
+        emu.acked = 0;
+        emu_reply(0x3D, resp, 1);
+        if (++emu.upload_parts == 3)
+            emu.start_pending = 1;
+        return;
+
+    case 0x57: // EROM data: domain and CID
+        memset(resp, 0, 10);
+        resp[1] = emu.color;
+        resp[9] = emu.cid;
+        emu_reply(0x57, resp, 10);
+        return;
+    }
+
+    if (emu.verbose)
+        printf("emu: unhandled cmd %02X, NAK\n", cmd);
+    emu_send_byte(SERIAL_NAK);
+}
+
+static size_t emu_loader(const uint8_t *p, size_t n)
+{
+    if (p[0] == SERIAL_ACK)
+    {
+        // bare ACKs mean something only while the host drives a transfer,
+        // otherwise it's the prefix of the next command
+        if (emu.start_pending)
+            emu_send_hello();
+        else if (emu.rd_active)
+            emu_read_next();
+        else if (emu.gd_active)
+            emu_backup_next();
+        else
+            emu.acked = 1;
+        return 1;
+    }
+
+    if (p[0] == SERIAL_NAK && (emu.rd_active || emu.gd_active))
+    {
+        if (emu.last_len)
+            emu_send(emu.last, emu.last_len);
+        return 1;
+    }
+
+    if (p[0] != SERIAL_HDR89)
+    {
+        if (emu.verbose)
+            printf("emu: loader skipping 0x%02X\n", p[0]);
+        emu.acked = 0;
+        return 1;
+    }
+
+    if (n < 4)
+        return 0;
+    size_t len = p[2] | (p[3] << 8);
+    if (n < len + 5)
+        return 0;
+
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len + 4; i++)
+        sum ^= p[i];
+
+    if (((sum + 7) & 0xFF) != p[len + 4])
+    {
+        if (emu.verbose)
+            printf("emu: bad checksum on cmd %02X, NAK\n", p[1]);
+        emu_send_byte(SERIAL_NAK);
+    }
+    else
+    {
+        emu_command(p[1], p + 4, len);
+    }
+
+    emu.acked = 0;
+    return len + 5;
+}
+
+static void emu_process(void)
+{
+    size_t pos = 0;
+
+    while (pos < emu.in_len && emu.connected)
+    {
+        const uint8_t *p = emu.in + pos;
+        size_t n = emu.in_len - pos;
+        size_t used;
+
+        if (emu.state == EMU_OFF)
+            used = n; // powered down, nothing listens
+        else if (emu.state == EMU_LOADER)
+            used = emu_loader(p, n);
+        else
+            used = emu_erom(p, n);
+
+        if (used == 0)
+            break;
+        pos += used;
+    }
+
+    memmove(emu.in, emu.in + pos, emu.in_len - pos);
+    emu.in_len -= pos;
+}
+
+// ------------- session -------------
+
+static void emu_power_on(void)
+{
+    emu.state = EMU_EROM;
+    emu.baud = 9600;
+    emu.in_len = 0;
+    emu.acked = 0;
+    emu.upload_len = 0;
+    emu.upload_parts = 0;
+    emu.start_pending = 0;
+    emu.wr_left = 0;
+    emu.rd_active = 0;
+    emu.gd_active = 0;
+    emu.last_len = 0;
+    emu.rx_clock = emu.tx_clock = 0;
+
+    emu.t_open = get_time_sec();
+    emu.bytes_in = emu.bytes_out = 0;
+    emu.blocks_written = emu.frames_read = 0;
+}
+
+static void emu_session_end(void)
+{
+    double elapsed = get_time_sec() - emu.t_open;
+    printf("emu: host closed after %.1fs, %llu bytes in, %llu out, %u blocks written, %u frames read\n",
+           elapsed, (unsigned long long)emu.bytes_in, (unsigned long long)emu.bytes_out,
+           emu.blocks_written, emu.frames_read);
+    fflush(stdout);
+
+    emu.connected = 0;
+    emu.state = EMU_OFF;
+    tcflush(emu.fd, TCIOFLUSH);
+}
+
+static void emu_run(void)
+{
+    while (!emu_quit)
+    {
+        struct pollfd pfd = {emu.fd, POLLIN, 0};
+        int r = poll(&pfd, 1, 20);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return;
+        }
+
+        // the master reports a hangup while nobody has the slave open
+        if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLIN))
+        {
+            if (emu.connected)
+                emu_session_end();
+            struct timespec ts = {0, 10000000};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        if (!emu.connected)
+        {
+            // give the host a moment to put its end in raw mode
+            struct timespec ts = {0, 50000000};
+            nanosleep(&ts, NULL);
+            tcflush(emu.fd, TCIFLUSH);
+
+            emu.connected = 1;
+            emu_power_on();
+            printf("emu: host connected\n");
+            fflush(stdout);
+            emu_send((const uint8_t *)"Z", 1);
+            continue;
+        }
+
+        if (!(pfd.revents & POLLIN))
+            continue;
+
+        if (emu.in_len == sizeof(emu.in))
+        {
+            fprintf(stderr, "emu: input overflow, dropping %zu bytes\n", emu.in_len);
+            emu.in_len = 0;
+        }
+
+        ssize_t n = read(emu.fd, emu.in + emu.in_len, sizeof(emu.in) - emu.in_len);
+        if (n <= 0)
+        {
+            if (n < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            if (emu.connected)
+                emu_session_end();
+            continue;
+        }
+
+        // the bytes only count as received once they'd have crossed the wire
+        emu_sleep_until(emu_wire(&emu.rx_clock, n));
+        emu.bytes_in += n;
+        emu.in_len += n;
+        emu_process();
+        fflush(stdout);
+    }
+}
+
+static int emu_open_pty(char *slave, size_t slave_size)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+    {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    const char *name = ptsname(fd);
+    if (!name)
+    {
+        perror("ptsname");
+        close(fd);
+        return -1;
+    }
+    snprintf(slave, slave_size, "%s", name);
+
+    // raw from the start, so nothing the phone sends is echoed or line-buffered
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void emu_usage(const char *prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("Virtual phone on a pty, connect with seftool -p pty:<path>\n\n");
+    printf("Options:\n");
+    printf("  --chip <hex>        Chip ID (default 9900, DB2020)\n");
+    printf("  --cid <n>           Certificate CID (default 53)\n");
+    printf("  --color <name>      red, brown, blue or black (default red)\n");
+    printf("  --imei <digits>     14 digit IMEI (default 35000000000000)\n");
+    printf("  --flash-id <hex>    Flash chip ID (default 897E)\n");
+    printf("  --flash-base <hex>  Flash start address (default 44000000)\n");
+    printf("  --flash-size <hex>  Flash size (default 2000000)\n");
+    printf("  --image <file>      Preload flash with a raw image at the flash base\n");
+    printf("  --gdfs <file>       Preload GDFS from a seftool GDFS backup\n");
+    printf("  --gdfs-fill <n>     Extra filler GDFS units (default 256)\n");
+    printf("  --latency <ms>      Turnaround before every reply (default 0)\n");
+    printf("  --corrupt <n>       Bad checksum on every nth flash read frame (default 0, never)\n");
+    printf("  --baud <rate>       Pace the line at this rate instead of following\n");
+    printf("                      S0..S7, 0 = no pacing\n");
+    printf("  --link <path>       Symlink to the pty slave\n");
+    printf("  -v                  Log every command\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *image = NULL;
+    const char *gdfs = NULL;
+    const char *link_path = NULL;
+    int fill = 256;
+
+    emu.chip_id = DB2020;
+    emu.cid = 53;
+    emu.color = 4;
+    emu.flash_id = 0x897E;
+    emu.flash_base = 0x44000000;
+    emu.flash_size = 0x2000000;
+    emu.fixed_baud = -1;
+    snprintf(emu.imei, sizeof(emu.imei), "35000000000000");
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *opt = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(opt, "-h") == 0 || strcmp(opt, "--help") == 0)
+        {
+            emu_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(opt, "-v") == 0)
+        {
+            emu.verbose = 1;
+            continue;
+        }
+        if (!val)
+        {
+            fprintf(stderr, "Unknown or incomplete option %s\n", opt);
+            emu_usage(argv[0]);
+            return 1;
+        }
+        i++;
+
+        if (strcmp(opt, "--chip") == 0)
+            emu.chip_id = strtoul(val, NULL, 16);
+        else if (strcmp(opt, "--cid") == 0)
+            emu.cid = atoi(val);
+        else if (strcmp(opt, "--color") == 0)
+        {
+            if (strcmp(val, "blue") == 0)
+                emu.color = 1;
+            else if (strcmp(val, "brown") == 0)
+                emu.color = 2;
+            else if (strcmp(val, "red") == 0)
+                emu.color = 4;
+            else if (strcmp(val, "black") == 0)
+                emu.color = 8;
+            else
+            {
+                fprintf(stderr, "Unknown color %s\n", val);
+                return 1;
+            }
+        }
+        else if (strcmp(opt, "--imei") == 0)
+        {
+            if (strlen(val) != 14)
+            {
+                fprintf(stderr, "IMEI must be 14 digits\n");
+                return 1;
+            }
+            memcpy(emu.imei, val, 14);
+        }
+        else if (strcmp(opt, "--flash-id") == 0)
+            emu.flash_id = strtoul(val, NULL, 16);
+        else if (strcmp(opt, "--flash-base") == 0)
+            emu.flash_base = strtoul(val, NULL, 16);
+        else if (strcmp(opt, "--flash-size") == 0)
+            emu.flash_size = strtoul(val, NULL, 16);
+        else if (strcmp(opt, "--image") == 0)
+            image = val;
+        else if (strcmp(opt, "--gdfs") == 0)
+            gdfs = val;
+        else if (strcmp(opt, "--gdfs-fill") == 0)
+            fill = atoi(val);
+        else if (strcmp(opt, "--latency") == 0)
+            emu.latency_ms = atoi(val);
+        else if (strcmp(opt, "--corrupt") == 0)
+            emu.corrupt = atoi(val);
+        else if (strcmp(opt, "--baud") == 0)
+            emu.fixed_baud = atoi(val);
+        else if (strcmp(opt, "--link") == 0)
+            link_path = val;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            emu_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    emu.flash = malloc(emu.flash_size);
+    if (!emu.flash)
+    {
+        fprintf(stderr, "Cannot allocate 0x%X bytes of flash\n", emu.flash_size);
+        return 1;
+    }
+    memset(emu.flash, 0xFF, emu.flash_size);
+
+    if (image)
+    {
+        size_t size;
+        uint8_t *buf = load_file(image, &size);
+        if (!buf)
+        {
+            fprintf(stderr, "Cannot read %s\n", image);
+            return 1;
+        }
+        memcpy(emu.flash, buf, size < emu.flash_size ? size : emu.flash_size);
+        free(buf);
+    }
+
+    emu_gdfs_seed(fill);
+    if (gdfs && emu_gdfs_load(gdfs) != 0)
+        return 1;
+
+    char slave[128];
+    emu.fd = emu_open_pty(slave, sizeof(slave));
+    if (emu.fd < 0)
+        return 1;
+
+    if (link_path)
+    {
+        unlink(link_path);
+        if (symlink(slave, link_path) != 0)
+        {
+            fprintf(stderr, "Cannot create %s\n", link_path);
+            return 1;
+        }
+    }
+
+    struct sigaction sa = {0};
+    sa.sa_handler = emu_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("seftool-emu: %s (%04X) CID %d %s, flash %08X-%08X, %zu GDFS units\n",
+           get_chipset_name(emu.chip_id), emu.chip_id, emu.cid,
+           emu.color == 1 ? "blue" : emu.color == 2 ? "brown" : emu.color == 8 ? "black" : "red",
+           emu.flash_base, emu.flash_base + emu.flash_size - 1, emu.nvars);
+    printf("pty: %s\n", slave);
+    fflush(stdout);
+
+    emu_run();
+
+    if (link_path)
+        unlink(link_path);
+    close(emu.fd);
+    free(emu.flash);
+    return 0;
+}
@@ -2,7 +2,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <libserialport.h>
 
 #ifdef _WIN32
 #include <io.h>
@@ -11,6 +10,8 @@
 #include <unistd.h>
 #endif
 
+#include "transport.h"
+#include "babe.h"
 #include "common.h"
 #include "cmd.h"
 #include "csloader.h"
@@ -20,6 +21,10 @@
 #include "serial.h"
 #include "action.h"
 #include "vkp.h"
+#include "vkpapply.h"
+#include "sigscan.h"
+#include "store.h"
+#include "zdump.h"
 
 action_t action_from_string(const char *a)
 {
@@ -41,10 +46,14 @@ action_t action_from_string(const char *a)
         return ACT_UNLOCK;
     if (strcmp(a, "convert") == 0)
         return ACT_CONVERT;
+    if (strcmp(a, "scan") == 0)
+        return ACT_SCAN;
+    if (strcmp(a, "apply-vkp") == 0)
+        return ACT_APPLY_VKP;
     return ACT_NONE;
 }
 
-int unlock_usercode_db2020_pnx5230(struct sp_port *port, struct phone_info *phone)
+int unlock_usercode_db2020_pnx5230(struct transport *port, struct phone_info *phone)
 {
     if (loader_send_csloader(port, phone) != 0)
         return -1;
@@ -58,7 +67,7 @@ int unlock_usercode_db2020_pnx5230(struct sp_port *port, struct phone_info *phon
     return 0;
 }
 
-int unlock_usercode_db2000_db2010(struct sp_port *port, struct phone_info *phone)
+int unlock_usercode_db2000_db2010(struct transport *port, struct phone_info *phone)
 {
     if (loader_enter_flashmode(port, phone) != 0)
         return -1;
@@ -73,7 +82,7 @@ int unlock_usercode_db2000_db2010(struct sp_port *port, struct phone_info *phone
     return 0;
 }
 
-int action_unlock_usercode(struct sp_port *port, struct phone_info *phone)
+int action_unlock_usercode(struct transport *port, struct phone_info *phone)
 {
     switch (phone->chip_id)
     {
@@ -92,7 +101,7 @@ int action_unlock_usercode(struct sp_port *port, struct phone_info *phone)
 }
 
 // Return number of bytes received, or -1 on error
-int pnx_send_packet(struct sp_port *port,
+int pnx_send_packet(struct transport *port,
                     uint8_t block, uint8_t msb, uint8_t lsb,
                     uint8_t *resp, size_t resp_max)
 {
@@ -126,7 +135,7 @@ int pnx_send_packet(struct sp_port *port,
     return datasize;
 }
 
-int dump_sec_units_pnx(struct sp_port *port, const char *backup_name)
+int dump_sec_units_pnx(struct transport *port, const char *backup_name)
 {
     FILE *f = fopen(backup_name, "a");
     if (!f)
@@ -177,7 +186,7 @@ int dump_sec_units_pnx(struct sp_port *port, const char *backup_name)
     return 0;
 }
 
-int action_identify_pnx(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int action_identify_pnx(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     printf("Phone Info (from GDFS):\n");
 
@@ -271,7 +280,7 @@ int action_identify_pnx(struct sp_port *port, struct phone_info *phone, struct g
     return 0;
 }
 
-int action_identify(struct sp_port *port, struct phone_info *phone)
+int action_identify(struct transport *port, struct phone_info *phone)
 {
     struct gdfs_data_t gdfs = {0};
 
@@ -336,11 +345,53 @@ int action_identify(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int action_flash_fw(struct sp_port *port, struct phone_info *phone, const char *main_fw, const char *fs_fw)
+// 1 when path is a BABE without a signature (raw2babe, apply-vkp), checked
+// before any loader goes out
+static int action_babe_unsigned(const char *path)
 {
+    size_t size;
+    const uint8_t *file = map_file(path, &size);
+    if (!file)
+        return 0; // flash_babe_fw() reports it
+    int unsigned_babe = !babe_is_signed(file, size);
+    unmap_file(file, size);
+    return unsigned_babe;
+}
+
+int action_flash_fw(struct transport *port, struct phone_info *phone, const char *main_fw, const char *fs_fw)
+{
+    const char *loader;
     if (phone->erom_cid == 49 &&
         (phone->chip_id == DB2000 || phone->chip_id == DB2010_1 || phone->chip_id == DB2010_2) &&
         phone->break_rsa == 1)
+        loader = "bflash";
+    else
+        loader = "oflash";
+
+    // the delta BABE is unsigned and the comparison reads back with 0x32,
+    // the signed production loader takes neither
+    if (flash_delta != FLASH_DELTA_OFF && strcmp(loader, "bflash") != 0)
+    {
+        fprintf(stderr, "Error: --delta needs the bflash loader (CID49 DB2000/DB2010 with --break-rsa)\n");
+        return -1;
+    }
+
+    // the signed loader checks the header signature before it writes a byte
+    if (strcmp(loader, "bflash") != 0)
+    {
+        const char *files[2] = {main_fw, fs_fw};
+        for (int i = 0; i < 2; i++)
+        {
+            if (files[i] && action_babe_unsigned(files[i]))
+            {
+                fprintf(stderr, "Error: %s is not signed, it needs the bflash loader (CID49 DB2000/DB2010 with --break-rsa)\n",
+                        files[i]);
+                return -1;
+            }
+        }
+    }
+
+    if (strcmp(loader, "bflash") == 0)
     {
         printf("Bypass RSA\n");
         if (loader_send_bflash_ldr(port, phone) != 0)
@@ -352,22 +403,48 @@ int action_flash_fw(struct sp_port *port, struct phone_info *phone, const char *
             return -1;
     }
 
-    if (flash_babe_fw(port, main_fw, 1) != 0)
+    // the IMEI is only known once the loader is up
+    struct flash_journal journal;
+    flash_journal_init(&journal, phone->otp_imei, loader);
+    if (phone->resume)
+    {
+        if (flash_journal_load(&journal) != 0)
+        {
+            fprintf(stderr, "Error: nothing to resume, %s not found\n", journal.path);
+            return -1;
+        }
+        if (strcmp(journal.loader, loader) != 0)
+        {
+            fprintf(stderr, "Error: interrupted flash used the %s loader, this one needs %s\n",
+                    journal.loader, loader);
+            return -1;
+        }
+        printf("Resuming flash from %s\n", journal.path);
+    }
+    else if (access(journal.path, 0) == 0)
+    {
+        printf("Starting over, an interrupted flash of this phone could have been resumed with --resume\n");
+    }
+
+    if (flash_babe_fw(port, phone, main_fw, 1, &journal) != 0)
         return -1;
 
     if (fs_fw)
     {
-        if (flash_babe_fw(port, fs_fw, 1) != 0)
+        if (flash_babe_fw(port, phone, fs_fw, 1, &journal) != 0)
             return -1;
     }
 
+    flash_journal_remove(&journal);
     return 0;
 }
 
-int action_read_flash(struct sp_port *port, struct phone_info *phone, uint32_t addr, uint32_t size)
+int action_read_flash(struct transport *port, struct phone_info *phone, uint32_t addr, uint32_t size)
 {
     if (loader_send_bflash_ldr(port, phone) != 0)
         return -1;
+    if (flash_cache_open(phone) != 0)
+        return -1;
 
     if (phone->anycid == 1 || phone->break_rsa == 1)
     {
@@ -381,7 +458,7 @@ int action_read_flash(struct sp_port *port, struct phone_info *phone, uint32_t a
     return 0;
 }
 
-int action_restore_gdfs(struct sp_port *port, struct phone_info *phone, const char *inputfname)
+int action_restore_gdfs(struct transport *port, struct phone_info *phone, const char *inputfname)
 {
     if (loader_send_csloader(port, phone) != 0)
         return -1;
@@ -395,7 +472,7 @@ int action_restore_gdfs(struct sp_port *port, struct phone_info *phone, const ch
     return 0;
 }
 
-int action_backup_gdfs(struct sp_port *port, struct phone_info *phone)
+int action_backup_gdfs(struct transport *port, struct phone_info *phone)
 {
     if (loader_send_csloader(port, phone) != 0)
         return -1;
@@ -409,7 +486,7 @@ int action_backup_gdfs(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int action_exec_scripts(struct sp_port *port, struct phone_info *phone,
+int action_exec_scripts(struct transport *port, struct phone_info *phone,
                         int nfiles, const char **filenames)
 {
     int rc = 0;
@@ -437,6 +514,8 @@ int action_exec_scripts(struct sp_port *port, struct phone_info *phone,
         // --- Prepare bflash loader once ---
         if (loader_send_bflash_ldr(port, phone) != 0)
             return -1;
+        if (flash_cache_open(phone) != 0)
+            return -1;
 
         if (phone->anycid == 1 || phone->break_rsa == 1)
         {
@@ -446,42 +525,46 @@ int action_exec_scripts(struct sp_port *port, struct phone_info *phone,
 
         int patched_count = 0;
         int skipped_count = 0;
+        int parsed = 0;
+        vkp_patch_t *patches = calloc(nfiles, sizeof(vkp_patch_t));
+        const char **names = calloc(nfiles, sizeof(const char *));
+        if (!patches || !names)
+        {
+            free(patches);
+            free(names);
+            return -1;
+        }
 
-        // --- Loop over VKP patches ---
+        // --- Parse all VKP patches, then flash them together ---
         for (int i = 0; i < nfiles; i++)
         {
             const char *fname = filenames[i];
-            vkp_patch_t patch;
-            vkp_patch_init(&patch);
+            vkp_patch_t *patch = &patches[parsed];
+            vkp_patch_init(patch);
 
-            if (vkp_load_file(fname, &patch) != 0)
+            if (vkp_load_file(fname, patch) != 0)
             {
                 fprintf(stderr, "Failed to parse VKP file: %s\n", fname);
-                vkp_patch_free(&patch);
+                vkp_patch_free(patch);
                 rc = -1;
                 continue; // try next patch
             }
 
             printf("\n%s parsed successfully, %zu byte(s)\n",
-                   fname, patch.patch.count);
-
-            int vkp_rc = flash_vkp(port, fname, &patch, 0, phone->flashblocksize);
-            if (vkp_rc == FLASH_VKP_SKIP)
-            {
-                skipped_count++;
-                vkp_patch_free(&patch);
-                continue; // keep processing others
-            }
-            if (vkp_rc == FLASH_VKP_ERR)
-            {
-                vkp_patch_free(&patch);
-                rc = -1;
-                break;
-            }
-            patched_count++;
-            vkp_patch_free(&patch);
+                   fname, patch->patch.count);
+            names[parsed++] = fname;
         }
 
+        if (parsed > 0 &&
+            flash_vkp_batch(port, parsed, names, patches, 0, phone,
+                            &patched_count, &skipped_count) != FLASH_VKP_OK)
+            rc = -1;
+
+        for (int i = 0; i < parsed; i++)
+            vkp_patch_free(&patches[i]);
+        free(patches);
+        free(names);
+
         printf("\nSummary: %d patched, %d skipped\n\n", patched_count, skipped_count);
     }
     else
@@ -538,6 +621,55 @@ int action_convert(const char *cnv_mode, const char *cnv_filename, uint32_t mem_
             return -1;
         }
     }
+    else if (strcmp(cnv_mode, "zdump2raw") == 0)
+    {
+        snprintf(outname, sizeof(outname), "%s.bin", cnv_filename);
+        if (zdump_to_raw_file(cnv_filename, outname) != 0)
+        {
+            fprintf(stderr, "Error: failed to convert zdump to raw\n");
+            return -1;
+        }
+    }
+    else if (strcmp(cnv_mode, "store2raw") == 0)
+    {
+        snprintf(outname, sizeof(outname), "%s.bin", cnv_filename);
+        if (store_to_raw_file(cnv_filename, outname) != 0)
+        {
+            fprintf(stderr, "Error: failed to rebuild raw from the store\n");
+            return -1;
+        }
+    }
+    else if (strcmp(cnv_mode, "store2babe") == 0)
+    {
+        snprintf(outname, sizeof(outname), "%s.ssw", cnv_filename);
+        if (store_to_babe_file(cnv_filename, outname) != 0)
+        {
+            fprintf(stderr, "Error: failed to rebuild babe from the store\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// inventory of a dump: fw ids, article numbers, BABE headers, loaders
+int action_scan(const char *filename)
+{
+    if (sigscan_report(filename) != 0)
+    {
+        fprintf(stderr, "Error: failed to scan %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
 
+int action_apply_vkp(const char *image, int has_addr, uint32_t addr, int nfiles,
+                     const char **filenames, int remove_flag, int babe_v4, const char *header)
+{
+    if (vkpapply_file(image, has_addr, addr, nfiles, filenames, remove_flag, babe_v4, header) != 0)
+    {
+        fprintf(stderr, "Error: failed to patch %s\n", image);
+        return -1;
+    }
     return 0;
 }
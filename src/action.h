@@ -14,18 +14,23 @@ typedef enum
     ACT_WRITE_GDFS,
     ACT_WRITE_SCRIPT,
     ACT_CONVERT,
+    ACT_SCAN,
+    ACT_APPLY_VKP,
 } action_t;
 
 action_t action_from_string(const char *a);
 
-int action_unlock_usercode(struct sp_port *port, struct phone_info *phone);
-int action_identify(struct sp_port *port, struct phone_info *phone);
-int action_flash_fw(struct sp_port *port, struct phone_info *phone, const char *main_fw, const char *fs_fw);
-int action_read_flash(struct sp_port *port, struct phone_info *phone, uint32_t addr, uint32_t size);
-int action_backup_gdfs(struct sp_port *port, struct phone_info *phone);
-int action_restore_gdfs(struct sp_port *port, struct phone_info *phone, const char *inputfname);
-int action_exec_scripts(struct sp_port *port, struct phone_info *phone,
+int action_unlock_usercode(struct transport *port, struct phone_info *phone);
+int action_identify(struct transport *port, struct phone_info *phone);
+int action_flash_fw(struct transport *port, struct phone_info *phone, const char *main_fw, const char *fs_fw);
+int action_read_flash(struct transport *port, struct phone_info *phone, uint32_t addr, uint32_t size);
+int action_backup_gdfs(struct transport *port, struct phone_info *phone);
+int action_restore_gdfs(struct transport *port, struct phone_info *phone, const char *inputfname);
+int action_exec_scripts(struct transport *port, struct phone_info *phone,
                         int nfiles, const char **filenames);
 int action_convert(const char *cnv_mode, const char *cnv_filename, uint32_t mem_addr);
+int action_scan(const char *filename);
+int action_apply_vkp(const char *image, int has_addr, uint32_t addr, int nfiles,
+                     const char **filenames, int remove_flag, int babe_v4, const char *header);
 
 #endif // se_h
@@ -2,8 +2,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <libserialport.h>
 
+#include "transport.h"
 #include "babe.h"
 #include "certz.h"
 #include "common.h"
@@ -67,72 +67,177 @@ struct babehdr_t cidz[26] = {
     {0xBEBA, 0x0, 0x3, 0x60, 0x10000, 0x20, 0x10, 0xC1, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x1E001, 0x171A, 0x171A, 0x0, 0x1, 0x1, 0xFFFFFFFF, 0xBB, 0x1B, 0xCF, 0xBB, 0x64, 0xD1, 0xD9, 0xED, 0x5C, 0x12, 0x8E, 0x9, 0x6A, 0xA3, 0xB3, 0x11, 0x76, 0xFF, 0x76, 0x5A, 0xCE, 0xC2, 0x4A, 0xFA, 0xB3, 0xF9, 0xF1, 0x15, 0xDB, 0xC0, 0x7D, 0x92, 0x6B, 0x26, 0xA8, 0x6F, 0x7F, 0xBA, 0x56, 0xC6, 0x96, 0x9D, 0x2C, 0x74, 0xC1, 0x48, 0x91, 0x9A, 0xAA, 0xB6, 0x82, 0xE4, 0xA2, 0x7C, 0xA0, 0xBE, 0x84, 0x68, 0xB1, 0x47, 0x9, 0x2D, 0x2B, 0xB6, 0x3E, 0x80, 0x7, 0x13, 0xDE, 0xC, 0x8E, 0x6E, 0x13, 0xDE, 0xA7, 0xCE, 0xD, 0x13, 0x98, 0x5B, 0xED, 0x9C, 0x7E, 0x72, 0x65, 0x3F, 0x5A, 0x17, 0x5E, 0x7D, 0x4E, 0x83, 0x5, 0x40, 0x91, 0x75, 0x8A, 0x93, 0x39, 0xBB, 0x8E, 0x30, 0xAF, 0x5B, 0x3E, 0x93, 0xB0, 0xF0, 0x5E, 0x69, 0xD6, 0xE7, 0x9F, 0xAA, 0xC5, 0xD, 0x90, 0x82, 0x78, 0x28, 0xF6, 0xAD, 0xCC, 0x1, 0x5E, 0x94, 0x92, 0x6C, 0x0, 0x0, 0x0, 0x0, 0x0, 0xC1, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x0, 0xA0E0, 0xA0E0, 0x10, 0x1, 0x1, 0xFFFFFFFF, 0x7B, 0xD5, 0x64, 0xD9, 0x69, 0xCA, 0xEE, 0x35, 0x54, 0x5A, 0xA1, 0xE, 0x27, 0x88, 0x9A, 0x61, 0x2C, 0xB2, 0xC2, 0x2E, 0x95, 0xF2, 0xED, 0x7F, 0x8, 0xAB, 0xDF, 0x77, 0xAD, 0x89, 0xFF, 0x3E, 0x1E, 0x94, 0x94, 0x18, 0x65, 0x9A, 0x66, 0xC, 0xF2, 0xE5, 0xB3, 0x6D, 0x29, 0x81, 0x11, 0xA5, 0x85, 0x29, 0x5A, 0xA2, 0xB0, 0x2C, 0x27, 0x4D, 0x7, 0x47, 0x77, 0x6, 0x3, 0x1E, 0x1D, 0xE5, 0xC5, 0x16, 0x46, 0x84, 0x65, 0xC7, 0xFD, 0x91, 0xEF, 0x67, 0x64, 0x49, 0xF9, 0x4E, 0x62, 0x67, 0xCE, 0x12, 0x21, 0x83, 0x62, 0xE0, 0xCB, 0x94, 0x25, 0x8, 0x1B, 0x2E, 0xC6, 0x1D, 0x53, 0x2, 0xA9, 0x1A, 0xA8, 0xE9, 0xC, 0x9A, 0x1B, 0xCD, 0x18, 0xE1, 0xFF, 0x96, 0xC2, 0xA1, 0x9D, 0x6E, 0x6F, 0xF6, 0x47, 0xAC, 0x30, 0xAB, 0xFD, 0x11, 0x3, 0xFD, 0xFC, 0xC9, 0x30, 0xA4, 0xC9, 0x5A} //------------------------------------------------------------------
 };
 
-int babe_check(uint8_t *file, size_t size, int checktype)
+// --- babe_index_build ---
+// Walks the block headers once. Returns CHECKBABE_OK, CHECKBABE_NOTFULL
+// (file ends on a block boundary before the last block) or CHECKBABE_BADFILE
+// (truncated block); idx->count holds the complete blocks either way.
+int babe_index_build(const uint8_t *file, size_t size, struct babe_index *idx)
 {
-    int i;
-    uint8_t hash[SHA1_BLOCK_SIZE];
-    SHA1_CTX sha, shacopy;
+    memset(idx, 0, sizeof(*idx));
 
-    struct babehdr_t *babehdr = (struct babehdr_t *)file;
-
-    if (babehdr->sig != 0xBEBA)
+    const struct babehdr_t *babehdr = (const struct babehdr_t *)file;
+    if (size < sizeof(struct babehdr_t) || babehdr->sig != 0xBEBA)
         return CHECKBABE_NOTBABE;
 
-    int platform = babehdr->platform;
-    int hashsize = babehdr->ver >= 4 ? 20 : 1;
+    idx->hashsize = babehdr->ver >= 4 ? 20 : 1;
+    idx->blocks = babehdr->payloadsize1;
+    idx->hdrsize = (babehdr->ver <= 2) ? 0x480 : idx->blocks * idx->hashsize + 0x380;
 
-    int cid = babehdr->cid;
-    int color = babehdr->color;
-    int blocks = babehdr->payloadsize1;
-    int hdrsize = (babehdr->ver <= 2) ? 0x480 : blocks * hashsize + 0x380;
+    if (idx->blocks < 0 || idx->hdrsize > size)
+        return CHECKBABE_BADFILE;
 
-    if (checktype)
-    {
-        for (i = 0; i < (int)(sizeof(certz) / sizeof(certz[0])); i++)
-        {
-            if ((certz[i].platform & platform) &&
-                (certz[i].cid == cid) &&
-                (certz[i].color == color))
-                break;
-        }
-        if (i == (int)(sizeof(certz) / sizeof(certz[0])))
-            return CHECKBABE_CANTCHECK;
-
-        sha1_init(&sha);
-        sha1_update(&sha, file, 0x3C);
-        sha1_update(&sha, certz[i].cert, 0x1E8);
-        sha1_update(&sha, file + 0x3C + 0x1E8, 0x300 - (0x3C + 0x1E8));
-    }
+    // never trust the header for the allocation, a block takes 8 bytes at least
+    size_t maxblocks = (size - idx->hdrsize) / 8;
+    size_t nalloc = (size_t)idx->blocks < maxblocks ? (size_t)idx->blocks : maxblocks;
+    idx->block = calloc(nalloc ? nalloc : 1, sizeof(struct babe_block));
+    if (!idx->block)
+        return CHECKBABE_BADFILE;
 
-    size_t curpos = hdrsize;
-    for (int block = 0; block < blocks; block++)
+    size_t curpos = idx->hdrsize;
+    for (int block = 0; block < idx->blocks; block++)
     {
         if (curpos == size)
             return CHECKBABE_NOTFULL;
         if (curpos + 8 > size)
             return CHECKBABE_BADFILE;
 
-        size_t blsize = ((uint32_t *)&file[curpos])[1];
-        if (blsize + curpos + 8 > (uint32_t)size)
+        uint32_t blsize = get_word((uint8_t *)file + curpos + 4);
+        if (blsize > size - curpos - 8)
             return CHECKBABE_BADFILE;
 
-        if (checktype)
-        {
-            sha1_update(&sha, file + curpos, 8);
-            curpos += 8;
-            sha1_update(&sha, file + curpos, blsize);
-            curpos += blsize;
+        struct babe_block *b = &idx->block[idx->count++];
+        b->offset = curpos;
+        b->addr = get_word((uint8_t *)file + curpos);
+        b->size = blsize;
+
+        curpos += 8 + blsize;
+    }
+    return CHECKBABE_OK;
+}
+
+void babe_index_free(struct babe_index *idx)
+{
+    free(idx->block);
+    idx->block = NULL;
+    idx->count = 0;
+}
+
+// --- streaming verify ---
+// Seeds the hash chain: header up to the certificate, the certificate from
+// certz (the file carries a placeholder), then the rest of the signed header.
+// Without a matching certificate the header's own certificate area is used
+// and CHECKBABE_CANTCHECK returned.
+static int babe_chain_seed(SHA1_CTX *sha, const uint8_t *file)
+{
+    int i;
+    const struct babehdr_t *babehdr = (const struct babehdr_t *)file;
+    int platform = babehdr->platform;
+    int cid = babehdr->cid;
+    int color = babehdr->color;
+
+    for (i = 0; i < (int)(sizeof(certz) / sizeof(certz[0])); i++)
+    {
+        if ((certz[i].platform & platform) &&
+            (certz[i].cid == cid) &&
+            (certz[i].color == color))
+            break;
+    }
+
+    int found = i < (int)(sizeof(certz) / sizeof(certz[0]));
+    sha1_init(sha);
+    sha1_update(sha, file, 0x3C);
+    sha1_update(sha, found ? certz[i].cert : file + 0x3C, 0x1E8);
+    sha1_update(sha, file + 0x3C + 0x1E8, 0x300 - (0x3C + 0x1E8));
+    return found ? CHECKBABE_OK : CHECKBABE_CANTCHECK;
+}
+
+int babe_verify_start(struct babe_verify *v, const uint8_t *file, const struct babe_index *idx)
+{
+    memset(v, 0, sizeof(*v));
+
+    if (babe_chain_seed(&v->sha, file) != CHECKBABE_OK)
+        return CHECKBABE_CANTCHECK;
+
+    v->file = file;
+    v->idx = idx;
+    return CHECKBABE_OK;
+}
+
+// Advances the chain through block `upto` (blocks before it that were not
+// hashed yet go in first, the chain only runs in file order).
+int babe_verify_block(struct babe_verify *v, int upto)
+{
+    uint8_t hash[SHA1_BLOCK_SIZE];
+    SHA1_CTX shacopy;
+    const struct babe_index *idx = v->idx;
+
+    if (upto >= idx->count)
+        upto = idx->count - 1;
+
+    for (; v->next <= upto; v->next++)
+    {
+        const struct babe_block *b = &idx->block[v->next];
+        sha1_update(&v->sha, v->file + b->offset, 8 + b->size);
 
-            memcpy(&shacopy, &sha, sizeof(SHA1_CTX));
-            sha1_final(&shacopy, hash);
+        memcpy(&shacopy, &v->sha, sizeof(SHA1_CTX));
+        sha1_final(&shacopy, hash);
 
-            if (memcmp(hash + 20 - hashsize, file + sizeof(struct babehdr_t) + block * hashsize, hashsize) != 0)
-                return CHECKBABE_BADFILE;
-        }
+        if (memcmp(hash + 20 - idx->hashsize, v->file + sizeof(struct babehdr_t) + v->next * idx->hashsize,
+                   idx->hashsize) != 0)
+            return CHECKBABE_BADFILE;
     }
     return CHECKBABE_OK;
 }
 
+// Rewrites the per block hashes (v3 and up) after the blocks or the header
+// changed, the way babe_verify_block() checks them. The header signature
+// is not touched, it no longer matches. CHECKBABE_CANTCHECK: no certificate for this header, see
+// babe_chain_seed().
+int babe_rehash(uint8_t *file, const struct babe_index *idx)
+{
+    uint8_t hash[SHA1_BLOCK_SIZE];
+    SHA1_CTX sha, shacopy;
+
+    int rc = babe_chain_seed(&sha, file);
+    for (int b = 0; b < idx->count; b++)
+    {
+        sha1_update(&sha, file + idx->block[b].offset, 8 + idx->block[b].size);
+
+        memcpy(&shacopy, &sha, sizeof(SHA1_CTX));
+        sha1_final(&shacopy, hash);
+        memcpy(file + sizeof(struct babehdr_t) + b * idx->hashsize, hash + 20 - idx->hashsize, idx->hashsize);
+    }
+    return rc;
+}
+
+// --- babe_check_index ---
+// Verifies the hash chain over the indexed blocks, no second walk of the file.
+int babe_check_index(const uint8_t *file, const struct babe_index *idx, int checktype)
+{
+    struct babe_verify v;
+
+    if (!checktype)
+        return CHECKBABE_OK;
+
+    int rc = babe_verify_start(&v, file, idx);
+    if (rc != CHECKBABE_OK)
+        return rc;
+    return babe_verify_block(&v, idx->count - 1);
+}
+
+int babe_check(uint8_t *file, size_t size, int checktype)
+{
+    struct babe_index idx;
+    int rc = babe_index_build(file, size, &idx);
+    if (rc == CHECKBABE_NOTBABE)
+        return rc;
+
+    // certificate and hash errors win over a short file, same as before
+    int hrc = babe_check_index(file, &idx, checktype);
+    babe_index_free(&idx);
+    return hrc != CHECKBABE_OK ? hrc : rc;
+}
+
 int babe_is_valid(uint8_t *addr, size_t size)
 {
     if (size < sizeof(struct babehdr_t))
@@ -146,3 +251,18 @@ int babe_is_valid(uint8_t *addr, size_t size)
 
     return (v1 + v2 + 0x380 == size);
 }
+
+// A BABE made or patched here has no RSA signature, its hash2 is zero.
+// Anything else, even not a BABE, counts as signed and is left to the
+// checks that follow.
+int babe_is_signed(const uint8_t *file, size_t size)
+{
+    if (size < sizeof(struct babehdr_t) || file[0] != 0xBA || file[1] != 0xBE)
+        return 1;
+
+    const struct babehdr_t *hdr = (const struct babehdr_t *)file;
+    for (size_t i = 0; i < sizeof(hdr->hash2); i++)
+        if (hdr->hash2[i])
+            return 1;
+    return 0;
+}
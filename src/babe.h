@@ -1,8 +1,11 @@
 #ifndef babe_h
 #define babe_h
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "sha1.h"
+
 #pragma pack(push, 1)
 struct babehdr_t
 {
@@ -54,8 +57,42 @@ enum
     UNKNOWN = 0x4E4B4E55, //'UNKN' //?????????
 };
 
+// one payload block: [addr4][size4][data]
+struct babe_block
+{
+    size_t offset; // of the 8 byte block header
+    uint32_t addr;
+    uint32_t size;
+};
+
+// block layout of a BABE file, built once and shared by check, delta and flash
+struct babe_index
+{
+    size_t hdrsize;  // header + per block hashes
+    size_t hashsize; // 1 (v3) or 20 (v4+)
+    int blocks;      // declared in the header
+    int count;       // complete blocks in the file
+    struct babe_block *block;
+};
+
+// hash chain state, advanced block by block while the blocks go out
+struct babe_verify
+{
+    SHA1_CTX sha;
+    const uint8_t *file;
+    const struct babe_index *idx;
+    int next; // first block not hashed yet
+};
+
 int babe_check(uint8_t *file, size_t size, int checktype);
+int babe_verify_start(struct babe_verify *v, const uint8_t *file, const struct babe_index *idx);
+int babe_verify_block(struct babe_verify *v, int upto);
+int babe_index_build(const uint8_t *file, size_t size, struct babe_index *idx);
+int babe_check_index(const uint8_t *file, const struct babe_index *idx, int checktype);
+int babe_rehash(uint8_t *file, const struct babe_index *idx);
+void babe_index_free(struct babe_index *idx);
 int babe_is_valid(uint8_t *addr, size_t size);
+int babe_is_signed(const uint8_t *file, size_t size);
 
 typedef enum
 {
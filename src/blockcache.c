@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "blockcache.h"
+#include "sha1.h"
+
+// backup/blocks_<imei>.txt: a "# flash <id>" line, then one line per
+// block: addr size sha1
+
+void blockcache_digest(const uint8_t *data, size_t size, uint8_t sha1[20])
+{
+    SHA1_CTX sha;
+    sha1_init(&sha);
+    sha1_update(&sha, data, size);
+    sha1_final(&sha, sha1);
+}
+
+// index of the first entry at or above addr
+static size_t blockcache_lower(const struct blockcache *c, uint32_t addr)
+{
+    size_t lo = 0, hi = c->count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (c->e[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// a digest that is already known, e.g. from a dump manifest
+int blockcache_set(struct blockcache *c, uint32_t addr, uint32_t size, const uint8_t sha1[20])
+{
+    size_t i = blockcache_lower(c, addr);
+    if (i == c->count || c->e[i].addr != addr)
+    {
+        if (c->count >= c->capacity)
+        {
+            size_t newcap = c->capacity ? c->capacity * 2 : 256;
+            struct blockcache_entry *ne = realloc(c->e, newcap * sizeof(*ne));
+            if (!ne)
+                return -1;
+            c->e = ne;
+            c->capacity = newcap;
+        }
+        memmove(&c->e[i + 1], &c->e[i], (c->count - i) * sizeof(*c->e));
+        c->count++;
+    }
+
+    c->e[i].addr = addr;
+    c->e[i].size = size;
+    memcpy(c->e[i].sha1, sha1, 20);
+    return 0;
+}
+
+// 0 = ready (a missing file is an empty cache), -1 = error
+int blockcache_open(struct blockcache *c, const char *imei, int flash_id)
+{
+    memset(c, 0, sizeof(*c));
+    snprintf(c->path, sizeof(c->path), "./backup/blocks_%s.txt", imei);
+    c->flash_id = flash_id;
+
+    FILE *f = fopen(c->path, "r");
+    if (!f)
+        return 0;
+
+    char line[128];
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned id;
+        if (sscanf(line, "# flash %x", &id) == 1)
+        {
+            if ((int)id != flash_id)
+                break; // another chip, nothing here applies
+            continue;
+        }
+
+        unsigned addr, size;
+        char hex[41];
+        uint8_t sha1[20];
+        if (sscanf(line, "%x %x %40s", &addr, &size, hex) != 3 || strlen(hex) != 40)
+            continue;
+
+        for (int i = 0; i < 20; i++)
+        {
+            unsigned b;
+            sscanf(hex + i * 2, "%2x", &b);
+            sha1[i] = (uint8_t)b;
+        }
+        if (blockcache_set(c, addr, size, sha1) != 0)
+        {
+            fclose(f);
+            blockcache_close(c);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+const struct blockcache_entry *blockcache_find(const struct blockcache *c, uint32_t addr)
+{
+    size_t i = blockcache_lower(c, addr);
+    if (i < c->count && c->e[i].addr == addr)
+        return &c->e[i];
+    return NULL;
+}
+
+int blockcache_put(struct blockcache *c, uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    uint8_t sha1[20];
+    blockcache_digest(data, size, sha1);
+    return blockcache_set(c, addr, size, sha1);
+}
+
+// drops every block that overlaps addr .. addr + size
+void blockcache_invalidate(struct blockcache *c, uint32_t addr, uint32_t size)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < c->count; i++)
+    {
+        const struct blockcache_entry *e = &c->e[i];
+        if (e->addr < addr + size && addr < e->addr + e->size)
+            continue;
+        c->e[n++] = *e;
+    }
+    c->count = n;
+}
+
+int blockcache_save(const struct blockcache *c)
+{
+    FILE *f = fopen(c->path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Error: Cannot write %s\n", c->path);
+        return -1;
+    }
+
+    fprintf(f, "# flash %04X\n", c->flash_id);
+    for (size_t i = 0; i < c->count; i++)
+    {
+        fprintf(f, "%08X %X ", c->e[i].addr, c->e[i].size);
+        for (int j = 0; j < 20; j++)
+            fprintf(f, "%02x", c->e[i].sha1[j]);
+        fprintf(f, "\n");
+    }
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void blockcache_close(struct blockcache *c)
+{
+    free(c->e);
+    c->e = NULL;
+    c->count = c->capacity = 0;
+}
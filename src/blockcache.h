@@ -0,0 +1,38 @@
+#ifndef blockcache_h
+#define blockcache_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// What is known to be in the phone's flash, per IMEI: one SHA1 per block,
+// taken from what was last read or flashed. Kept sorted by address.
+// The blocks being written are dropped before each write to the phone and
+// recorded once it is finalized, so an interrupted write leaves them
+// unknown instead of stale.
+struct blockcache_entry
+{
+    uint32_t addr;
+    uint32_t size;
+    uint8_t sha1[20];
+};
+
+struct blockcache
+{
+    char path[64];
+    int flash_id; // a different flash chip under the same IMEI starts empty
+    struct blockcache_entry *e;
+    size_t count;
+    size_t capacity;
+};
+
+void blockcache_digest(const uint8_t *data, size_t size, uint8_t sha1[20]);
+
+int blockcache_open(struct blockcache *c, const char *imei, int flash_id);
+const struct blockcache_entry *blockcache_find(const struct blockcache *c, uint32_t addr);
+int blockcache_put(struct blockcache *c, uint32_t addr, const uint8_t *data, uint32_t size);
+int blockcache_set(struct blockcache *c, uint32_t addr, uint32_t size, const uint8_t sha1[20]);
+void blockcache_invalidate(struct blockcache *c, uint32_t addr, uint32_t size);
+int blockcache_save(const struct blockcache *c);
+void blockcache_close(struct blockcache *c);
+
+#endif // blockcache_h
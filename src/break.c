@@ -3,8 +3,8 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdint.h>
-#include <libserialport.h>
 
+#include "transport.h"
 #include "babe.h"
 #include "certz.h"
 #include "common.h"
@@ -19,7 +19,7 @@
 #define TAILBLOCKSSIZE 4
 #define MAX_HASH_VALUE 0x000FFFFF
 
-int break_build_bootname(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int break_build_bootname(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     if (loader_activate_gdfs(port) != 0)
         return -1;
@@ -74,7 +74,7 @@ int break_build_bootname(struct sp_port *port, struct phone_info *phone, struct
     return 0;
 }
 
-int break_cid49(struct sp_port *port, struct phone_info *phone)
+int break_cid49(struct transport *port, struct phone_info *phone)
 {
     char bootname[128], osename[128], hdrname[128];
     snprintf(bootname, sizeof(bootname), "./break49/%s", phone->bootname);
@@ -260,7 +260,7 @@ int break_cid49(struct sp_port *port, struct phone_info *phone)
     return rc;
 }
 
-int break_cid36(struct sp_port *port, struct phone_info *phone)
+int break_cid36(struct transport *port, struct phone_info *phone)
 {
     printf("Breaking rabbit hole...=) \n");
 
@@ -1,8 +1,8 @@
 #ifndef breah_h
 #define breah_h
 
-int break_cid36(struct sp_port *port, struct phone_info *phone);
-int break_cid49(struct sp_port *port, struct phone_info *phone);
-int break_build_bootname(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int break_cid36(struct transport *port, struct phone_info *phone);
+int break_cid49(struct transport *port, struct phone_info *phone);
+int break_build_bootname(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
 
 #endif // breah_h
\ No newline at end of file
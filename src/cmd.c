@@ -131,6 +131,12 @@ int cmd_decode_packet_ack(const uint8_t *buf, int size, struct packetdata_t *out
 	out->cmd = buf[2]; // command ID
 	out->length = buf[3] | (buf[4] << 8);
 
+	if (out->length > sizeof(out->data))
+	{
+		fprintf(stderr, "Reply too long: %d bytes\n", out->length);
+		return -1;
+	}
+
 	if (size < 5 + out->length + 1)
 	{
 		fprintf(stderr, "Reply length mismatch: expected %d got %d\n",
@@ -179,6 +185,12 @@ int cmd_decode_packet_noack(const uint8_t *buf, int size, struct packetdata_t *o
 	out->cmd = buf[1]; // command ID
 	out->length = buf[2] | (buf[3] << 8);
 
+	if (out->length > sizeof(out->data))
+	{
+		fprintf(stderr, "Reply too long: %d bytes\n", out->length);
+		return -1;
+	}
+
 	if (size < 4 + out->length + 1)
 	{
 		fprintf(stderr, "Reply length mismatch: expected %d got %d\n",
@@ -3,13 +3,15 @@
 
 #include <stdint.h>
 
+#define PACKET_DATA_MAX 0x1000
+
 struct packetdata_t
 {
     uint8_t ack;
     uint8_t hdr;
     uint8_t cmd;
     uint16_t length;
-    uint8_t data[512];
+    uint8_t data[PACKET_DATA_MAX];
     uint8_t checksum;
 };
 
@@ -3,9 +3,18 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "babe.h"
 #include "common.h"
+#include "sigscan.h"
 
 // ---------- byte helper ----------
 uint8_t get_byte(uint8_t *p)
@@ -163,19 +172,22 @@ const char *color_get_name(int color_code)
     }
 }
 
-int scan_fw_version(uint8_t *buf, size_t size, char *fw_id, size_t fw_id_size)
+// offset of the first "prgCXC"/"prg120" at or after from, -1 if none
+int find_fw_marker(const uint8_t *buf, size_t from, size_t size)
 {
-    int found = -1;
-    for (size_t i = 0; i < size - 3; i++)
-    {
-        if (memcmp(&buf[i], "prgCXC", 6) == 0 || // DB20XX
-            memcmp(&buf[i], "prg120", 6) == 0)   // PNX5230
-        {
-            found = (int)i;
-            break;
-        }
-    }
+    struct sigscan s;
+    if (from >= size || sigscan_init(&s, sigscan_fw_ids, sigscan_fw_ids_count) != 0)
+        return -1;
+
+    size_t found;
+    if (!sigscan_buf(&s, buf + from, size - from, sigscan_first_hit, &found))
+        return -1;
+    return (int)(from + found);
+}
 
+int scan_fw_version(uint8_t *buf, size_t size, char *fw_id, size_t fw_id_size)
+{
+    int found = find_fw_marker(buf, 0, size);
     if (found == -1)
         return -1;
 
@@ -236,6 +248,54 @@ uint8_t *load_file(const char *path, size_t *size)
     return buf;
 }
 
+// --- map_file ---
+// Read-only view of a whole file, pages come in as they are touched so a
+// 50 MB firmware doesn't sit in the heap. Release with unmap_file().
+#ifndef _WIN32
+const uint8_t *map_file(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    // the flash paths read front to back
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    *size = st.st_size;
+    return p;
+}
+
+void unmap_file(const uint8_t *p, size_t size)
+{
+    if (p)
+        munmap((void *)p, size);
+}
+#else
+// no mmap here (yet), fall back to reading the file
+const uint8_t *map_file(const char *path, size_t *size)
+{
+    return load_file(path, size);
+}
+
+void unmap_file(const uint8_t *p, size_t size)
+{
+    (void)size;
+    free((void *)p);
+}
+#endif
+
 const char *get_speed_chars(int baudrate)
 {
     switch (baudrate)
@@ -250,4 +310,12 @@ const char *get_speed_chars(int baudrate)
     case 921600: return "S7";
     default:     return NULL;
     }
+}
+
+// monotonic clock in seconds, for timing transfers
+double get_time_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
\ No newline at end of file
@@ -52,6 +52,7 @@ struct phone_info
     int skiperrors;
     int save_as_babe;
     int anycid;
+    int resume;
 
     // break-rsa
     int break_rsa;
@@ -85,8 +86,13 @@ const char *color_get_state(int color_code);
 const char *color_get_name(int color_code);
 uint32_t get_platform(uint16_t chip_id);
 
+int find_fw_marker(const uint8_t *buf, size_t from, size_t size);
 int scan_fw_version(uint8_t *buf, size_t size, char *fw_id, size_t fw_id_size);
 
 uint8_t *load_file(const char *path, size_t *size);
+const uint8_t *map_file(const char *path, size_t *size);
+void unmap_file(const uint8_t *p, size_t size);
+
+double get_time_sec(void);
 
 #endif // common_h
\ No newline at end of file
@@ -3,13 +3,13 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
-#include <libserialport.h>
 
+#include "transport.h"
 #include "babe.h"
 #include "common.h"
 #include "serial.h"
 
-int set_speed(struct sp_port *port, struct phone_info *phone)
+int set_speed(struct transport *port, struct phone_info *phone)
 {
     // --- DB2000 has max 460800 ---
     if (phone->chip_id == DB2000 && phone->baudrate > 460800)
@@ -40,16 +40,16 @@ int set_speed(struct sp_port *port, struct phone_info *phone)
 
     printf("SPEED: %d\n\n", phone->baudrate);
 
-    if (serial_set_baudrate(port, phone->baudrate) != SP_OK)
+    if (serial_set_baudrate(port, phone->baudrate) != 0)
     {
-        fprintf(stderr, "sp_set_baudrate failed\n");
+        fprintf(stderr, "Setting baudrate failed\n");
         return -1;
     }
 
-    return SP_OK;
+    return 0;
 }
 
-int wait_for_Z(struct sp_port *port)
+int wait_for_Z(struct transport *port)
 {
     printf("Powering phone\n");
     printf("Waiting for reply (30s timeout):\n");
@@ -69,7 +69,7 @@ int wait_for_Z(struct sp_port *port)
             {
                 printf("\nConnected\n");
                 printf("\nDetected Sony Ericsson\n");
-                return SP_OK; // success
+                return 0; // success
             }
         }
 
@@ -99,7 +99,7 @@ int wait_for_Z(struct sp_port *port)
     }
 }
 
-int send_question_mark(struct sp_port *port, struct phone_info *phone)
+int send_question_mark(struct transport *port, struct phone_info *phone)
 {
     uint8_t cmd = '?';
 
@@ -129,7 +129,7 @@ int send_question_mark(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int erom_get_info(struct sp_port *port, struct phone_info *phone)
+int erom_get_info(struct transport *port, struct phone_info *phone)
 {
     if (phone->chip_id == DB2020 || phone->chip_id == 0x5B07 || phone->chip_id == 0x5B08)
         return 0;
@@ -210,7 +210,7 @@ int erom_get_info(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int connection_open(struct sp_port *port, struct phone_info *phone)
+int connection_open(struct transport *port, struct phone_info *phone)
 {
     if (serial_open(port) != 0)
         return -1;
@@ -226,7 +226,7 @@ int connection_open(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int connection_close(struct sp_port *port)
+int connection_close(struct transport *port)
 {
-    return sp_close(port);
+    return transport_close(port);
 }
\ No newline at end of file
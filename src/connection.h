@@ -1,7 +1,7 @@
 #ifndef connection_h
 #define connection_h
 
-int connection_open(struct sp_port *port, struct phone_info *phone);
-int connection_close(struct sp_port *port);
+int connection_open(struct transport *port, struct phone_info *phone);
+int connection_close(struct transport *port);
 
 #endif // connection_h
\ No newline at end of file
@@ -3,15 +3,15 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
-#include <libserialport.h>
 
+#include "transport.h"
 #include "common.h"
 #include "cmd.h"
 #include "loader.h"
 #include "gdfs.h"
 #include "serial.h"
 
-int csloader_read_gdfs_var(struct sp_port *port, uint8_t block, uint8_t lo, uint8_t hi,
+int csloader_read_gdfs_var(struct transport *port, uint8_t block, uint8_t lo, uint8_t hi,
                            uint8_t *dest, int maxdest, int binary)
 {
     uint8_t gdfs_var[3];
@@ -27,58 +27,45 @@ int csloader_read_gdfs_var(struct sp_port *port, uint8_t block, uint8_t lo, uint
     if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
         return -1;
 
-    uint8_t resp[0x1000];
-    int rcv_len = serial_read(port, resp, sizeof(resp), TIMEOUT);
-    if (rcv_len <= 0)
+    struct packetdata_t repl;
+    if (serial_recv_packet(port, &repl, TIMEOUT) != 0)
         return -1;
 
-    if (resp[0] != SERIAL_ACK || resp[1] != SERIAL_HDR89 || resp[2] != 0x04)
+    if (repl.ack != SERIAL_ACK || repl.cmd != 0x04)
     {
-        fprintf(stderr, "Bad reply: %X %X %X expected:06 89 04\n", resp[0], resp[1], resp[2]);
+        fprintf(stderr, "Bad reply: %X %X %X expected:06 89 04\n", repl.ack, repl.hdr, repl.cmd);
         return 0;
     }
 
-    int len = get_half(&resp[3]);
-
-    int gdfs_len = len - 2;
+    int gdfs_len = repl.length - 2;
     if (gdfs_len > maxdest)
         gdfs_len = maxdest;
+    if (gdfs_len < 0)
+        gdfs_len = 0;
 
     if (binary)
-        memcpy(dest, &resp[7], gdfs_len);
+        memcpy(dest, &repl.data[2], gdfs_len);
     else
-        strncpy((char *)dest, (char *)&resp[6], gdfs_len);
+        strncpy((char *)dest, (char *)&repl.data[1], gdfs_len);
 
     return gdfs_len;
 }
 
-int csloader_write_gdfs_var(struct sp_port *port, uint8_t block, uint8_t lo, uint8_t hi, uint8_t *data, uint32_t size)
+int csloader_write_gdfs_var(struct transport *port, uint8_t block, uint8_t lo, uint8_t hi, uint8_t *data, uint32_t size)
 {
-    uint8_t *gdfs_var = malloc(size + 7);
-    gdfs_var[0] = block;
-    gdfs_var[1] = lo;
-    gdfs_var[2] = hi;
-    memcpy(&gdfs_var[3], &size, 4);
-    memcpy(&gdfs_var[7], data, size);
-
-    uint8_t cmd_buf[0x800];
-    uint8_t resp[8];
-
-    int cmd_len = cmd_encode_csloader_packet(0x04, 0x03, gdfs_var, size + 7, cmd_buf);
-    free(gdfs_var);
-
-    if (cmd_len <= 0)
-        return -1;
-
-    if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
-        return -1;
-
-    int rcv_len = serial_read(port, resp, sizeof(resp), TIMEOUT);
-    if (rcv_len <= 0)
+    uint8_t gdfs_var[8];
+    gdfs_var[0] = 0x03; // subcmd
+    gdfs_var[1] = block;
+    gdfs_var[2] = lo;
+    gdfs_var[3] = hi;
+    set_word(&gdfs_var[4], size);
+
+    struct transport_iov payload[2] = {{gdfs_var, sizeof(gdfs_var)}, {data, size}};
+    if (serial_send_packet(port, 1, 0x04, payload, 2) < 0)
         return -1;
 
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, TIMEOUT) != 0)
         return -1;
 
     if (repl.cmd != 0x04 && repl.data[1] != 0x00)
@@ -87,7 +74,7 @@ int csloader_write_gdfs_var(struct sp_port *port, uint8_t block, uint8_t lo, uin
     return 0;
 }
 
-int csloader_write_gdfs(struct sp_port *port, const char *inputfname)
+int csloader_write_gdfs(struct transport *port, const char *inputfname)
 {
     printf("Restore GDFS...\n");
     size_t datasize;
@@ -140,7 +127,7 @@ int csloader_write_gdfs(struct sp_port *port, const char *inputfname)
     return 0;
 }
 
-int csloader_read_gdfs(struct sp_port *port, struct phone_info *phone)
+int csloader_read_gdfs(struct transport *port, struct phone_info *phone)
 {
     printf("Back up GDFS...\n");
 
@@ -220,7 +207,7 @@ int csloader_read_gdfs(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int csloader_parse_gdfs_script(struct sp_port *port, const char *inputfname, const char *outputfname)
+int csloader_parse_gdfs_script(struct transport *port, const char *inputfname, const char *outputfname)
 {
     printf("\nRun GDFS-script...%s\n", inputfname);
 
@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "babe.h"
+#include "common.h"
+#include "dumpwriter.h"
+#include "manifest.h"
+#include "store.h"
+#include "zdump.h"
+
+struct dumpwriter_buf
+{
+    uint8_t *data;
+    size_t len;
+};
+
+struct dumpwriter
+{
+    FILE *f;
+    int format;
+    int hole;  // sparse: the file ends in a hole that still needs its length
+    int error; // a write failed, set by the writer thread
+    struct zdump z;
+    struct manifest *manifest; // NULL = none
+    int to_store;              // blocks also go to the block store
+    uint32_t addr;     // address of the next block
+    uint32_t nblocks;  // BABE: blocks in the header
+    uint32_t written;  // BABE: blocks written so far
+    struct dumpwriter_buf buf[DUMPWRITER_BUFS];
+
+#ifndef _WIN32
+    // buf[head] .. count buffers are queued for the thread, buf[tail] is being filled
+    int head;
+    int tail;
+    int count;
+    int closing;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued; // thread waits for work
+    pthread_cond_t freed;  // producer waits for a buffer
+#endif
+};
+
+static int dumpwriter_is_zero(const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (data[i])
+            return 0;
+    return 1;
+}
+
+// one buffer is one 64 KB block of the dump (the last one may be short)
+static int dumpwriter_put_data(struct dumpwriter *w, const struct dumpwriter_buf *b)
+{
+    switch (w->format)
+    {
+    case DUMPWRITER_SPARSE:
+        // holes read back as zeros, so only zero blocks can be left out
+        w->hole = dumpwriter_is_zero(b->data, b->len);
+        if (w->hole)
+        {
+            if (fseek(w->f, (long)b->len, SEEK_CUR) != 0)
+            {
+                perror("dump seek");
+                return -1;
+            }
+            return 0;
+        }
+        break;
+
+    case DUMPWRITER_ZDUMP:
+        if (zdump_add_block(&w->z, b->data, b->len) != 0)
+        {
+            perror("dump write");
+            return -1;
+        }
+        return 0;
+
+    case DUMPWRITER_STORE:
+        return 0; // dumpwriter_put() stored it
+
+    case DUMPWRITER_BABE:
+    {
+        uint8_t blockhdr[8];
+        set_word(blockhdr, w->addr);
+        set_word(blockhdr + 4, (uint32_t)b->len);
+        if (fwrite(blockhdr, 1, sizeof(blockhdr), w->f) != sizeof(blockhdr))
+        {
+            perror("dump write");
+            return -1;
+        }
+        w->written++;
+        break;
+    }
+    }
+
+    if (fwrite(b->data, 1, b->len, w->f) != b->len)
+    {
+        perror("dump write");
+        return -1;
+    }
+    return 0;
+}
+
+static int dumpwriter_put(struct dumpwriter *w, const struct dumpwriter_buf *b)
+{
+    // hashed here, on the writer thread, while the next block is on the wire
+    if (w->manifest && manifest_add(w->manifest, w->addr, b->data, b->len) != 0)
+    {
+        perror("manifest write");
+        return -1;
+    }
+    if (w->to_store)
+    {
+        if (!w->manifest)
+        {
+            fprintf(stderr, "dump store: no manifest\n");
+            return -1;
+        }
+        // the manifest line for this block has its SHA1 already
+        const struct manifest_entry *e = &w->manifest->e[w->manifest->count - 1];
+        if (!e->erased && store_put(STORE_DIR, e->sha1, b->data, b->len) < 0)
+            return -1;
+    }
+    if (dumpwriter_put_data(w, b) != 0)
+        return -1;
+
+    w->addr += b->len;
+    return 0;
+}
+
+// whatever follows the last block: the file length or the zdump index
+static int dumpwriter_finish(struct dumpwriter *w)
+{
+    if (w->format == DUMPWRITER_SPARSE && w->hole)
+    {
+        // a seek alone doesn't extend the file, write its last (zero) byte
+        if (fseek(w->f, -1, SEEK_CUR) != 0 || fputc(0, w->f) == EOF)
+            return -1;
+    }
+    if (w->format == DUMPWRITER_ZDUMP)
+        return zdump_finish(&w->z);
+    if (w->format == DUMPWRITER_BABE && w->written == w->nblocks)
+    {
+        // the signature goes in last, a cut short dump is no BABE
+        uint8_t sig[2];
+        set_half(sig, 0xBEBA);
+        if (fseek(w->f, 0, SEEK_SET) != 0 || fwrite(sig, 1, sizeof(sig), w->f) != sizeof(sig))
+            return -1;
+    }
+    return 0;
+}
+
+// header and hash area of an unsigned v3 BABE, without the signature yet
+static int dumpwriter_babe_begin(struct dumpwriter *w, size_t size)
+{
+    w->nblocks = (size + DUMPWRITER_BUF_SIZE - 1) / DUMPWRITER_BUF_SIZE;
+
+    struct babehdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.ver = 3;
+    hdr.payloadsize1 = w->nblocks;
+    if (fwrite(&hdr, 1, sizeof(hdr), w->f) != sizeof(hdr))
+        return -1;
+
+    // one (unused) hash byte per block
+    for (uint32_t i = 0; i < w->nblocks; i++)
+        if (fputc(0, w->f) == EOF)
+            return -1;
+    return 0;
+}
+
+// flush the C buffer and the page cache, the dump is on disk when we return
+static int dumpwriter_sync(struct dumpwriter *w)
+{
+    if (!w->f)
+        return 0;
+    if (fflush(w->f) != 0)
+        return -1;
+#ifdef _WIN32
+    return _commit(_fileno(w->f));
+#else
+    return fsync(fileno(w->f));
+#endif
+}
+
+#ifndef _WIN32
+static void *dumpwriter_thread(void *arg)
+{
+    struct dumpwriter *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;)
+    {
+        while (w->count == 0 && !w->closing)
+            pthread_cond_wait(&w->queued, &w->lock);
+        if (w->count == 0)
+            break;
+
+        // buf[head] stays ours until count drops, the producer never fills a queued buffer
+        struct dumpwriter_buf *b = &w->buf[w->head];
+        int failed = w->error;
+        pthread_mutex_unlock(&w->lock);
+
+        if (!failed && dumpwriter_put(w, b) != 0)
+            failed = 1;
+
+        pthread_mutex_lock(&w->lock);
+        w->error = failed;
+        b->len = 0;
+        w->head = (w->head + 1) % DUMPWRITER_BUFS;
+        w->count--;
+        pthread_cond_signal(&w->freed);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// hand buf[tail] to the thread and wait for a free one to fill next
+static int dumpwriter_queue(struct dumpwriter *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->count++;
+    w->tail = (w->tail + 1) % DUMPWRITER_BUFS;
+    pthread_cond_signal(&w->queued);
+
+    while (w->count == DUMPWRITER_BUFS)
+        pthread_cond_wait(&w->freed, &w->lock);
+    int error = w->error;
+    pthread_mutex_unlock(&w->lock);
+
+    return error ? -1 : 0;
+}
+#endif
+
+// offset > 0 keeps that much of an existing raw/sparse file and writes on
+// from there; addr and size describe the whole dump, for the zdump header
+struct dumpwriter *dumpwriter_open(const char *path, int format, size_t offset,
+                                   uint32_t addr, size_t size)
+{
+    if (format != DUMPWRITER_RAW && format != DUMPWRITER_SPARSE && offset)
+    {
+        fprintf(stderr, "Error: only raw and sparse dumps can be continued\n");
+        return NULL;
+    }
+
+    struct dumpwriter *w = calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+    w->format = format;
+    w->to_store = format == DUMPWRITER_STORE;
+    w->addr = addr + offset;
+
+    for (int i = 0; i < DUMPWRITER_BUFS; i++)
+    {
+        w->buf[i].data = malloc(DUMPWRITER_BUF_SIZE);
+        if (!w->buf[i].data)
+            goto fail;
+    }
+
+    // the store keeps one file per block, there is no dump file
+    if (format != DUMPWRITER_STORE)
+        w->f = fopen(path, offset ? "r+b" : "wb");
+    if (!w->f && format != DUMPWRITER_STORE)
+    {
+        perror("open output");
+        goto fail;
+    }
+    if (offset && fseek(w->f, (long)offset, SEEK_SET) != 0)
+    {
+        perror("seek output");
+        fclose(w->f);
+        goto fail;
+    }
+    if ((format == DUMPWRITER_ZDUMP && zdump_begin(&w->z, w->f, addr, size) != 0) ||
+        (format == DUMPWRITER_BABE && dumpwriter_babe_begin(w, size) != 0))
+    {
+        perror("open output");
+        fclose(w->f);
+        goto fail;
+    }
+
+#ifndef _WIN32
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->queued, NULL);
+    pthread_cond_init(&w->freed, NULL);
+    if (pthread_create(&w->thread, NULL, dumpwriter_thread, w) != 0)
+    {
+        fprintf(stderr, "Error: can't start the dump writer thread\n");
+        pthread_cond_destroy(&w->freed);
+        pthread_cond_destroy(&w->queued);
+        pthread_mutex_destroy(&w->lock);
+        if (format == DUMPWRITER_ZDUMP)
+            zdump_finish(&w->z);
+        if (w->f)
+            fclose(w->f);
+        goto fail;
+    }
+#endif
+
+    return w;
+
+fail:
+    for (int i = 0; i < DUMPWRITER_BUFS; i++)
+        free(w->buf[i].data);
+    free(w);
+    return NULL;
+}
+
+// m gets a line per block, set before the first dumpwriter_write();
+// required for DUMPWRITER_STORE, the manifest is how the dump is found again
+void dumpwriter_set_manifest(struct dumpwriter *w, struct manifest *m)
+{
+    w->manifest = m;
+}
+
+// blocks also go to the block store, as the read cache (DUMPWRITER_STORE
+// does this anyway); set before the first dumpwriter_write()
+void dumpwriter_set_store(struct dumpwriter *w)
+{
+    w->to_store = 1;
+}
+
+int dumpwriter_write(struct dumpwriter *w, const uint8_t *data, size_t len)
+{
+#ifndef _WIN32
+    struct dumpwriter_buf *b = &w->buf[w->tail];
+#else
+    // no thread here (yet), the pool is a single write-behind buffer
+    struct dumpwriter_buf *b = &w->buf[0];
+#endif
+
+    while (len > 0)
+    {
+        size_t n = DUMPWRITER_BUF_SIZE - b->len;
+        if (n > len)
+            n = len;
+        memcpy(b->data + b->len, data, n);
+        b->len += n;
+        data += n;
+        len -= n;
+
+        if (b->len < DUMPWRITER_BUF_SIZE)
+            break;
+
+#ifndef _WIN32
+        if (dumpwriter_queue(w) != 0)
+            return -1;
+        b = &w->buf[w->tail];
+#else
+        if (dumpwriter_put(w, b) != 0)
+            return -1;
+        b->len = 0;
+#endif
+    }
+
+    return 0;
+}
+
+// writes what is left, waits for the thread and syncs the file
+int dumpwriter_close(struct dumpwriter *w)
+{
+    if (!w)
+        return -1;
+
+#ifndef _WIN32
+    pthread_mutex_lock(&w->lock);
+    if (w->buf[w->tail].len > 0)
+    {
+        w->count++;
+        w->tail = (w->tail + 1) % DUMPWRITER_BUFS;
+    }
+    w->closing = 1;
+    pthread_cond_signal(&w->queued);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->freed);
+    pthread_cond_destroy(&w->queued);
+    pthread_mutex_destroy(&w->lock);
+#else
+    if (w->buf[0].len > 0 && dumpwriter_put(w, &w->buf[0]) != 0)
+        w->error = 1;
+#endif
+
+    // also after an error, a short zdump is left without its index
+    if (dumpwriter_finish(w) != 0)
+    {
+        perror("dump write");
+        w->error = 1;
+    }
+
+    int rc = w->error ? -1 : 0;
+    if (rc == 0 && dumpwriter_sync(w) != 0)
+    {
+        perror("dump sync");
+        rc = -1;
+    }
+    if (w->f && fclose(w->f) != 0)
+        rc = -1;
+
+    for (int i = 0; i < DUMPWRITER_BUFS; i++)
+        free(w->buf[i].data);
+    free(w);
+    return rc;
+}
@@ -0,0 +1,34 @@
+#ifndef dumpwriter_h
+#define dumpwriter_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Writes a dump to disk on its own thread so the serial receive loop never
+// waits for the disk. Data is copied into a pool of DUMPWRITER_BUFS buffers
+// of DUMPWRITER_BUF_SIZE; when all of them are queued, dumpwriter_write()
+// blocks until the disk catches up.
+#define DUMPWRITER_BUF_SIZE 0x10000
+#define DUMPWRITER_BUFS 8
+
+// output formats
+enum
+{
+    DUMPWRITER_RAW,    // byte for byte
+    DUMPWRITER_SPARSE, // raw, all-zero blocks left as holes
+    DUMPWRITER_ZDUMP,  // compressed container, see zdump.h
+    DUMPWRITER_BABE,   // unsigned v3 BABE, one block per 64 KB (save-as-babe)
+    DUMPWRITER_STORE   // no file, blocks go to the block store (see store.h)
+};
+
+struct dumpwriter;
+struct manifest;
+
+struct dumpwriter *dumpwriter_open(const char *path, int format, size_t offset,
+                                   uint32_t addr, size_t size);
+void dumpwriter_set_manifest(struct dumpwriter *w, struct manifest *m);
+void dumpwriter_set_store(struct dumpwriter *w);
+int dumpwriter_write(struct dumpwriter *w, const uint8_t *data, size_t len);
+int dumpwriter_close(struct dumpwriter *w);
+
+#endif // dumpwriter_h
@@ -2,7 +2,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <libserialport.h>
 
 #ifdef _WIN32
 #include <io.h>
@@ -11,6 +10,7 @@
 #include <unistd.h>
 #endif
 
+#include "transport.h"
 #include "babe.h"
 #include "common.h"
 #include "cmd.h"
@@ -18,20 +18,278 @@
 #include "loader.h"
 #include "gdfs.h"
 #include "serial.h"
+#include "sha1.h"
+#include "sigscan.h"
+#include "blockcache.h"
+#include "dumpwriter.h"
+#include "manifest.h"
+#include "patchreg.h"
+#include "store.h"
 #include "vkp.h"
 
 #define FLASH_OK 0
 #define FLASH_ERROR -1
+#define FLASH_RETRY -2
+
+// achieved rate vs. what the line could carry at 8N1
+static void flash_print_throughput(size_t bytes, double elapsed)
+{
+    if (elapsed <= 0)
+        return;
+
+    double rate = bytes / elapsed;
+    double wire = serial_get_baudrate() / 10.0;
+    printf("%zu bytes in %.1fs, %.1f KB/s (%.0f%% of wire speed)\n",
+           bytes, elapsed, rate / 1024, 100 * rate / wire);
+}
 
 // ------------- Write to Flash -------------
 
-int flash_babe(struct sp_port *port, uint8_t *babe_buf, size_t size, int flashfull)
+int flash_window = FLASH_WINDOW_DEFAULT;
+int flash_packet_size = FLASH_PACKET_SIZE;
+int flash_delta = FLASH_DELTA_OFF;
+int flash_dump_format = DUMPWRITER_RAW;
+int flash_read_cache = FLASH_CACHE_SPOT;
+
+// --- session block cache ---
+// backup/blocks_<imei>.txt for the digests, the block store for the data.
+// Open from flash_cache_open() until flash_cache_close(); every write
+// through flash_babe_journal() drops its blocks first and records the new
+// contents once the loader finalized them.
+static struct blockcache flash_cache;
+static int flash_cache_ready;
+
+int flash_cache_open(const struct phone_info *phone)
+{
+    if (flash_cache_ready)
+        return 0;
+    if (blockcache_open(&flash_cache, phone->otp_imei, phone->flash_id) != 0)
+        return -1;
+    flash_cache_ready = 1;
+    return 0;
+}
+
+void flash_cache_close(void)
+{
+    if (!flash_cache_ready)
+        return;
+    blockcache_close(&flash_cache);
+    flash_cache_ready = 0;
+}
+
+static int flash_is_erased(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        if (data[i] != 0xFF)
+            return 0;
+    return 1;
+}
+
+// what the phone has at addr now; the data too unless --read-cache off
+static void flash_cache_keep(uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    if (!flash_cache_ready)
+        return;
+
+    uint8_t sha1[20];
+    blockcache_digest(data, size, sha1);
+    blockcache_set(&flash_cache, addr, size, sha1);
+    if (flash_read_cache != FLASH_CACHE_OFF && !flash_is_erased(data, size))
+        store_put(STORE_DIR, sha1, data, size);
+}
+
+// a copy of the block at addr, 0 = hit
+static int flash_cache_get(uint32_t addr, uint32_t size, uint8_t *out)
+{
+    if (!flash_cache_ready || flash_read_cache == FLASH_CACHE_OFF)
+        return -1;
+
+    const struct blockcache_entry *e = blockcache_find(&flash_cache, addr);
+    if (!e || e->size != size)
+        return -1;
+    if (store_get(STORE_DIR, e->sha1, out, size) == 0)
+        return 0;
+
+    // erased blocks are not stored, they are known by their digest
+    memset(out, 0xFF, size);
+    uint8_t sha1[20];
+    blockcache_digest(out, size, sha1);
+    return memcmp(sha1, e->sha1, 20) == 0 ? 0 : -1;
+}
+
+// --- send one block: 0x10 block header + 0x01 data packets ---
+// Up to 'window' data packets are in flight before their ACKs are
+// collected. Returns FLASH_RETRY when a pipelined send was NAKed or
+// timed out, so the caller can resend the block stop-and-wait.
+static int flash_send_block(struct transport *port, const uint8_t *block, uint32_t bsize, int window)
 {
-    struct babehdr_t *hdr = (struct babehdr_t *)babe_buf;
-    int fileformatver = hdr->ver;
-    size_t hashsize = fileformatver >= 4 ? 20 : 1;
-    int blocks = hdr->payloadsize1;
-    size_t hdrsize = (fileformatver <= 2) ? 0x480 : blocks * hashsize + 0x380;
+    // send block header
+    struct transport_iov blockhdr = {block, 8};
+    if (serial_send_packet(port, 1, 0x10, &blockhdr, 1) < 0)
+        return FLASH_ERROR;
+
+    if (serial_wait_ack(port, TIMEOUT) < 0)
+        return window > 1 ? FLASH_RETRY : FLASH_ERROR;
+
+    // send block data
+    const uint8_t *data = block + 8;
+    uint32_t psize = flash_packet_size;
+    int packets = (bsize + psize - 1) / psize;
+    int sent = 0;
+    int acked = 0;
+
+    while (acked < packets)
+    {
+        while (sent < packets && sent - acked < window)
+        {
+            uint32_t offset = sent * psize;
+            uint32_t tsize = (bsize - offset > psize) ? psize : bsize - offset;
+            struct transport_iov payload = {data + offset, tsize};
+            if (serial_send_packet(port, 0, 0x01, &payload, 1) < 0)
+                return FLASH_ERROR;
+            sent++;
+        }
+
+        // the oldest ACK can only arrive after everything queued before it is on the wire
+        int inflight = sent - acked;
+        int timeout = TIMEOUT + serial_wire_time_ms(inflight * (psize + 5));
+        if (serial_wait_ack(port, timeout) < 0)
+            return window > 1 ? FLASH_RETRY : FLASH_ERROR;
+        acked++;
+    }
+
+    return FLASH_OK;
+}
+
+// ------------- Flash journal -------------
+
+void flash_journal_init(struct flash_journal *j, const char *imei, const char *loader)
+{
+    memset(j, 0, sizeof(*j));
+    snprintf(j->path, sizeof(j->path), "./backup/flash_%s.journal", imei);
+    snprintf(j->loader, sizeof(j->loader), "%s", loader);
+}
+
+// 0 = journal loaded, -1 = none or unreadable
+int flash_journal_load(struct flash_journal *j)
+{
+    FILE *f = fopen(j->path, "r");
+    if (!f)
+        return -1;
+
+    char line[128];
+    j->count = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        struct flash_journal_entry e = {0};
+        if (strncmp(line, "loader ", 7) == 0)
+            sscanf(line + 7, "%15s", j->loader);
+        else if (sscanf(line, "fw %40s %d %d", e.sha1, &e.blocks, &e.done) == 3 &&
+                 j->count < FLASH_JOURNAL_MAX)
+            j->fw[j->count++] = e;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int flash_journal_save(struct flash_journal *j)
+{
+    FILE *f = fopen(j->path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Error: Cannot write %s\n", j->path);
+        return -1;
+    }
+
+    fprintf(f, "loader %s\n", j->loader);
+    for (int i = 0; i < j->count; i++)
+        fprintf(f, "fw %s %d %d\n", j->fw[i].sha1, j->fw[i].blocks, j->fw[i].done);
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void flash_journal_remove(struct flash_journal *j)
+{
+    remove(j->path);
+}
+
+// entry for this firmware, a new one if it is not in the journal yet
+static struct flash_journal_entry *flash_journal_entry(struct flash_journal *j, const char *sha1)
+{
+    for (int i = 0; i < j->count; i++)
+    {
+        if (strcmp(j->fw[i].sha1, sha1) == 0)
+            return &j->fw[i];
+    }
+
+    if (j->count >= FLASH_JOURNAL_MAX)
+        return NULL;
+
+    struct flash_journal_entry *e = &j->fw[j->count++];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->sha1, sizeof(e->sha1), "%s", sha1);
+    return e;
+}
+
+// ------------- Flash BABE -------------
+
+// complete blocks the loader can take, stops at the first oversized one
+static int flash_babe_blocks(const struct babe_index *idx)
+{
+    int bl;
+    for (bl = 0; bl < idx->count; bl++)
+        if (idx->block[bl].size > BLOCK_SIZE)
+            break;
+    return bl;
+}
+
+int flash_babe(struct transport *port, const uint8_t *babe_buf, size_t size, int flashfull)
+{
+    struct babe_index idx;
+    if (babe_index_build(babe_buf, size, &idx) == CHECKBABE_NOTBABE)
+    {
+        printf("This is not BABE file\n");
+        return FLASH_ERROR;
+    }
+    if (idx.hdrsize > size)
+    {
+        printf("Bad BABE file\n");
+        babe_index_free(&idx);
+        return FLASH_ERROR;
+    }
+
+    int rc = flash_babe_journal(port, babe_buf, &idx, NULL, flashfull, NULL, NULL);
+    babe_index_free(&idx);
+    return rc;
+}
+
+// --- flash_babe_journal ---
+// idx = block index of babe_buf, see babe_index_build()
+// v = hash chain to check while sending, NULL = none. Each block is hashed
+// while the phone writes it; a mismatch stops before 0x11, so the loader
+// never finalizes a bad file.
+// j, e = journal to update after every 0x13, NULL = none
+// Blocks before e->blocks were acknowledged in an earlier session and are
+// skipped; the header always goes out, the loader needs it to take blocks.
+int flash_babe_journal(struct transport *port, const uint8_t *babe_buf, const struct babe_index *idx,
+                       struct babe_verify *v, int flashfull,
+                       struct flash_journal *j, struct flash_journal_entry *e)
+{
+    size_t hdrsize = idx->hdrsize;
+    int blocks = flash_babe_blocks(idx);
+
+    // the blocks are unknown from here until the loader finalizes them
+    if (flash_cache_ready)
+    {
+        for (int bl = 0; bl < blocks; bl++)
+            blockcache_invalidate(&flash_cache, idx->block[bl].addr, idx->block[bl].size);
+        if (blockcache_save(&flash_cache) != 0)
+            return FLASH_ERROR;
+    }
+
+    double start_time = get_time_sec();
+    size_t sent_bytes = 0;
 
     // --- send header ---
     size_t curpos = 0;
@@ -41,21 +299,12 @@ int flash_babe(struct sp_port *port, uint8_t *babe_buf, size_t size, int flashfu
         if (chunk > 0x800)
             chunk = 0x800;
 
-        uint8_t cmd_buf[0x1000];
-        int cmd_len = cmd_encode_binary_packet(0x0E, babe_buf + curpos, chunk, cmd_buf);
-        if (cmd_len <= 0)
-            return FLASH_ERROR;
-
-        if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
-            return FLASH_ERROR;
-
-        uint8_t resp[7];
-        int rcv_len = serial_read(port, resp, sizeof(resp), TIMEOUT);
-        if (rcv_len <= 0)
+        struct transport_iov payload = {babe_buf + curpos, chunk};
+        if (serial_send_packet(port, 1, 0x0E, &payload, 1) < 0)
             return FLASH_ERROR;
 
         struct packetdata_t repl;
-        if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+        if (serial_recv_packet(port, &repl, TIMEOUT) != 0)
             return FLASH_ERROR;
 
         if (repl.cmd != 0x0F || repl.length != 1 || repl.data[0] != 0x00)
@@ -64,85 +313,50 @@ int flash_babe(struct sp_port *port, uint8_t *babe_buf, size_t size, int flashfu
             return FLASH_ERROR;
         }
         curpos += chunk;
+        sent_bytes += chunk;
     }
 
-    // --- detect real block count ---
-    curpos = hdrsize;
-    int bl;
-    for (bl = 0; bl < blocks; bl++)
-    {
-        if (curpos + 8 >= size)
-            break;
-        long bsize = ((long *)(babe_buf + curpos))[1];
-        if (bsize > BLOCK_SIZE)
-            break;
-        curpos += 8;
-        if (curpos + bsize > size)
-            break;
-        curpos += bsize;
-    }
-    blocks = bl;
-    printf("flashing %d blocks\n", blocks);
+    int first = e ? e->blocks : 0;
+    printf("flashing %d blocks", blocks);
+    if (first > 0)
+        printf(", resuming at block %d", first + 1);
+    if (flash_window > 1)
+        printf(" (window %d)", flash_window);
+    printf("\n");
 
     // --- flash blocks ---
-    curpos = hdrsize;
-    for (bl = 0; bl < blocks; bl++)
+    for (int bl = first; bl < blocks; bl++)
     {
-        if (curpos + 8 >= size)
-            break;
-
-        int addr_val = ((int *)(babe_buf + curpos))[0];
-        int bsize = ((int *)(babe_buf + curpos))[1];
+        const struct babe_block *b = &idx->block[bl];
 
         printf("\rflashing block %d/%d (addr %08X size %08X)",
-               bl + 1, blocks, addr_val, bsize);
+               bl + 1, blocks, b->addr, b->size);
         fflush(stdout);
 
-        // send block header
-        uint8_t cmd_buf[0xD];
-        int cmd_len = cmd_encode_binary_packet(0x10, babe_buf + curpos, 8, cmd_buf);
-        if (cmd_len <= 0)
-            return FLASH_ERROR;
-
-        if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
-            return FLASH_ERROR;
-
-        if (serial_wait_ack(port, TIMEOUT) < 0)
+        int rc = flash_send_block(port, babe_buf + b->offset, b->size, flash_window);
+        if (rc == FLASH_RETRY)
+        {
+            // the loader lost track of the pipeline, fall back to stop-and-wait
+            printf("\nno ACK with %d packets in flight, resending block stop-and-wait\n", flash_window);
+            flash_window = 1;
+            serial_drain_input(port, TIMEOUT);
+            rc = flash_send_block(port, babe_buf + b->offset, b->size, flash_window);
+        }
+        if (rc != FLASH_OK)
             return FLASH_ERROR;
 
-        if (bsize > BLOCK_SIZE)
-            break;
-
-        curpos += 8;
-
-        if ((curpos + bsize > size))
-            break;
+        sent_bytes += 8 + b->size;
 
-        // send block data
-        while (bsize > 0)
+        // the phone is busy writing the block, hash it meanwhile
+        if (v && babe_verify_block(v, bl) != CHECKBABE_OK)
         {
-            uint8_t data_buf[0x800];
-            uint32_t tsize = (bsize > 0x800) ? 0x800 : bsize;
-            cmd_len = cmd_encode_binary_packet(0x01, babe_buf + curpos, tsize, data_buf);
-            if (cmd_len <= 0)
-                return FLASH_ERROR;
-            if (serial_write_chunks(port, data_buf, cmd_len, 0x400) < 0)
-                return FLASH_ERROR;
-            if (serial_wait_ack(port, TIMEOUT) < 0)
-                return FLASH_ERROR;
-
-            curpos += tsize;
-            bsize -= tsize;
+            printf("\nblock %d hash mismatch, bad BABE file, not finalizing\n", v->next + 1);
+            return FLASH_ERROR;
         }
 
         // wait for block reply
-        uint8_t resp[6];
-        int rcv_len = serial_read(port, resp, sizeof(resp), TIMEOUT);
-        if (rcv_len <= 0)
-            return FLASH_ERROR;
-
         struct packetdata_t repl;
-        if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+        if (serial_recv_packet(port, &repl, TIMEOUT) != 0)
             return FLASH_ERROR;
 
         if (repl.cmd != 0x13)
@@ -155,6 +369,22 @@ int flash_babe(struct sp_port *port, uint8_t *babe_buf, size_t size, int flashfu
             printf("\nsend block error\n");
             return FLASH_ERROR;
         }
+
+        if (e)
+        {
+            e->blocks = bl + 1;
+            if (flash_journal_save(j) != 0)
+                return FLASH_ERROR;
+        }
+    }
+
+    double elapsed = get_time_sec() - start_time;
+
+    // blocks that were not sent (oversized, or none at all) are still part of the chain
+    if (v && babe_verify_block(v, idx->count - 1) != CHECKBABE_OK)
+    {
+        printf("\nblock %d hash mismatch, bad BABE file, not finalizing\n", v->next + 1);
+        return FLASH_ERROR;
     }
 
     // --- finalization ---
@@ -168,13 +398,8 @@ int flash_babe(struct sp_port *port, uint8_t *babe_buf, size_t size, int flashfu
         if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
             return FLASH_ERROR;
 
-        uint8_t resp[8];
-        int rcv_len = serial_read(port, resp, sizeof(resp), 100 * TIMEOUT); // 10s timeout
-        if (rcv_len <= 0)
-            return FLASH_ERROR;
-
         struct packetdata_t repl;
-        if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+        if (serial_recv_packet(port, &repl, 100 * TIMEOUT) != 0) // 10s timeout
             return FLASH_ERROR;
 
         if (repl.cmd != 0x12)
@@ -187,21 +412,201 @@ int flash_babe(struct sp_port *port, uint8_t *babe_buf, size_t size, int flashfu
             printf("final error\n");
             return FLASH_ERROR;
         }
+
+        if (e)
+        {
+            e->done = 1;
+            flash_journal_save(j);
+        }
+
+        if (flash_cache_ready)
+        {
+            for (int bl = 0; bl < blocks; bl++)
+                flash_cache_keep(idx->block[bl].addr, babe_buf + idx->block[bl].offset + 8, idx->block[bl].size);
+            blockcache_save(&flash_cache);
+        }
     }
 
     printf("\n%d blocks flashed ok\n", blocks);
+    flash_print_throughput(sent_bytes, elapsed);
 
     return FLASH_OK;
 }
 
-int flash_babe_fw(struct sp_port *port, const char *filename, int flashfull)
+// --- unsigned v3 BABE: header, one hash byte per block, then the blocks ---
+static uint8_t *flash_babe_alloc(size_t numblocks, size_t datasize, size_t *babe_size_out)
+{
+    size_t babesize = sizeof(struct babehdr_t) + numblocks * (1 + 8) + datasize;
+
+    uint8_t *babe = calloc(1, babesize);
+    if (!babe)
+        return NULL;
+
+    struct babehdr_t *babe_hdr = (struct babehdr_t *)babe;
+    babe_hdr->sig = 0xBEBA;
+    babe_hdr->ver = 3;
+    babe_hdr->payloadsize1 = numblocks;
+
+    if (babe_size_out)
+        *babe_size_out = babesize;
+
+    return babe;
+}
+
+// returns the position after the block
+static size_t flash_babe_add_block(uint8_t *babe, size_t pos, uint32_t addr,
+                                   const uint8_t *data, uint32_t bsize)
+{
+    set_word(babe + pos, addr);
+    set_word(babe + pos + 4, bsize);
+    memcpy(babe + pos + 8, data, bsize);
+    return pos + 8 + bsize;
+}
+
+uint8_t *flash_convert_raw_to_babe(uint8_t *raw, size_t size, uint32_t raw_addr, size_t *babe_size_out)
+{
+    size_t numblocks = (size + 0xFFFF) / BLOCK_SIZE;
+
+    uint8_t *babe = flash_babe_alloc(numblocks, size, babe_size_out);
+    if (!babe)
+        return NULL;
+
+    size_t pos = sizeof(struct babehdr_t) + numblocks;
+    uint8_t *rawp = raw;
+    size_t left = size;
+
+    while (left > 0)
+    {
+        int bsize = left > BLOCK_SIZE ? BLOCK_SIZE : left;
+        pos = flash_babe_add_block(babe, pos, raw_addr, rawp, bsize);
+
+        rawp += bsize;
+        left -= bsize;
+        raw_addr += bsize;
+    }
+
+    return babe;
+}
+
+// --- delta flashing ---
+// Compares every block of a BABE with the phone and returns an unsigned
+// BABE of only the blocks that differ (*babe_size_out = 0 if none do).
+// Blocks the session cache knows are not read back in FLASH_DELTA_CACHE
+// mode; everything that is read goes into the cache. The hash chain v is
+// checked along the way, nothing is flashed from a bad file.
+static uint8_t *flash_delta_reduce(struct transport *port, const uint8_t *babe_buf,
+                                   const struct babe_index *idx, struct babe_verify *v,
+                                   size_t *babe_size_out)
+{
+    int blocks = flash_babe_blocks(idx);
+
+    uint8_t *keep = calloc(blocks ? blocks : 1, 1);
+    if (!keep)
+        return NULL;
+
+    int nkeep = 0, ncached = 0, nread = 0;
+    size_t datasize = 0;
+    int bl;
+    for (bl = 0; bl < blocks; bl++)
+    {
+        uint32_t addr = idx->block[bl].addr;
+        uint32_t bsize = idx->block[bl].size;
+        const uint8_t *data = babe_buf + idx->block[bl].offset + 8;
+
+        printf("\rcomparing block %d/%d (addr %08X)", bl + 1, blocks, addr);
+        fflush(stdout);
+
+        if (babe_verify_block(v, bl) != CHECKBABE_OK)
+        {
+            printf("\nblock %d hash mismatch, bad BABE file\n", v->next + 1);
+            free(keep);
+            return NULL;
+        }
+
+        uint8_t sha1[20];
+        blockcache_digest(data, bsize, sha1);
+
+        const struct blockcache_entry *known = blockcache_find(&flash_cache, addr);
+        if (flash_delta == FLASH_DELTA_CACHE && known && known->size == bsize)
+        {
+            keep[bl] = memcmp(known->sha1, sha1, 20) != 0;
+            ncached++;
+        }
+        else
+        {
+            uint8_t *raw = flash_read_raw(port, addr, bsize);
+            if (!raw)
+            {
+                fprintf(stderr, "\nread failed at 0x%08X\n", addr);
+                free(keep);
+                return NULL;
+            }
+            keep[bl] = memcmp(raw, data, bsize) != 0;
+            flash_cache_keep(addr, raw, bsize);
+            free(raw);
+            nread++;
+        }
+
+        if (keep[bl])
+        {
+            nkeep++;
+            datasize += bsize;
+        }
+    }
+
+    if (babe_verify_block(v, idx->count - 1) != CHECKBABE_OK)
+    {
+        printf("\nblock %d hash mismatch, bad BABE file\n", v->next + 1);
+        free(keep);
+        return NULL;
+    }
+
+    printf("\ndelta: %d of %d blocks differ (%d read back, %d from cache)\n",
+           nkeep, blocks, nread, ncached);
+
+    *babe_size_out = 0;
+    uint8_t *out = flash_babe_alloc(nkeep, datasize, nkeep ? babe_size_out : NULL);
+    if (!out)
+    {
+        free(keep);
+        return NULL;
+    }
+
+    size_t pos = sizeof(struct babehdr_t) + nkeep;
+    for (bl = 0; bl < blocks; bl++)
+    {
+        const struct babe_block *b = &idx->block[bl];
+        if (keep[bl])
+            pos = flash_babe_add_block(out, pos, b->addr, babe_buf + b->offset + 8, b->size);
+    }
+
+    free(keep);
+    return out;
+}
+
+int flash_babe_fw(struct transport *port, struct phone_info *phone, const char *filename,
+                  int flashfull, struct flash_journal *j)
 {
     printf("\nflashing babe: %s\n", filename);
 
+    // mapped, not loaded: the blocks stream from the page cache as they are sent
     size_t size;
-    uint8_t *buffer = load_file(filename, &size);
+    const uint8_t *buffer = map_file(filename, &size);
+    uint8_t *reduced = NULL;
+    struct babe_index idx = {0};
+
+    if (!buffer)
+    {
+        fprintf(stderr, "can't read %s\n", filename);
+        return FLASH_ERROR;
+    }
 
-    int babe = babe_check(buffer, size, CHECKBABE_CHECKFULL);
+    // one walk over the block headers, reused for the check, delta and sending;
+    // the hash chain runs later, block by block, behind the serial I/O
+    struct babe_verify verify;
+    int babe = babe_index_build(buffer, size, &idx);
+    if (babe == CHECKBABE_OK)
+        babe = babe_verify_start(&verify, buffer, &idx);
     switch (babe)
     {
     case CHECKBABE_NOTBABE:
@@ -229,54 +634,78 @@ int flash_babe_fw(struct sp_port *port, const char *filename, int flashfull)
         goto exit_error;
     }
 
-    if (flash_babe(port, buffer, size, flashfull) == 0)
+    struct flash_journal_entry *e = NULL;
+    if (j)
     {
-        free(buffer);
-        return FLASH_OK;
+        // the header carries the hash of every block, no need to hash the whole file
+        SHA1_CTX sha;
+        uint8_t hash[SHA1_BLOCK_SIZE];
+        uint8_t fsize[4];
+        char hex[41];
+        set_word(fsize, size);
+        sha1_init(&sha);
+        sha1_update(&sha, buffer, idx.hdrsize);
+        sha1_update(&sha, fsize, sizeof(fsize));
+        sha1_final(&sha, hash);
+        for (int i = 0; i < SHA1_BLOCK_SIZE; i++)
+            sprintf(hex + i * 2, "%02x", hash[i]);
+
+        e = flash_journal_entry(j, hex);
+        if (!e)
+        {
+            fprintf(stderr, "Error: too many firmware files in %s\n", j->path);
+            goto exit_error;
+        }
+        if (e->done)
+        {
+            printf("already flashed in the interrupted session, skipped\n");
+            babe_index_free(&idx);
+            unmap_file(buffer, size);
+            return FLASH_OK;
+        }
+        if (flash_journal_save(j) != 0)
+            goto exit_error;
     }
 
-exit_error:
-    free(buffer);
-    return FLASH_ERROR;
-}
-
-uint8_t *flash_convert_raw_to_babe(uint8_t *raw, size_t size, uint32_t raw_addr, size_t *babe_size_out)
-{
-    size_t numblocks = (size + 0xFFFF) / BLOCK_SIZE;
-    size_t babesize = numblocks * (8 + 1) + size + sizeof(struct babehdr_t);
-
-    uint8_t *babe = malloc(babesize);
-    if (!babe)
-        return NULL;
-
-    struct babehdr_t *babe_hdr = (struct babehdr_t *)babe;
-    babe_hdr->sig = 0xBEBA;
-    babe_hdr->ver = 3;
-    babe_hdr->payloadsize1 = numblocks;
-
-    size_t pos = sizeof(struct babehdr_t) + numblocks;
-    uint8_t *rawp = raw;
-    size_t left = size;
+    if (flash_cache_open(phone) != 0)
+        goto exit_error;
 
-    while (left > 0)
+    if (flash_delta != FLASH_DELTA_OFF)
     {
-        int bsize = left > BLOCK_SIZE ? BLOCK_SIZE : left;
-        *((uint32_t *)(babe + pos)) = raw_addr;
-        pos += 4;
-        *((uint32_t *)(babe + pos)) = bsize;
-        pos += 4;
-        memcpy(babe + pos, rawp, bsize);
-        pos += bsize;
-
-        rawp += bsize;
-        left -= bsize;
-        raw_addr += bsize;
+        // a delta rerun skips whatever made it, so it needs no block journal
+        size_t reduced_size;
+        reduced = flash_delta_reduce(port, buffer, &idx, &verify, &reduced_size);
+        if (!reduced)
+            goto exit_error;
+        blockcache_save(&flash_cache);
+
+        if (reduced_size == 0)
+            printf("nothing to flash, the phone already has every block\n");
+        else if (flash_babe(port, reduced, reduced_size, flashfull) != 0)
+            goto exit_error;
+
+        if (e)
+        {
+            e->done = 1;
+            flash_journal_save(j);
+        }
+    }
+    else if (flash_babe_journal(port, buffer, &idx, &verify, flashfull, j, e) != 0)
+    {
+        goto exit_error;
     }
 
-    if (babe_size_out)
-        *babe_size_out = babesize;
+    // flash_babe_journal() recorded what it wrote, the delta pass the rest
+    free(reduced);
+    babe_index_free(&idx);
+    unmap_file(buffer, size);
+    return FLASH_OK;
 
-    return babe;
+exit_error:
+    free(reduced);
+    babe_index_free(&idx);
+    unmap_file(buffer, size);
+    return FLASH_ERROR;
 }
 
 int flash_cnv_babe_to_raw_file(const char *babe_filename, const char *raw_filename)
@@ -408,7 +837,7 @@ int flash_cnv_raw_to_babe_file(const char *raw_filename, const char *babe_filena
     return FLASH_OK;
 }
 
-int flash_raw(struct sp_port *port, const char *filename, uint32_t raw_addr)
+int flash_raw(struct transport *port, const char *filename, uint32_t raw_addr)
 {
     size_t fsize;
     uint8_t *raw = load_file(filename, &fsize);
@@ -434,7 +863,7 @@ int flash_raw(struct sp_port *port, const char *filename, uint32_t raw_addr)
     return ret;
 }
 
-int flash_restore_boot_area(struct sp_port *port, struct phone_info *phone)
+int flash_restore_boot_area(struct transport *port, struct phone_info *phone)
 {
     if (flash_detect_fw_version(port, phone) != 0)
         return -1;
@@ -454,18 +883,16 @@ int flash_restore_boot_area(struct sp_port *port, struct phone_info *phone)
         printf("Flashing REST: %s\n", restfile);
 
         size_t size;
-        uint8_t *rest = load_file(restfile, &size);
+        const uint8_t *rest = map_file(restfile, &size);
         if (!rest)
         {
             fprintf(stderr, "can't read %s\n", restfile);
             return -1;
         }
-        if (flash_babe(port, rest, size, 1) != 0)
-        {
-            free(rest);
+        int rc = flash_babe(port, rest, size, 1);
+        unmap_file(rest, size);
+        if (rc != 0)
             return -1;
-        }
-        free(rest);
     }
     else
     {
@@ -501,261 +928,689 @@ int flash_restore_boot_area(struct sp_port *port, struct phone_info *phone)
 // ------------- Read from Flash -------------
 
 // --- receive one flash block ---
-int flash_recv_block(struct sp_port *port,
+// A frame with a bad checksum, or none at all, is NAKed and the loader sends
+// its last frame again; FLASH_RECV_RETRIES tries in all, the last failure
+// isn't NAKed since nobody would wait for the answer. Getting the previous
+// frame back means our ACK was lost: ACK it again and wait for ours.
+int flash_recv_block(struct transport *port,
                      uint32_t expected_addr,
                      uint8_t *buf,
                      int maxlen)
 {
-    // read 4-byte header
-    uint8_t hdr_buf[4];
-    int rcv_len = serial_read(port, hdr_buf, sizeof(hdr_buf), 5 * TIMEOUT);
-    if (rcv_len < 0)
+    for (int attempt = 0; attempt < FLASH_RECV_RETRIES; attempt++)
+    {
+        struct packetdata_t repl;
+        int rc = serial_recv_packet(port, &repl, 5 * TIMEOUT);
+        if (rc == SERIAL_RX_BADSUM || rc == SERIAL_RX_TIMEOUT)
+        {
+            const char *what = rc == SERIAL_RX_BADSUM ? "bad frame" : "no frame";
+            if (attempt + 1 == FLASH_RECV_RETRIES)
+            {
+                printf("\n%s at 0x%08X\n", what, expected_addr);
+                break;
+            }
+            printf("\n%s at 0x%08X, asking again (%d/%d)\n",
+                   what, expected_addr, attempt + 1, FLASH_RECV_RETRIES - 1);
+            uint8_t nak = SERIAL_NAK;
+            if (serial_write(port, &nak, 1) < 0)
+                return FLASH_ERROR;
+            continue;
+        }
+        if (rc != SERIAL_RX_OK)
+            return FLASH_ERROR;
+
+        int length = repl.length;
+        uint8_t *resp = repl.data;
+
+        if (repl.cmd != 0x33)
+        {
+            fprintf(stderr, "Unexpected CMD 0x33 got 0x%X\n", repl.cmd);
+            return FLASH_ERROR;
+        }
+        if (length < 6)
+        {
+            fprintf(stderr, "Bad reply size\n");
+            return FLASH_ERROR;
+        }
+
+        // parse address
+        int data_len = length - 6; // subtract 4-byte addr + 2-byte length
+        uint32_t rpl_addr = get_word(&resp[2]);
+        if (rpl_addr != expected_addr && rpl_addr + data_len == expected_addr)
+        {
+            uint8_t ack = SERIAL_ACK;
+            if (serial_write(port, &ack, 1) < 0)
+                return FLASH_ERROR;
+            continue;
+        }
+        if (rpl_addr != expected_addr)
+        {
+            fprintf(stderr, "Bad reply addr: expected 0x%08X got 0x%08X\n",
+                    expected_addr, rpl_addr);
+            return FLASH_ERROR;
+        }
+
+        // copy data into buf
+        if (data_len > maxlen)
+            data_len = maxlen; // truncate if needed
+
+        memcpy(buf, &resp[6], data_len);
+        return data_len;
+    }
+
+    fprintf(stderr, "\ngiving up on the frame at 0x%08X\n", expected_addr);
+    return FLASH_ERROR;
+}
+
+// --- flash_read_range ---
+// One 0x32 for the whole range; every 0x33 frame is ACKed first (so the
+// phone sends the next one) and then handed to sink.
+static int flash_read_range(struct transport *port, uint32_t addr, size_t size,
+                            int (*sink)(void *ctx, const uint8_t *data, size_t len), void *ctx)
+{
+    uint32_t addr_range[2] = {addr, addr + size};
+
+    uint8_t cmd_buf[32];
+    int cmd_len = cmd_encode_binary_packet(0x32,
+                                           (uint8_t *)addr_range,
+                                           sizeof(addr_range),
+                                           cmd_buf);
+    if (cmd_len <= 0)
         return FLASH_ERROR;
 
-    int length = get_half(&hdr_buf[2]); // little endian u16
+    if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
+        return FLASH_ERROR;
 
-    if (hdr_buf[0] != SERIAL_HDR89)
-    {
-        fprintf(stderr, "Bad HDR: 0x%02X\n", hdr_buf[0]);
+    uint8_t ack;
+    int rcv_len = serial_read(port, &ack, 1, 50 * TIMEOUT);
+    if (rcv_len <= 0)
         return FLASH_ERROR;
+
+    size_t pos = 0;
+    while (pos < size)
+    {
+        uint8_t tmp[0x800];
+        int data_len = flash_recv_block(port, addr + pos, tmp, sizeof(tmp));
+        if (data_len < 0)
+            return FLASH_ERROR;
+        if (data_len == 0)
+        {
+            fprintf(stderr, "Empty read frame at 0x%08zX\n", addr + pos);
+            return FLASH_ERROR;
+        }
+
+        if (pos + data_len > size)
+            data_len = size - pos;
+        pos += data_len;
+
+        if (pos < size)
+        {
+            uint8_t ack = SERIAL_ACK;
+            if (serial_write(port, &ack, 1) < 0)
+                return FLASH_ERROR;
+        }
+
+        if (sink(ctx, tmp, data_len) != 0)
+            return FLASH_ERROR;
     }
-    if (hdr_buf[1] != 0x33)
+
+    return FLASH_OK;
+}
+
+static int flash_read_to_buf(void *ctx, const uint8_t *data, size_t len)
+{
+    uint8_t **pos = ctx;
+    memcpy(*pos, data, len);
+    *pos += len;
+    return 0;
+}
+
+uint8_t *flash_read_raw(struct transport *port, uint32_t addr, size_t size)
+{
+    uint8_t *buf = malloc(size);
+    if (!buf)
+        return NULL;
+
+    uint8_t *pos = buf;
+    if (flash_read_range(port, addr, size, flash_read_to_buf, &pos) != FLASH_OK)
     {
-        fprintf(stderr, "Unexpected CMD 0x33 got 0x%X\n", hdr_buf[1]);
-        return FLASH_ERROR;
+        free(buf);
+        return NULL;
+    }
+
+    return buf; // caller must free()
+}
+
+// a cached block must still match the phone in a random
+// FLASH_CACHE_SPOT_SIZE window, unless --read-cache trust
+static int flash_cache_spot_check(struct transport *port, uint32_t addr, const uint8_t *data, size_t size)
+{
+    static uint32_t seed;
+    if (!seed)
+        seed = (uint32_t)(get_time_sec() * 1000) | 1;
+    seed = seed * 1103515245 + 12345;
+
+    size_t spots = size / FLASH_CACHE_SPOT_SIZE;
+    size_t off = spots > 1 ? (seed >> 8) % spots * FLASH_CACHE_SPOT_SIZE : 0;
+    size_t len = size - off < FLASH_CACHE_SPOT_SIZE ? size - off : FLASH_CACHE_SPOT_SIZE;
+
+    uint8_t *raw = flash_read_raw(port, addr + off, len);
+    if (!raw)
+        return -1;
+    int same = memcmp(raw, data + off, len) == 0;
+    free(raw);
+    return same ? 0 : -1;
+}
+
+// the whole block at addr from the session cache, 0 = hit; spot = a spot
+// read is enough to confirm it, else only --read-cache trust takes it
+static int flash_cache_block(struct transport *port, uint32_t addr, uint8_t *out, int spot)
+{
+    if (!spot && flash_read_cache != FLASH_CACHE_TRUST)
+        return -1;
+    if (flash_cache_get(addr, BLOCK_SIZE, out) != 0)
+        return -1;
+    if (flash_read_cache == FLASH_CACHE_TRUST ||
+        flash_cache_spot_check(port, addr, out, BLOCK_SIZE) == 0)
+        return 0;
+
+    // changed behind our back (another tool, a different firmware)
+    printf("\ncached block 0x%08X no longer matches the phone, reading it\n", addr);
+    blockcache_invalidate(&flash_cache, addr, BLOCK_SIZE);
+    return -1;
+}
+
+// flash_read_raw() through the session cache, for the blocks a session
+// reads again and again (VKP erase blocks, the version area). Whole blocks
+// are cached as they are read; a part of a block is served from the cache
+// only if the whole block is there. spot: see flash_cache_block(); data
+// that gets written back to the phone must not rely on a spot read.
+uint8_t *flash_read_cached(struct transport *port, uint32_t addr, size_t size, int spot)
+{
+    if (!flash_cache_ready || flash_read_cache == FLASH_CACHE_OFF)
+        return flash_read_raw(port, addr, size);
+
+    uint8_t *buf = malloc(size);
+    uint8_t *block = malloc(BLOCK_SIZE);
+    if (!buf || !block)
+    {
+        free(buf);
+        free(block);
+        return NULL;
     }
-    if (length < 6)
+
+    size_t pos = 0;
+    while (pos < size)
     {
-        fprintf(stderr, "Bad reply size\n");
-        return FLASH_ERROR;
+        uint32_t base = (addr + pos) & ~(BLOCK_SIZE - 1);
+        size_t off = addr + pos - base;
+        size_t n = BLOCK_SIZE - off;
+        if (n > size - pos)
+            n = size - pos;
+
+        if (flash_cache_block(port, base, block, spot) != 0)
+        {
+            // a whole block is worth keeping, a part is just read
+            uint8_t *raw = flash_read_raw(port, addr + pos, n);
+            if (!raw)
+            {
+                free(buf);
+                free(block);
+                return NULL;
+            }
+            if (n == BLOCK_SIZE)
+                flash_cache_keep(base, raw, BLOCK_SIZE);
+            memcpy(block + off, raw, n);
+            free(raw);
+        }
+
+        memcpy(buf + pos, block + off, n);
+        pos += n;
     }
 
-    // read block
-    uint8_t resp[0x800];
-    rcv_len = serial_read(port, resp, length, 5 * TIMEOUT);
-    if (rcv_len < 0)
-        return FLASH_ERROR;
+    free(block);
+    blockcache_save(&flash_cache);
+    return buf; // caller must free()
+}
+
+// --- firmware version probe ---
+// The version string sits somewhere in a candidate region per chip. The
+// region is read in growing windows, smallest first, and reading stops
+// once the string is complete; where it was found is kept in
+// backup/fwprobe.txt (chip_id flash_id addr) and tried first next time.
+#define FLASH_PROBE_FILE "./backup/fwprobe.txt"
+
+static void flash_set_fw_version(struct phone_info *phone, uint8_t *buf, size_t size)
+{
+    char fw_id[128];
+    if (scan_fw_version(buf, size, fw_id, sizeof(fw_id)) != 0)
+        return;
+
+    printf("\nFW Version: %s\n", fw_id);
+
+    size_t len = strlen(fw_id);
+    if (len >= sizeof(phone->fw_version))
+        len = sizeof(phone->fw_version) - 1;
+
+    memcpy(phone->fw_version, fw_id, len);
+    phone->fw_version[len] = '\0';
+}
 
-    // read checksum
-    uint8_t checksum;
-    rcv_len = serial_read(port, &checksum, 1, 5 * TIMEOUT);
-    if (rcv_len < 0)
+// 0 = found at *hit
+static int flash_scan_fw_version(struct transport *port, struct phone_info *phone,
+                                 uint32_t addr, size_t size, uint32_t *hit)
+{
+    struct sigscan scan;
+    if (sigscan_init(&scan, sigscan_fw_ids, sigscan_fw_ids_count) != 0)
         return FLASH_ERROR;
 
-    // verify checksum
-    uint8_t sum = 0;
-    for (int i = 0; i < 4; i++)
-        sum ^= hdr_buf[i];
-    for (int i = 0; i < length; i++)
-        sum ^= resp[i];
-    sum = (sum + 7) & 0xFF;
+    uint8_t *buf = malloc(size);
+    if (!buf)
+        return FLASH_ERROR;
 
-    if (sum != checksum)
+    size_t len = 0;
+    size_t window = FLASH_PROBE_WINDOW;
+    size_t found = (size_t)-1;
+    while (len < size)
     {
-        uint8_t nak = SERIAL_NAK;
-        serial_write(port, &nak, 1);
-        fprintf(stderr, "Checksum mismatch! got 0x%02X expected 0x%02X\n", checksum, sum);
-        return FLASH_ERROR;
+        size_t chunk = size - len;
+        if (chunk > window)
+            chunk = window;
+
+        uint8_t *pos = buf + len;
+        if (flash_read_range(port, addr + len, chunk, flash_read_to_buf, &pos) != FLASH_OK)
+        {
+            free(buf);
+            return FLASH_ERROR;
+        }
+
+        // only the new bytes, the scanner carries a marker split between windows
+        if (found == (size_t)-1)
+            sigscan_feed(&scan, buf + len, chunk, sigscan_first_hit, &found);
+        len += chunk;
+
+        if (found != (size_t)-1 && len - found >= FLASH_PROBE_TAIL)
+            break;
+        if (window < FLASH_READ_WINDOW)
+            window *= 2;
     }
 
-    // parse address
-    uint32_t rpl_addr = get_word(&resp[2]);
-    if (rpl_addr != expected_addr)
+    if (found == (size_t)-1)
     {
-        fprintf(stderr, "Bad reply addr: expected 0x%08X got 0x%08X\n",
-                expected_addr, rpl_addr);
+        free(buf);
         return FLASH_ERROR;
     }
 
-    // copy data into buf
-    int data_len = length - 6; // subtract 4-byte addr + 2-byte length
-    if (data_len > maxlen)
-        data_len = maxlen; // truncate if needed
-
-    memcpy(buf, &resp[6], data_len);
-    return data_len;
+    flash_set_fw_version(phone, buf + found, len - found);
+    *hit = addr + found;
+    free(buf);
+    return FLASH_OK;
 }
 
-uint8_t *flash_read_raw(struct sp_port *port, uint32_t addr, size_t size)
+static int flash_probe_cache_get(const struct phone_info *phone, uint32_t *addr)
 {
-    uint32_t addr_range[2] = {addr, addr + size};
-
-    uint8_t cmd_buf[32];
-    int cmd_len = cmd_encode_binary_packet(0x32,
-                                           (uint8_t *)addr_range,
-                                           sizeof(addr_range),
-                                           cmd_buf);
-    if (cmd_len <= 0)
-        return NULL;
-
-    if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
-        return NULL;
-
-    uint8_t ack;
-    int rcv_len = serial_read(port, &ack, 1, 50 * TIMEOUT);
-    if (rcv_len <= 0)
-        return NULL;
-
-    uint8_t *buf = malloc(size);
-    if (!buf)
-        return NULL;
+    FILE *f = fopen(FLASH_PROBE_FILE, "r");
+    if (!f)
+        return -1;
 
-    size_t pos = 0;
-    while (pos < size)
+    char line[64];
+    int rc = -1;
+    while (rc != 0 && fgets(line, sizeof(line), f))
     {
-        uint8_t tmp[0x800];
-        int data_len = flash_recv_block(port, addr + pos, tmp, sizeof(tmp));
-        if (data_len < 0)
+        unsigned chip, flashid, a;
+        if (sscanf(line, "%x %x %x", &chip, &flashid, &a) == 3 &&
+            chip == phone->chip_id && flashid == (unsigned)phone->flash_id)
         {
-            free(buf);
-            return NULL;
+            *addr = a;
+            rc = 0;
         }
+    }
 
-        if (pos + data_len > size)
-            data_len = size - pos;
+    fclose(f);
+    return rc;
+}
 
-        memcpy(buf + pos, tmp, data_len);
-        pos += data_len;
+// rewrites the file with this phone's line replaced
+static void flash_probe_cache_put(const struct phone_info *phone, uint32_t addr)
+{
+    char lines[63][64]; // one line per chip/flash pair, a few in practice
+    int n = 0;
 
-        if (pos < size)
+    FILE *f = fopen(FLASH_PROBE_FILE, "r");
+    if (f)
+    {
+        char line[64];
+        while (n < 63 && fgets(line, sizeof(line), f))
         {
-            uint8_t ack = SERIAL_ACK;
-            if (serial_write(port, &ack, 1) < 0)
-            {
-                free(buf);
-                return NULL;
-            }
+            unsigned chip, flashid, a;
+            if (sscanf(line, "%x %x %x", &chip, &flashid, &a) != 3 ||
+                (chip == phone->chip_id && flashid == (unsigned)phone->flash_id))
+                continue;
+            snprintf(lines[n++], sizeof(lines[0]), "%04X %04X %08X\n", chip, flashid, a);
         }
+        fclose(f);
     }
 
-    return buf; // caller must free()
+    f = fopen(FLASH_PROBE_FILE, "w");
+    if (!f)
+        return;
+    for (int i = 0; i < n; i++)
+        fputs(lines[i], f);
+    fprintf(f, "%04X %04X %08X\n", phone->chip_id, (unsigned)phone->flash_id, addr);
+    fclose(f);
 }
 
-int flash_scan_fw_version(struct sp_port *port, struct phone_info *phone,
-                          uint32_t addr, size_t size)
+// the version string is still where it was last time (same firmware)
+static int flash_probe_cached(struct transport *port, struct phone_info *phone, uint32_t addr)
 {
-    uint8_t *buf = flash_read_raw(port, addr, size);
+    uint8_t *buf = flash_read_cached(port, addr, FLASH_PROBE_TAIL, 1);
     if (!buf)
         return FLASH_ERROR;
 
-    char fw_id[128];
-    if (scan_fw_version(buf, size, fw_id, sizeof(fw_id)) == 0)
+    int rc = FLASH_ERROR;
+    if (find_fw_marker(buf, 0, 6) == 0)
     {
-        printf("\nFW Version: %s\n", fw_id);
-
-        size_t len = strlen(fw_id);
-        if (len >= sizeof(phone->fw_version))
-            len = sizeof(phone->fw_version) - 1;
+        flash_set_fw_version(phone, buf, FLASH_PROBE_TAIL);
+        rc = FLASH_OK;
+    }
 
-        memcpy(phone->fw_version, fw_id, len);
-        phone->fw_version[len] = '\0';
+    free(buf);
+    return rc;
+}
 
-        free(buf);
+static const struct
+{
+    uint16_t chip_id;
+    uint32_t addr;
+    size_t size;
+} flash_fw_regions[] = {
+    {PNX5230, 0x216E0000, 4 * BLOCK_SIZE},   // W350/W380/Z555
+    {PNX5230, 0x213FC000, BLOCK_SIZE},       // Z310
+    {DB2000, 0x21A00000, 4 * BLOCK_SIZE},    // W900
+    {DB2000, 0x21400000, 4 * BLOCK_SIZE},    // K600/K608/V600
+    {DB2010_1, 0x44880000, 16 * BLOCK_SIZE},
+    {DB2010_1, 0x447C0000, 4 * BLOCK_SIZE},
+    {DB2010_1, 0x44B00000, 4 * BLOCK_SIZE},
+    {DB2010_2, 0x44880000, 16 * BLOCK_SIZE},
+    {DB2010_2, 0x447C0000, 4 * BLOCK_SIZE},
+    {DB2010_2, 0x44B00000, 4 * BLOCK_SIZE},
+    {DB2020, 0x45B00000, 8 * BLOCK_SIZE},
+};
+
+int flash_detect_fw_version(struct transport *port, struct phone_info *phone)
+{
+    uint32_t addr;
+    if (flash_probe_cache_get(phone, &addr) == 0 &&
+        flash_probe_cached(port, phone, addr) == FLASH_OK)
         return FLASH_OK;
+
+    int known = 0;
+    for (size_t i = 0; i < sizeof(flash_fw_regions) / sizeof(flash_fw_regions[0]); i++)
+    {
+        if (flash_fw_regions[i].chip_id != phone->chip_id)
+            continue;
+        known = 1;
+
+        if (flash_scan_fw_version(port, phone, flash_fw_regions[i].addr,
+                                  flash_fw_regions[i].size, &addr) == FLASH_OK)
+        {
+            flash_probe_cache_put(phone, addr);
+            return FLASH_OK;
+        }
     }
 
-    free(buf);
+    if (!known)
+        printf("Unsupported chip id: %08X\n", phone->chip_id);
     return FLASH_ERROR;
 }
 
-int flash_detect_fw_version(struct sp_port *port, struct phone_info *phone)
+// --- streaming dump ---
+struct flash_dump
 {
-    if (phone->chip_id == PNX5230)
+    struct dumpwriter *out;
+    uint32_t addr; // start of the dump
+    size_t size;
+    size_t done;
+    double start_time;
+};
+
+static int flash_dump_frame(void *ctx, const uint8_t *data, size_t len)
+{
+    struct flash_dump *d = ctx;
+
+    // only a copy into the writer's pool, the disk is written on its own thread
+    if (dumpwriter_write(d->out, data, len) != 0)
+        return -1;
+
+    size_t prev = d->done;
+    d->done += len;
+
+    // one progress line per 64 KB, not per frame
+    if (prev / BLOCK_SIZE != d->done / BLOCK_SIZE || d->done == d->size)
     {
-        if (flash_scan_fw_version(port, phone, 0x216E0000, 4 * BLOCK_SIZE) == 0) // W350/W380/Z555
-            return FLASH_OK;
+        double elapsed = get_time_sec() - d->start_time;
+        printf("\rreading 0x%08zX: %zu/%zu KB, %.1f KB/s",
+               d->addr + d->done, d->done / 1024, d->size / 1024,
+               elapsed > 0 ? d->done / elapsed / 1024 : 0.0);
+        fflush(stdout);
+    }
+    return 0;
+}
 
-        return flash_scan_fw_version(port, phone, 0x213FC000, BLOCK_SIZE); // Z310
+// --- dump resume ---
+// Where an earlier, interrupted dump of the same range can go on: its length
+// rounded down to a block, if the phone still has the same last block.
+// Returns 0 to start over, (size_t)-1 on a read error.
+static size_t flash_dump_resume_point(struct transport *port, const char *rawfile,
+                                      uint32_t addr, size_t size)
+{
+    FILE *f = fopen(rawfile, "rb");
+    if (!f)
+    {
+        printf("nothing to resume, %s not found\n", rawfile);
+        return 0;
     }
-    else if (phone->chip_id == DB2000)
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    size_t have = len > 0 ? (size_t)len : 0;
+    if (have > size)
+        have = size;
+    have -= have % BLOCK_SIZE;
+    if (have == 0)
     {
-        if (flash_scan_fw_version(port, phone, 0x21A00000, 4 * BLOCK_SIZE) == 0) // W900
-            return FLASH_OK;
+        fclose(f);
+        return 0;
+    }
 
-        return flash_scan_fw_version(port, phone, 0x21400000, 4 * BLOCK_SIZE); // // K600/K608/V600
+    // the tail is what a dropped link or a full disk would have damaged
+    uint8_t *tail = malloc(BLOCK_SIZE);
+    if (!tail)
+    {
+        fclose(f);
+        return (size_t)-1;
     }
-    else if (phone->chip_id == DB2010_1 || phone->chip_id == DB2010_2)
+    fseek(f, have - BLOCK_SIZE, SEEK_SET);
+    size_t got = fread(tail, 1, BLOCK_SIZE, f);
+    fclose(f);
+
+    uint8_t *raw = flash_read_raw(port, addr + have - BLOCK_SIZE, BLOCK_SIZE);
+    if (!raw)
     {
-        if (flash_scan_fw_version(port, phone, 0x44880000, 16 * BLOCK_SIZE) == 0)
-            return FLASH_OK;
+        free(tail);
+        return (size_t)-1;
+    }
 
-        if (flash_scan_fw_version(port, phone, 0x447C0000, 4 * BLOCK_SIZE) == 0)
-            return FLASH_OK;
+    int same = got == BLOCK_SIZE && memcmp(tail, raw, BLOCK_SIZE) == 0;
+    free(raw);
+    free(tail);
 
-        return flash_scan_fw_version(port, phone, 0x44B00000, 4 * BLOCK_SIZE);
+    if (!same)
+    {
+        printf("the end of %s doesn't match the phone, starting over\n", rawfile);
+        return 0;
     }
-    else if (phone->chip_id == DB2020)
+
+    printf("resuming at 0x%08zX, %zu KB already read\n", addr + have, have / 1024);
+    return have;
+}
+
+// the part of a resumed dump that is already on disk goes into the manifest first
+static int flash_dump_manifest_kept(struct manifest *m, const char *rawfile,
+                                    uint32_t addr, size_t kept)
+{
+    FILE *f = fopen(rawfile, "rb");
+    uint8_t *buf = malloc(BLOCK_SIZE);
+    int rc = f && buf ? 0 : -1;
+
+    for (size_t pos = 0; rc == 0 && pos < kept; pos += BLOCK_SIZE)
     {
-        return flash_scan_fw_version(port, phone, 0x45B00000, 8 * BLOCK_SIZE);
+        if (fread(buf, 1, BLOCK_SIZE, f) != BLOCK_SIZE)
+            rc = -1;
+        else
+            rc = manifest_add(m, addr + pos, buf, BLOCK_SIZE);
     }
 
-    printf("Unsupported chip id: %08X\n", phone->chip_id);
-    return FLASH_ERROR;
+    if (f)
+        fclose(f);
+    free(buf);
+    return rc;
+}
+
+// what was just read is what the phone has, the block cache can skip rehashing
+// it; the data went to the block store on the writer thread
+static void flash_dump_cache_blocks(const struct manifest *m)
+{
+    if (!flash_cache_ready)
+        return;
+
+    for (size_t i = 0; i < m->count; i++)
+        blockcache_set(&flash_cache, m->e[i].addr, m->e[i].size, m->e[i].sha1);
+
+    blockcache_save(&flash_cache);
 }
 
-int flash_read(struct sp_port *port, struct phone_info *phone,
+int flash_read(struct transport *port, struct phone_info *phone,
                uint32_t addr, size_t size)
 {
+    // save-as-babe is written as a BABE right away, no raw file in between
+    int format = phone->save_as_babe ? DUMPWRITER_BABE : flash_dump_format;
+    const char *ext = format == DUMPWRITER_BABE ? "ssw" : format == DUMPWRITER_ZDUMP ? "zdump" : "bin";
+    int to_store = format == DUMPWRITER_STORE;
+
     char rawfile[1024];
     snprintf(rawfile, sizeof(rawfile),
-             "./backup/flashdump_%s_%08X_%08zX.bin",
+             "./backup/flashdump_%s_%08X_%08zX.%s",
              phone->otp_imei,
-             addr, size);
+             addr, size, ext);
 
-    FILE *out = fopen(rawfile, "wb");
-    if (!out)
-    {
-        perror("open output");
-        return FLASH_ERROR;
-    }
-
-    printf("\nreading raw: %s\n", rawfile);
-    size_t total_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    printf("reading %zu blocks\n", total_blocks);
+    if (to_store)
+        printf("\nreading into %s\n", STORE_DIR);
+    else
+        printf("\nreading %s: %s\n", format == DUMPWRITER_BABE ? "babe" : "raw", rawfile);
 
-    size_t pos = 0;
-    while (pos < size)
+    size_t start = 0;
+    if (phone->resume)
     {
-        size_t chunk = (size - pos < BLOCK_SIZE) ? (size - pos) : BLOCK_SIZE;
-        uint8_t *buf = flash_read_raw(port, addr + pos, chunk);
-        if (!buf)
-        {
-            fclose(out);
+        start = flash_dump_resume_point(port, rawfile, addr, size);
+        if (start == (size_t)-1)
             return FLASH_ERROR;
-        }
+    }
 
-        fwrite(buf, 1, chunk, out);
-        free(buf);
+    char manifestfile[1024];
+    snprintf(manifestfile, sizeof(manifestfile),
+             "./backup/flashdump_%s_%08X_%08zX.manifest",
+             phone->otp_imei,
+             addr, size);
 
-        pos += chunk;
+    struct manifest manifest;
+    if (manifest_create(&manifest, manifestfile) != 0)
+        return FLASH_ERROR;
+    if (start && flash_dump_manifest_kept(&manifest, rawfile, addr, start) != 0)
+    {
+        fprintf(stderr, "Error: can't hash the kept part of %s\n", rawfile);
+        manifest_free(&manifest);
+        return FLASH_ERROR;
+    }
 
-        size_t current_block = pos / BLOCK_SIZE;
-        printf("\rreading block: %zu/%zu (addr 0x%08zX size 0x%zX)",
-               current_block, total_blocks, addr + pos, chunk);
-        fflush(stdout);
+    struct dumpwriter *out = dumpwriter_open(rawfile, format, start, addr, size);
+    if (!out)
+    {
+        manifest_free(&manifest);
+        return FLASH_ERROR;
     }
+    dumpwriter_set_manifest(out, &manifest);
+    if (flash_cache_ready && flash_read_cache != FLASH_CACHE_OFF)
+        dumpwriter_set_store(out);
 
-    printf("\n\n");
-    fclose(out);
+    uint8_t *block = malloc(BLOCK_SIZE);
+    if (!block)
+    {
+        dumpwriter_close(out);
+        manifest_free(&manifest);
+        return FLASH_ERROR;
+    }
 
-    // --- optional babe conversion ---
-    if (phone->save_as_babe)
+    // one 0x32 per window instead of per 64 KB, frames go straight to the file.
+    // A backup has to be what the phone has now: a spot read can't tell a
+    // block the phone rewrote since, so cached blocks only with trust
+    int from_cache = flash_cache_ready && flash_read_cache == FLASH_CACHE_TRUST;
+    struct flash_dump dump = {out, addr, size, start, get_time_sec()};
+    int ncached = 0;
+    while (dump.done < size)
     {
-        char babefile[1024];
-        snprintf(babefile, sizeof(babefile),
-                 "./backup/flashdump_%s_%08X_%08zX.ssw",
-                 phone->otp_imei,
-                 addr, size);
+        int rc = FLASH_OK;
+        if (from_cache && size - dump.done >= BLOCK_SIZE &&
+            flash_cache_block(port, addr + dump.done, block, 0) == 0)
+        {
+            rc = flash_dump_frame(&dump, block, BLOCK_SIZE) == 0 ? FLASH_OK : FLASH_ERROR;
+            ncached++;
+        }
+        else
+        {
+            // up to the next block the cache knows
+            size_t chunk = BLOCK_SIZE;
+            while (chunk < FLASH_READ_WINDOW && dump.done + chunk < size &&
+                   !(from_cache && blockcache_find(&flash_cache, addr + dump.done + chunk)))
+                chunk += BLOCK_SIZE;
+            if (chunk > size - dump.done)
+                chunk = size - dump.done;
+
+            rc = flash_read_range(port, addr + dump.done, chunk, flash_dump_frame, &dump);
+        }
 
-        printf("converting to babe: %s\n", babefile);
-        if (flash_cnv_raw_to_babe_file(rawfile, babefile, addr) != 0)
+        if (rc != FLASH_OK)
         {
-            fprintf(stderr, "Error: failed to convert raw to babe\n");
+            fprintf(stderr, "\nread failed at 0x%08zX\n", addr + dump.done);
+            if (dumpwriter_close(out) == 0 && dump.done >= BLOCK_SIZE)
+                fprintf(stderr, "run the same command with --resume to continue\n");
+            free(block);
+            manifest_free(&manifest);
             return FLASH_ERROR;
         }
-        remove(rawfile);
     }
+    free(block);
 
+    printf("\n");
+    if (size - start > (size_t)ncached * BLOCK_SIZE)
+        flash_print_throughput(size - start - (size_t)ncached * BLOCK_SIZE, get_time_sec() - dump.start_time);
+    if (ncached)
+        printf("%d blocks from the cache\n", ncached);
+    printf("\n");
+    int rc = dumpwriter_close(out);
+    if (rc == 0 && manifest_finish(&manifest) != 0)
+        rc = -1;
+    if (rc != 0)
+    {
+        fprintf(stderr, "Error: failed to write %s\n", rawfile);
+        manifest_free(&manifest);
+        return FLASH_ERROR;
+    }
+
+    // with the store the manifest is the dump, store2raw/store2babe rebuild it
+    printf("%s: %s (%zu blocks)\n", to_store ? "recipe" : "manifest", manifestfile, manifest.count);
+    flash_dump_cache_blocks(&manifest);
+    manifest_free(&manifest);
     return FLASH_OK;
 }
 
@@ -791,7 +1646,15 @@ static user_choice_t ask_user_choice(const char *prompt,
     }
 }
 
-static int cmp_u32(const void *a, const void *b)
+// the byte at addr in the read copy of erase block data, where every
+// BLOCK_SIZE chunk follows its 8 byte BABE block header
+static uint8_t *flash_vkp_byte(uint8_t *data, uint32_t block, uint32_t addr)
+{
+    uint32_t off = addr - block;
+    return data + (off / BLOCK_SIZE) * (8 + BLOCK_SIZE) + 8 + off % BLOCK_SIZE;
+}
+
+static int flash_cmp_u32(const void *a, const void *b)
 {
     uint32_t va = *(const uint32_t *)a;
     uint32_t vb = *(const uint32_t *)b;
@@ -803,77 +1666,275 @@ static int cmp_u32(const void *a, const void *b)
     return 0;
 }
 
-int flash_vkp(struct sp_port *port, const char *filename, vkp_patch_t *patch,
-              int remove_flag, size_t flashblocksize)
+// Patches that write the same bytes. They still go in file order, so one
+// can be made on top of another, but it's worth saying before the questions.
+static void flash_vkp_conflicts(int count, const char **filenames, const vkp_patch_t *patches)
 {
-    if (!patch || patch->patch.count == 0)
+    for (int i = 0; i < count; i++)
     {
-        fprintf(stderr, "empty patch\n");
-        return FLASH_VKP_ERR;
+        for (int j = i + 1; j < count; j++)
+        {
+            const vkp_set_t *a = &patches[i].patch;
+            const vkp_set_t *b = &patches[j].patch;
+            size_t ka = 0, kb = 0, same = 0;
+            uint32_t first = 0;
+
+            // both are sorted by address
+            while (ka < a->count && kb < b->count)
+            {
+                if (a->lines[ka].addr < b->lines[kb].addr)
+                    ka++;
+                else if (a->lines[ka].addr > b->lines[kb].addr)
+                    kb++;
+                else
+                {
+                    if (same++ == 0)
+                        first = a->lines[ka].addr;
+                    ka++;
+                    kb++;
+                }
+            }
+            if (same)
+                printf("%s and %s both patch %zu byte(s), first at 0x%08X\n",
+                       filenames[i], filenames[j], same, first);
+        }
     }
-    if (patch->errorline)
+}
+
+// A registered patch is still on the phone if a few of its lines read
+// back patched: FLASH_VKP_SPOTS runs of up to FLASH_VKP_SPOT_RUN bytes,
+// from the first line to the last. 0 = it is
+static int flash_vkp_spot_check(struct transport *port, const vkp_patch_t *patch)
+{
+    const vkp_set_t *s = &patch->patch;
+    size_t done = 0;
+
+    for (int k = 0; k < FLASH_VKP_SPOTS; k++)
     {
-        fprintf(stderr, "%s: error in line %d\n", filename, patch->errorline);
-        return FLASH_VKP_ERR;
+        size_t i = (s->count - 1) * k / (FLASH_VKP_SPOTS - 1);
+        if (k > 0 && i < done)
+            continue; // in the run read last
+        size_t j = i + 1;
+        while (j < s->count && j - i < FLASH_VKP_SPOT_RUN &&
+               s->lines[j].addr == s->lines[j - 1].addr + 1)
+            j++;
+        done = j;
+
+        uint8_t *raw = flash_read_raw(port, s->lines[i].addr, j - i);
+        if (!raw)
+            return -1;
+        int same = 1;
+        for (size_t m = i; m < j; m++)
+            if (raw[m - i] != s->lines[m].data[1])
+                same = 0;
+        free(raw);
+        if (!same)
+            return -1;
+    }
+    return 0;
+}
+
+// Patches the registry has as installed, asked about before anything is
+// read: skip leaves them out of the read, uninstall marks them in
+// uninstall[]. A stale entry is dropped, the patch is then checked in full.
+static int flash_vkp_registered(struct transport *port, struct patchreg *reg, int count,
+                                const char **filenames, vkp_patch_t *patches,
+                                uint8_t (*digest)[20], char *skip, char *uninstall,
+                                int *skipped)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!patchreg_find(reg, digest[i]))
+            continue;
+        if (flash_read_cache == FLASH_CACHE_SPOT && flash_vkp_spot_check(port, &patches[i]) != 0)
+        {
+            printf("%s: registry entry no longer matches the phone, checking it in full\n",
+                   filenames[i]);
+            patchreg_remove(reg, digest[i]);
+            continue;
+        }
+
+        char prompt[300];
+        snprintf(prompt, sizeof(prompt), "%s: patch installed (registry), ", filenames[i]);
+
+        user_choice_t choice = ask_user_choice(prompt, "[u]ninstall / [s]kip / [a]bort");
+
+        if (choice == CHOICE_UNINSTALL)
+            uninstall[i] = 1;
+        else if (choice == CHOICE_SKIP)
+        {
+            printf("skipping %s\n", filenames[i]);
+            skip[i] = 1;
+            (*skipped)++;
+        }
+        else // abort
+            return -1;
+    }
+    return 0;
+}
+
+// state[] after the run, in file order, so a patch written over by a later
+// one is dropped again: 1 = installed, 0 = not (any more), -1 = unknown
+static void flash_vkp_register(struct patchreg *reg, int count, const char **filenames,
+                               const vkp_patch_t *patches, uint8_t (*digest)[20],
+                               const signed char *state, const char *applied)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (state[i] < 0)
+            continue;
+        if (applied[i])
+            patchreg_drop_overlaps(reg, &patches[i]);
+        if (state[i])
+            patchreg_add(reg, digest[i], filenames[i], &patches[i]);
+        else
+            patchreg_remove(reg, digest[i]);
     }
+    patchreg_save(reg);
+}
+
+// All patches in one go: the erase blocks any of them touches are read
+// once, each patch is checked and applied in file order on that copy, and
+// the blocks that changed are flashed as one BABE. The install/uninstall/
+// skip questions are per patch. Abort leaves the phone untouched.
+// Patches found installed or flashed go to the phone's patch registry
+// (backup/patches_<imei>.txt); the ones it already has are confirmed with
+// a few bytes instead of their erase blocks, unless --read-cache off.
+int flash_vkp_batch(struct transport *port, int count, const char **filenames,
+                    vkp_patch_t *patches, int remove_flag, const struct phone_info *phone,
+                    int *patched, int *skipped)
+{
+    *patched = 0;
+    *skipped = 0;
+    size_t flashblocksize = phone->flashblocksize;
     if (flashblocksize == 0)
     {
         fprintf(stderr, "unknown flash chip\n");
         return FLASH_VKP_ERR;
     }
 
-    // 1. Collect blocks
-    uint32_t blocks[MAX_BLOCKS];
-    size_t nblocks = vkp_collect_unique_blocks(patch, flashblocksize, blocks, MAX_BLOCKS);
-    if (nblocks == 0)
+    struct patchreg reg;
+    if (patchreg_open(&reg, phone->otp_imei) != 0)
     {
-        fprintf(stderr, "no blocks to patch\n");
+        fprintf(stderr, "malloc failed\n");
         return FLASH_VKP_ERR;
     }
-    qsort(blocks, nblocks, sizeof(uint32_t), cmp_u32);
 
-    size_t chunks_per_flashblock = flashblocksize / BLOCK_SIZE;
-    size_t realblocks = nblocks * chunks_per_flashblock;
+    int rc = FLASH_VKP_ERR;
+    vkp_block_t **blocks = calloc(count, sizeof(*blocks));
+    size_t *nblocks = calloc(count, sizeof(*nblocks));
+    uint8_t(*digest)[20] = calloc(count, sizeof(*digest));
+    char *skip = calloc(count, 1);
+    char *uninstall = calloc(count, 1);
+    char *applied = calloc(count, 1);
+    signed char *state = malloc(count);
+    uint32_t *all = NULL;
+    uint8_t *babe = NULL;
+    uint8_t *used = NULL;
+    if (!blocks || !nblocks || !digest || !skip || !uninstall || !applied || !state)
+    {
+        fprintf(stderr, "malloc failed\n");
+        goto out;
+    }
+    memset(state, -1, count);
 
-    // 2. Allocate babe
-    size_t babe_size = sizeof(struct babehdr_t) + realblocks /*hash*/ +
-                       realblocks * (8 + BLOCK_SIZE);
-    uint8_t *babe = calloc(1, babe_size);
-    if (!babe)
+    // 1. Collect blocks, each patch with its lines per block
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (patches[i].patch.count == 0)
+        {
+            fprintf(stderr, "%s: empty patch\n", filenames[i]);
+            goto out;
+        }
+        if (patches[i].errorline)
+        {
+            fprintf(stderr, "%s: error in line %d\n", filenames[i], patches[i].errorline);
+            goto out;
+        }
+        if (vkp_index_blocks(&patches[i], flashblocksize, &blocks[i], &nblocks[i]) != 0)
+        {
+            fprintf(stderr, "malloc failed\n");
+            goto out;
+        }
+        patchreg_digest(&patches[i], digest[i]);
+    }
+
+    if (remove_flag == 0 && flash_read_cache != FLASH_CACHE_OFF &&
+        flash_vkp_registered(port, &reg, count, filenames, patches, digest,
+                             skip, uninstall, skipped) != 0)
+        goto out;
+
+    for (int i = 0; i < count; i++)
+        if (!skip[i])
+            total += nblocks[i];
+    if (total == 0)
+    {
+        rc = FLASH_VKP_OK; // all skipped, nothing to read
+        goto out;
+    }
+
+    all = malloc(total * sizeof(uint32_t));
+    if (!all)
     {
         fprintf(stderr, "malloc failed\n");
-        return FLASH_VKP_ERR;
+        goto out;
+    }
+    size_t nall = 0;
+    for (int i = 0; i < count; i++)
+        for (size_t b = 0; b < nblocks[i] && !skip[i]; b++)
+            all[nall++] = blocks[i][b].addr;
+    qsort(all, nall, sizeof(uint32_t), flash_cmp_u32);
+
+    size_t n = 0;
+    for (size_t k = 0; k < nall; k++)
+        if (n == 0 || all[k] != all[n - 1])
+            all[n++] = all[k];
+    nall = n;
+
+    if (count > 1)
+    {
+        printf("%d patches, %zu erase block(s)\n", count, nall);
+        flash_vkp_conflicts(count, filenames, patches);
     }
 
-    struct babehdr_t *hdr = (struct babehdr_t *)babe;
-    hdr->sig = 0xBEBA;
-    hdr->ver = 3;
-    hdr->payloadsize1 = (uint32_t)realblocks;
+    size_t chunks_per_flashblock = flashblocksize / BLOCK_SIZE;
+    size_t realblocks = nall * chunks_per_flashblock;
+    size_t data_start = sizeof(struct babehdr_t) + realblocks; // skip header + hash
+    size_t block_bytes = chunks_per_flashblock * (8 + BLOCK_SIZE);
+
+    // 2. Allocate babe and read every block once
+    babe = calloc(1, data_start + nall * block_bytes);
+    used = calloc(nall, 1);
+    if (!babe || !used)
+    {
+        fprintf(stderr, "malloc failed\n");
+        goto out;
+    }
 
-    size_t pos = sizeof(struct babehdr_t) + realblocks; // skip header + hash
+    size_t pos = data_start;
     int block_index = 0;
     int total_blocks = (int)realblocks;
 
-    for (size_t b = 0; b < nblocks; b++)
+    for (size_t b = 0; b < nall; b++)
     {
-        uint32_t base = blocks[b];
         for (size_t off = 0; off < flashblocksize; off += BLOCK_SIZE)
         {
-            uint32_t chunk_addr = base + (uint32_t)off;
+            uint32_t chunk_addr = all[b] + (uint32_t)off;
 
             ((uint32_t *)(babe + pos))[0] = chunk_addr;
             ((uint32_t *)(babe + pos))[1] = BLOCK_SIZE;
             pos += 8;
 
-            uint8_t *dst = babe + pos;
-            uint8_t *raw = flash_read_raw(port, chunk_addr, BLOCK_SIZE);
+            // the block is flashed back whole, a stale copy would undo
+            // whatever changed it where a spot read didn't look
+            uint8_t *raw = flash_read_cached(port, chunk_addr, BLOCK_SIZE, 0);
             if (!raw)
             {
                 fprintf(stderr, "\nread failed at 0x%08X\n", chunk_addr);
-                free(babe);
-                return FLASH_VKP_ERR;
+                goto out;
             }
-            memcpy(dst, raw, BLOCK_SIZE);
+            memcpy(babe + pos, raw, BLOCK_SIZE);
             free(raw);
 
             pos += BLOCK_SIZE;
@@ -886,100 +1947,163 @@ int flash_vkp(struct sp_port *port, const char *filename, vkp_patch_t *patch,
     }
     printf("\n");
 
-    // 3. Scan patches for mismatch
-    int unmatched = 0, contrmatched = 0;
-    for (size_t pi = 0; pi < patch->patch.count; pi++)
+    for (int i = 0; i < count; i++)
     {
-        vkp_line_t *ln = &patch->patch.lines[pi];
-        uint32_t addr = ln->addr;
-
-        size_t p = sizeof(struct babehdr_t) + realblocks;
-        while (1)
+        const char *filename = filenames[i];
+        vkp_patch_t *patch = &patches[i];
+        int remove = remove_flag ^ uninstall[i];
+        if (skip[i])
+            continue;
+
+        // 3. Scan patches for mismatch, against the blocks as the patches
+        // before this one left them
+        int unmatched = 0, contrmatched = 0;
+        size_t u = 0;
+        for (size_t b = 0; b < nblocks[i]; b++)
         {
-            uint32_t curaddr = ((uint32_t *)(babe + p))[0];
-            uint32_t cursize = ((uint32_t *)(babe + p))[1];
-            if (addr < curaddr + cursize)
+            while (all[u] != blocks[i][b].addr)
+                u++;
+            uint8_t *data = babe + data_start + u * block_bytes;
+            for (size_t pi = blocks[i][b].first; pi < blocks[i][b].first + blocks[i][b].count; pi++)
             {
-                uint8_t actual = babe[p + 8 + (addr - curaddr)];
-                if (actual != ln->data[remove_flag])
+                vkp_line_t *ln = &patch->patch.lines[pi];
+                uint8_t actual = *flash_vkp_byte(data, blocks[i][b].addr, ln->addr);
+                if (actual != ln->data[remove])
                     unmatched++;
-                if (actual == ln->data[remove_flag ^ 1])
+                if (actual == ln->data[remove ^ 1])
                     contrmatched++;
-                break;
             }
-            p += 8 + BLOCK_SIZE;
         }
-    }
-
-    // patch already installed
-    if (unmatched && contrmatched == (int)patch->patch.count)
-    {
-        user_choice_t choice = ask_user_choice("patch installed, ", "[u]ninstall / [s]kip / [a]bort");
 
-        if (choice == CHOICE_UNINSTALL)
+        // patch already installed
+        if (!uninstall[i] && unmatched && contrmatched == (int)patch->patch.count)
         {
-            remove_flag ^= 1;
-            unmatched = 0;
+            char prompt[300];
+            snprintf(prompt, sizeof(prompt), "%s: patch installed, ", filename);
+
+            user_choice_t choice = ask_user_choice(prompt, "[u]ninstall / [s]kip / [a]bort");
+
+            if (choice == CHOICE_UNINSTALL)
+            {
+                remove ^= 1;
+                unmatched = 0;
+            }
+            else if (choice == CHOICE_SKIP)
+            {
+                printf("skipping %s\n", filename);
+                state[i] = remove == 0;
+                (*skipped)++;
+                continue;
+            }
+            else // abort
+                goto out;
         }
-        else if (choice == CHOICE_SKIP)
+
+        // patch mismatch
+        if (unmatched)
         {
-            free(babe);
-            printf("skipping %s\n", filename);
-            return FLASH_VKP_SKIP;
+            char prompt[300];
+            snprintf(prompt, sizeof(prompt),
+                     "%s: %d/%zu mismatch", filename, unmatched, patch->patch.count);
+
+            user_choice_t choice = ask_user_choice(prompt, "[c]ontinue / [s]kip / [a]bort");
+
+            if (choice == CHOICE_SKIP)
+            {
+                (*skipped)++;
+                continue; // skip this patch
+            }
+            else if (choice == CHOICE_ABORT)
+                goto out;
+            // CHOICE_CONTINUE → proceed
         }
-        else // abort
+
+        // 4. Apply patches
+        u = 0;
+        for (size_t b = 0; b < nblocks[i]; b++)
         {
-            free(babe);
-            return FLASH_VKP_ERR;
+            while (all[u] != blocks[i][b].addr)
+                u++;
+            uint8_t *data = babe + data_start + u * block_bytes;
+            for (size_t pi = blocks[i][b].first; pi < blocks[i][b].first + blocks[i][b].count; pi++)
+            {
+                vkp_line_t *ln = &patch->patch.lines[pi];
+                *flash_vkp_byte(data, blocks[i][b].addr, ln->addr) = ln->data[remove ^ 1];
+            }
+            used[u] = 1;
         }
+        applied[i] = 1;
+        state[i] = remove == 0;
+        (*patched)++;
     }
 
-    // patch mismatch
-    if (unmatched)
+    if (*patched == 0)
     {
-        char prompt[128];
-        snprintf(prompt, sizeof(prompt),
-                 "%d/%zu mismatch", unmatched, patch->patch.count);
-
-        user_choice_t choice = ask_user_choice(prompt, "[c]ontinue / [s]kip / [a]bort");
+        rc = FLASH_VKP_OK;
+        goto out;
+    }
 
-        if (choice == CHOICE_SKIP)
-        {
-            free(babe);
-            return FLASH_VKP_SKIP; // skip this patch
-        }
-        else if (choice == CHOICE_ABORT)
-        {
-            free(babe);
-            return FLASH_VKP_ERR;
-        }
-        // CHOICE_CONTINUE → proceed
+    // what is being written over is not known to be there until the flash
+    // went through, like the block cache
+    for (int i = 0; i < count; i++)
+    {
+        if (!applied[i])
+            continue;
+        patchreg_drop_overlaps(&reg, &patches[i]);
+        patchreg_remove(&reg, digest[i]);
     }
+    patchreg_save(&reg);
 
     printf("making a patched babe\n");
 
-    // 4. Apply patches
-    for (size_t pi = 0; pi < patch->patch.count; pi++)
+    // only the blocks of the applied patches, moved down over the hash
+    // bytes of the rest
+    size_t nused = 0;
+    for (size_t b = 0; b < nall; b++)
+        nused += used[b];
+    pos = sizeof(struct babehdr_t) + nused * chunks_per_flashblock;
+    for (size_t b = 0; b < nall; b++)
     {
-        vkp_line_t *ln = &patch->patch.lines[pi];
-        uint32_t addr = ln->addr;
+        if (!used[b])
+            continue;
+        memmove(babe + pos, babe + data_start + b * block_bytes, block_bytes);
+        pos += block_bytes;
+    }
+
+    struct babehdr_t *hdr = (struct babehdr_t *)babe;
+    hdr->sig = 0xBEBA;
+    hdr->ver = 3;
+    hdr->payloadsize1 = (uint32_t)(nused * chunks_per_flashblock);
 
-        size_t p = sizeof(struct babehdr_t) + realblocks;
-        while (1)
+    // 5. Flash
+    rc = flash_babe(port, babe, pos, 1) == 0 ? FLASH_VKP_OK : FLASH_VKP_ERR;
+
+out:
+    if (rc != FLASH_VKP_OK)
+        *patched = 0; // nothing was flashed
+    if (state && applied)
+    {
+        // what was found by reading still holds, the rest wasn't written
+        for (int i = 0; rc != FLASH_VKP_OK && i < count; i++)
         {
-            uint32_t curaddr = ((uint32_t *)(babe + p))[0];
-            uint32_t cursize = ((uint32_t *)(babe + p))[1];
-            if (addr < curaddr + cursize)
-            {
-                babe[p + 8 + (addr - curaddr)] = ln->data[remove_flag ^ 1];
-                break;
-            }
-            p += 8 + BLOCK_SIZE;
+            if (applied[i])
+                state[i] = -1;
+            applied[i] = 0;
         }
+        flash_vkp_register(&reg, count, filenames, patches, digest, state, applied);
     }
-
-    // 5. Flash
-    int rc = flash_babe(port, babe, pos, 1);
+    patchreg_close(&reg);
+    for (int i = 0; blocks && i < count; i++)
+        free(blocks[i]);
+    free(blocks);
+    free(nblocks);
+    free(digest);
+    free(skip);
+    free(uninstall);
+    free(applied);
+    free(state);
+    free(all);
     free(babe);
-    return rc == 0 ? FLASH_VKP_OK : FLASH_VKP_ERR;
+    free(used);
+    return rc;
 }
@@ -3,14 +3,31 @@
 
 #include <stdint.h>
 
+#include "babe.h"
 #include "vkp.h"
 
 #define BLOCK_SIZE 0x10000
-#define MAX_BLOCKS 480
+
+// data packets in flight while flashing a block (1 = stop-and-wait)
+#define FLASH_WINDOW_DEFAULT 1
+#define FLASH_WINDOW_MAX 16
+
+extern int flash_window;
+
+// payload bytes per 0x01 data packet, and the most a loader takes in one
+#define FLASH_PACKET_SIZE 0x800
+
+extern int flash_packet_size;
+
+// delta flashing: only send the blocks that differ from the phone
+#define FLASH_DELTA_OFF 0
+#define FLASH_DELTA_READ 1  // read every block back to compare
+#define FLASH_DELTA_CACHE 2 // trust backup/blocks_<imei>.txt, read only unknown blocks
+
+extern int flash_delta;
 
 #define FLASH_VKP_ERR -1
 #define FLASH_VKP_OK 0
-#define FLASH_VKP_SKIP 1
 
 // Unified choice enum
 typedef enum
@@ -21,22 +38,85 @@ typedef enum
     CHOICE_CONTINUE = 3
 } user_choice_t;
 
-int flash_detect_fw_version(struct sp_port *port, struct phone_info *phone);
+int flash_detect_fw_version(struct transport *port, struct phone_info *phone);
+
+// bytes requested per 0x32 by flash_read(), the phone streams 0x33 frames for all of it
+#define FLASH_READ_WINDOW 0x100000
+
+// firmware version probe: first 0x32 window (doubling up to
+// FLASH_READ_WINDOW), and bytes wanted after the "prgCXC"/"prg120" marker
+#define FLASH_PROBE_WINDOW 0x4000
+#define FLASH_PROBE_TAIL 0x800
+
+// tries per 0x33 frame before a read gives up, all but the last NAKed
+#define FLASH_RECV_RETRIES 5
+
+// flash_read() output, DUMPWRITER_RAW/SPARSE/ZDUMP
+extern int flash_dump_format;
 
-uint8_t *flash_read_raw(struct sp_port *port, uint32_t addr, size_t size);
-int flash_read(struct sp_port *port, struct phone_info *phone,
+// --read-cache: blocks of the per-IMEI cache (backup/blocks_<imei>.txt plus
+// the block store) are used instead of reading them again. The version
+// probe uses them by default; read-flash and VKP erase blocks only with trust
+#define FLASH_CACHE_OFF 0
+#define FLASH_CACHE_SPOT 1  // check each cached block with a small read first
+#define FLASH_CACHE_TRUST 2 // use cached blocks as they are, read-flash and VKP too
+#define FLASH_CACHE_SPOT_SIZE 0x100
+
+extern int flash_read_cache;
+
+int flash_cache_open(const struct phone_info *phone);
+void flash_cache_close(void);
+
+uint8_t *flash_read_raw(struct transport *port, uint32_t addr, size_t size);
+uint8_t *flash_read_cached(struct transport *port, uint32_t addr, size_t size, int spot);
+int flash_read(struct transport *port, struct phone_info *phone,
                uint32_t addr, size_t size);
 
-int flash_babe(struct sp_port *port, uint8_t *addr, size_t size, int flashfull);
-int flash_babe_fw(struct sp_port *port, const char *filename, int flashfull);
+// --- flash journal ---
+// One line per firmware file of the session, so --resume can skip what was
+// finalized and continue a file from its first unacknowledged block.
+#define FLASH_JOURNAL_MAX 4
+
+struct flash_journal_entry
+{
+    char sha1[41]; // firmware header (block hashes included) and size, hex
+    int blocks;    // blocks acknowledged with 0x13
+    int done;      // finalized with 0x11/0x12
+};
+
+struct flash_journal
+{
+    char path[64];
+    char loader[16]; // loader path the session was started with
+    int count;
+    struct flash_journal_entry fw[FLASH_JOURNAL_MAX];
+};
+
+void flash_journal_init(struct flash_journal *j, const char *imei, const char *loader);
+int flash_journal_load(struct flash_journal *j);
+int flash_journal_save(struct flash_journal *j);
+void flash_journal_remove(struct flash_journal *j);
 
-int flash_raw(struct sp_port *port, const char *filename, uint32_t raw_addr);
+int flash_babe(struct transport *port, const uint8_t *addr, size_t size, int flashfull);
+int flash_babe_journal(struct transport *port, const uint8_t *addr, const struct babe_index *idx,
+                       struct babe_verify *v, int flashfull,
+                       struct flash_journal *j, struct flash_journal_entry *e);
+int flash_babe_fw(struct transport *port, struct phone_info *phone, const char *filename,
+                  int flashfull, struct flash_journal *j);
+
+int flash_raw(struct transport *port, const char *filename, uint32_t raw_addr);
 uint8_t *flash_convert_raw_to_babe(uint8_t *raw, size_t size, uint32_t raw_addr, size_t *babe_size_out);
 
-int flash_restore_boot_area(struct sp_port *port, struct phone_info *phone);
+int flash_restore_boot_area(struct transport *port, struct phone_info *phone);
+
+// registered patches are confirmed with FLASH_VKP_SPOTS reads of up to
+// FLASH_VKP_SPOT_RUN bytes, see patchreg.h
+#define FLASH_VKP_SPOTS 4
+#define FLASH_VKP_SPOT_RUN 16
 
-int flash_vkp(struct sp_port *port, const char *filename, vkp_patch_t *patch,
-              int remove_flag, size_t flashblocksize);
+int flash_vkp_batch(struct transport *port, int count, const char **filenames,
+                    vkp_patch_t *patches, int remove_flag, const struct phone_info *phone,
+                    int *patched, int *skipped);
 
 int flash_cnv_raw_to_babe_file(const char *raw_filename, const char *babe_filename, uint32_t raw_addr);
 int flash_cnv_babe_to_raw_file(const char *babe_filename, const char *raw_filename);
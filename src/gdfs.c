@@ -2,15 +2,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <libserialport.h>
 
+#include "transport.h"
 #include "common.h"
 #include "cmd.h"
 #include "gdfs.h"
 #include "loader.h"
 #include "serial.h"
 
-int gdfs_read_var(struct sp_port *port, struct gdfs_data_t *gdfs, int gd_index,
+int gdfs_read_var(struct transport *port, struct gdfs_data_t *gdfs, int gd_index,
                          uint8_t block, uint8_t lsb, uint8_t msb)
 {
     uint8_t cmd_buf[64];
@@ -23,13 +23,8 @@ int gdfs_read_var(struct sp_port *port, struct gdfs_data_t *gdfs, int gd_index,
         return -1;
 
     // --- wait for response packet
-    uint8_t resp[128];
-    int rcv_len = serial_read(port, resp, sizeof(resp), TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, TIMEOUT) != 0)
         return -1;
 
     switch (gd_index)
@@ -66,7 +61,7 @@ int gdfs_read_var(struct sp_port *port, struct gdfs_data_t *gdfs, int gd_index,
     return 0;
 }
 
-int gdfs_get_phonename(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_phonename(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -100,7 +95,7 @@ int gdfs_get_phonename(struct sp_port *port, struct phone_info *phone, struct gd
     return gdfs_read_var(port, gdfs, GD_PHONE_NAME, block, msb, lsb);
 }
 
-int gdfs_get_brand(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_brand(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -153,7 +148,7 @@ int gdfs_parse_simlockdata(struct gdfs_data_t *gdfs, uint8_t *simlock)
     return 0;
 }
 
-int gdfs_get_simlock(struct sp_port *port, struct gdfs_data_t *gdfs)
+int gdfs_get_simlock(struct transport *port, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0x00;
     uint8_t msb = 0x00;
@@ -167,13 +162,8 @@ int gdfs_get_simlock(struct sp_port *port, struct gdfs_data_t *gdfs)
     if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
         return -1;
 
-    uint8_t resp[512];
-    int rcv_len = serial_read(port, resp, sizeof(resp), 5 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) < 0)
+    if (serial_recv_packet(port, &repl, 5 * TIMEOUT) != 0)
         return -1;
 
     gdfs_parse_simlockdata(gdfs, repl.data + 1);
@@ -181,7 +171,7 @@ int gdfs_get_simlock(struct sp_port *port, struct gdfs_data_t *gdfs)
     return 0;
 }
 
-int gdfs_dump_var(struct sp_port *port, struct phone_info *phone, uint16_t block, uint8_t msb, uint8_t lsb)
+int gdfs_dump_var(struct transport *port, struct phone_info *phone, uint16_t block, uint8_t msb, uint8_t lsb)
 {
     uint8_t cmd_buf[64];
     int cmd_len = cmd_encode_read_gdfs(block, lsb, msb, cmd_buf);
@@ -193,13 +183,8 @@ int gdfs_dump_var(struct sp_port *port, struct phone_info *phone, uint16_t block
         return -1;
 
     // --- wait for response packet
-    uint8_t resp[1024];
-    int rcv_len = serial_read(port, resp, sizeof(resp), 5 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) < 0)
+    if (serial_recv_packet(port, &repl, 5 * TIMEOUT) != 0)
         return -1;
 
     char backup_path[512];
@@ -228,7 +213,7 @@ int gdfs_dump_var(struct sp_port *port, struct phone_info *phone, uint16_t block
     return 0;
 }
 
-int gdfs_dump_sec_units(struct sp_port *port, struct phone_info *phone, const char *backup_name)
+int gdfs_dump_sec_units(struct transport *port, struct phone_info *phone, const char *backup_name)
 {
     if (gdfs_dump_var(port, phone, 0x00, 0x00, 0x06) < 0) // GD_COPS_Dynamic1Variable
         return -1;
@@ -250,7 +235,7 @@ int gdfs_dump_sec_units(struct sp_port *port, struct phone_info *phone, const ch
     return 0;
 }
 
-int gdfs_get_cxc_article(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_cxc_article(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -278,7 +263,7 @@ int gdfs_get_cxc_article(struct sp_port *port, struct phone_info *phone, struct
     return gdfs_read_var(port, gdfs, GD_CXC_ARTICLE, block, msb, lsb);
 }
 
-int gdfs_get_cxc_version(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_cxc_version(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -305,7 +290,7 @@ int gdfs_get_cxc_version(struct sp_port *port, struct phone_info *phone, struct
     return gdfs_read_var(port, gdfs, GD_CXC_VERSION, block, msb, lsb);
 }
 
-int gdfs_get_language(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_language(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -338,7 +323,7 @@ int gdfs_get_language(struct sp_port *port, struct phone_info *phone, struct gdf
     return gdfs_read_var(port, gdfs, GD_LANGPACK, block, msb, lsb);
 }
 
-int gdfs_get_cda_article(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_cda_article(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -372,7 +357,7 @@ int gdfs_get_cda_article(struct sp_port *port, struct phone_info *phone, struct
     return gdfs_read_var(port, gdfs, GD_CDA_ARTICLE, block, msb, lsb);
 }
 
-int gdfs_get_cda_revision(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_cda_revision(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -406,7 +391,7 @@ int gdfs_get_cda_revision(struct sp_port *port, struct phone_info *phone, struct
     return gdfs_read_var(port, gdfs, GD_CDA_REVISION, block, msb, lsb);
 }
 
-int gdfs_get_default_article(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_default_article(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -440,7 +425,7 @@ int gdfs_get_default_article(struct sp_port *port, struct phone_info *phone, str
     return gdfs_read_var(port, gdfs, GD_DEF_ARTICLE, block, msb, lsb);
 }
 
-int gdfs_get_default_version(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
+int gdfs_get_default_version(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0;
     uint8_t msb = 0;
@@ -474,7 +459,7 @@ int gdfs_get_default_version(struct sp_port *port, struct phone_info *phone, str
     return gdfs_read_var(port, gdfs, GD_DEF_VERSION, block, msb, lsb);
 }
 
-int gdfs_get_userlock(struct sp_port *port, struct gdfs_data_t *gdfs)
+int gdfs_get_userlock(struct transport *port, struct gdfs_data_t *gdfs)
 {
     uint8_t block = 0x00;
     uint8_t msb = 0x00;
@@ -490,13 +475,8 @@ int gdfs_get_userlock(struct sp_port *port, struct gdfs_data_t *gdfs)
         return -1;
 
     // --- wait for response packet
-    uint8_t resp[256];
-    int rcv_len = serial_read(port, resp, sizeof(resp), 5 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, 5 * TIMEOUT) != 0)
         return -1;
 
     uint8_t usercode_len = repl.data[0x62];
@@ -529,7 +509,7 @@ int gdfs_get_userlock(struct sp_port *port, struct gdfs_data_t *gdfs)
     return 0;
 }
 
-int gdfs_unlock_usercode(struct sp_port *port)
+int gdfs_unlock_usercode(struct transport *port)
 {
     printf("Reset USERCODE... ");
     uint8_t cmd_buf[64];
@@ -563,7 +543,7 @@ int gdfs_unlock_usercode(struct sp_port *port)
     return -1;
 }
 
-int gdfs_terminate_access(struct sp_port *port)
+int gdfs_terminate_access(struct transport *port)
 {
     uint8_t cmd_buf[8];
 
@@ -32,23 +32,23 @@ enum
     GD_COUNT,
 };
 
-int gdfs_read_var(struct sp_port *port, struct gdfs_data_t *gdfs, int gd_index,
+int gdfs_read_var(struct transport *port, struct gdfs_data_t *gdfs, int gd_index,
                          uint8_t block, uint8_t lsb, uint8_t msb);
-int gdfs_get_phonename(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_brand(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_cxc_article(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_cxc_version(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_language(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_cda_article(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_cda_revision(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_default_article(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_default_version(struct sp_port *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
-int gdfs_get_simlock(struct sp_port *port, struct gdfs_data_t *gdfs);
+int gdfs_get_phonename(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_brand(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_cxc_article(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_cxc_version(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_language(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_cda_article(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_cda_revision(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_default_article(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_default_version(struct transport *port, struct phone_info *phone, struct gdfs_data_t *gdfs);
+int gdfs_get_simlock(struct transport *port, struct gdfs_data_t *gdfs);
 int gdfs_parse_simlockdata(struct gdfs_data_t *gdfs, uint8_t *simlock);
-int gdfs_get_userlock(struct sp_port *port, struct gdfs_data_t *gdfs);
-int gdfs_unlock_usercode(struct sp_port *port);
-int gdfs_dump_sec_units(struct sp_port *port, struct phone_info *phone, const char *backup_name);
-int gdfs_terminate_access(struct sp_port *port);
+int gdfs_get_userlock(struct transport *port, struct gdfs_data_t *gdfs);
+int gdfs_unlock_usercode(struct transport *port);
+int gdfs_dump_sec_units(struct transport *port, struct phone_info *phone, const char *backup_name);
+int gdfs_terminate_access(struct transport *port);
 
 
 #endif // gdfs_h
\ No newline at end of file
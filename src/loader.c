@@ -4,8 +4,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
-#include <libserialport.h>
 
+#include "transport.h"
 #include "babe.h"
 #include "common.h"
 #include "connection.h"
@@ -79,7 +79,7 @@ int loader_get_hello(struct packetdata_t *packet)
     return 0;
 }
 
-int loader_send_binary_cmd3e(struct sp_port *port, const char *loader_name)
+int loader_send_binary_cmd3e(struct transport *port, const char *loader_name)
 {
     size_t fsize;
     uint8_t *buffer = load_file(loader_name, &fsize);
@@ -89,17 +89,11 @@ int loader_send_binary_cmd3e(struct sp_port *port, const char *loader_name)
         return -1;
     }
 
-    uint8_t cmd_buf[0x800];
-    int cmd_len = cmd_encode_binary_packet(0x3E, buffer, fsize, cmd_buf);
-    if (cmd_len <= 0)
-    {
-        free(buffer);
-        return -1;
-    }
-    free(buffer);
-
     // --- send cmd3e command
-    if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
+    struct transport_iov payload = {buffer, fsize};
+    int rc = serial_send_packet(port, 1, 0x3E, &payload, 1);
+    free(buffer);
+    if (rc < 0)
         return -1;
 
     // --- Read hello response from loader =)
@@ -123,7 +117,7 @@ int loader_send_binary_cmd3e(struct sp_port *port, const char *loader_name)
     return 0;
 }
 
-int loader_send_unsigned_bin(struct sp_port *port, const char *loader_name, uint32_t ram_addr)
+int loader_send_unsigned_bin(struct transport *port, const char *loader_name, uint32_t ram_addr)
 {
     size_t fsize;
     uint8_t *buffer = load_file(loader_name, &fsize);
@@ -158,13 +152,8 @@ int loader_send_unsigned_bin(struct sp_port *port, const char *loader_name, uint
         goto error;
 
     // --- Read hello response from loader =)
-    uint8_t hello_buf[128];
-    int rcv_len = serial_wait_packet(port, hello_buf, sizeof(hello_buf), 5 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(hello_buf, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, 5 * TIMEOUT) != 0)
         return -1;
 
     loader_get_hello(&repl);
@@ -178,15 +167,14 @@ error:
 }
 
 // --- Loader activate
-int loader_activate_payload(struct sp_port *port, struct phone_info *phone)
+int loader_activate_payload(struct transport *port, struct phone_info *phone)
 {
     if (loader_type == LDR_CHIPSELECT)
     {
         uint8_t cmd_buf[64];
-        uint8_t resp[128];
         struct packetdata_t repl = {0};
 
-        int cmd_len, rcv_len;
+        int cmd_len;
 
         // --- Activate CS loader
         printf("Activating CHIPSELECT loader... ");
@@ -196,11 +184,7 @@ int loader_activate_payload(struct sp_port *port, struct phone_info *phone)
         if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
             return -1;
 
-        rcv_len = serial_wait_packet(port, resp, 8, 20 * TIMEOUT);
-        if (rcv_len <= 0)
-            return -1;
-
-        if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+        if (serial_recv_packet(port, &repl, 20 * TIMEOUT) != 0)
             return -1;
 
         if (repl.data[1] != 0x00)
@@ -219,11 +203,7 @@ int loader_activate_payload(struct sp_port *port, struct phone_info *phone)
         if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
             return -1;
 
-        rcv_len = serial_wait_packet(port, resp, 8, 500 * TIMEOUT);
-        if (rcv_len <= 0)
-            return -1;
-
-        if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+        if (serial_recv_packet(port, &repl, 500 * TIMEOUT) != 0)
             return -1;
 
         if (repl.data[1] != 0x00)
@@ -266,11 +246,7 @@ int loader_activate_payload(struct sp_port *port, struct phone_info *phone)
         if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
             return -1;
 
-        rcv_len = serial_read(port, resp, sizeof(resp), 10 * TIMEOUT);
-        if (rcv_len <= 0)
-            return -1;
-
-        if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+        if (serial_recv_packet(port, &repl, 10 * TIMEOUT) != 0)
             return -1;
 
         if (repl.cmd != 0x04)
@@ -300,7 +276,7 @@ int loader_activate_payload(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int loader_send_qhldr_noact(struct sp_port *port, struct phone_info *phone, const char *loader_name)
+int loader_send_qhldr_noact(struct transport *port, struct phone_info *phone, const char *loader_name)
 {
     size_t fsize;
     uint8_t *buffer = load_file(loader_name, &fsize);
@@ -403,13 +379,8 @@ skip_body:
                 goto error;
         }
 
-        uint8_t hello_buf[64];
-        rcv_len = serial_read(port, hello_buf, sizeof(hello_buf), 3 * TIMEOUT);
-        if (rcv_len <= 0)
-            goto error;
-
         struct packetdata_t repl;
-        if (cmd_decode_packet(hello_buf, rcv_len, &repl) != 0)
+        if (serial_recv_packet(port, &repl, 3 * TIMEOUT) != 0)
             goto error;
 
         loader_get_hello(&repl);
@@ -419,13 +390,8 @@ skip_body:
     }
 
     // --- Read hello response from loader =)
-    uint8_t hello_buf[64];
-    int rcv_len = serial_read(port, hello_buf, sizeof(hello_buf), 3 * TIMEOUT);
-    if (rcv_len <= 0)
-        goto error;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(hello_buf, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, 3 * TIMEOUT) != 0)
         goto error;
 
     loader_get_hello(&repl);
@@ -438,7 +404,7 @@ error:
     return -1;
 }
 
-int loader_send_qhldr(struct sp_port *port, struct phone_info *phone, const char *loader_name)
+int loader_send_qhldr(struct transport *port, struct phone_info *phone, const char *loader_name)
 {
     if (phone->qhldr_sent == 1)
         return 0;
@@ -470,50 +436,28 @@ int loader_send_qhldr(struct sp_port *port, struct phone_info *phone, const char
     return 0;
 }
 
-int loader_send_encoded_cmd_and_data(struct sp_port *port, uint8_t cmd, uint8_t *data, size_t total_bytes)
+int loader_send_encoded_cmd_and_data(struct transport *port, uint8_t cmd, uint8_t *data, size_t total_bytes)
 {
-    uint8_t buf[0x800];
     size_t sent_bytes = 0;
     int do_once = 1;
 
     // printf("%s ... (%d bytes)\n", desc, total_bytes);
 
-    serial_send_ack(port);
-
     while (sent_bytes < total_bytes || do_once)
     {
-        int num = 0;
-        uint8_t checksum = 0;
-        do_once = 0;
-
-        buf[num++] = SERIAL_HDR89; // hdr
-        buf[num++] = cmd;          // command
-
         int bytes_to_send = total_bytes - sent_bytes;
         int max_bytes = 0x7FF;
         if (bytes_to_send > max_bytes)
             bytes_to_send = max_bytes;
 
-        // length = payload + continuebit
-        buf[num++] = (bytes_to_send + 1) & 0xFF;
-        buf[num++] = ((bytes_to_send + 1) >> 8) & 0xFF;
-
         // continuebit: 01 = more data coming, 00 = no more data coming
         uint8_t continuebit = (sent_bytes + bytes_to_send < total_bytes) ? 0x01 : 0x00;
-        buf[num++] = continuebit;
-
-        memcpy(&buf[num], &data[sent_bytes], bytes_to_send);
-        num += bytes_to_send;
 
-        // checksum
-        for (int i = 0; i < num; i++)
-            checksum ^= buf[i];
-        checksum = (checksum + 7) & 0xFF;
-        buf[num++] = checksum;
-
-        // send data
-        if (serial_write_chunks(port, buf, num, 0x400) < 0)
+        // length = payload + continuebit, the first packet carries the leading ACK
+        struct transport_iov payload[2] = {{&continuebit, 1}, {&data[sent_bytes], bytes_to_send}};
+        if (serial_send_packet(port, do_once, cmd, payload, 2) < 0)
             return -1;
+        do_once = 0;
 
         // --- Read response
         if (continuebit)
@@ -528,7 +472,7 @@ int loader_send_encoded_cmd_and_data(struct sp_port *port, uint8_t cmd, uint8_t
     return 0;
 }
 
-int loader_send_binary_noact(struct sp_port *port, const char *loader_name)
+int loader_send_binary_noact(struct transport *port, const char *loader_name)
 {
     size_t fsize;
     uint8_t *buffer = load_file(loader_name, &fsize);
@@ -548,21 +492,14 @@ int loader_send_binary_noact(struct sp_port *port, const char *loader_name)
     uint8_t *qa00 = buffer + qh_size;
     uint8_t *qd00 = buffer + qh_size + qa_size;
 
-    uint8_t resp[7] = {0};
-    int rcv_len;
-
     struct packetdata_t repl;
 
     // printf("Send header ...\n");
     if (loader_send_encoded_cmd_and_data(port, 0x3C, qh00, qh_size) < 0)
         goto error;
-    rcv_len = serial_read(port, resp, sizeof(resp), 5 * TIMEOUT);
-    if (rcv_len <= 0)
+    if (serial_recv_packet(port, &repl, 5 * TIMEOUT) != 0)
         goto error;
 
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
-        return -1;
-
     if (repl.cmd != 0x3D)
     {
         fprintf(stderr, "Bad answer %02X\n", repl.cmd);
@@ -573,13 +510,9 @@ int loader_send_binary_noact(struct sp_port *port, const char *loader_name)
     if (loader_send_encoded_cmd_and_data(port, 0x3C, qa00, qa_size) < 0)
         goto error;
 
-    rcv_len = serial_read(port, resp, sizeof(resp), 3 * TIMEOUT);
-    if (rcv_len <= 0)
+    if (serial_recv_packet(port, &repl, 3 * TIMEOUT) != 0)
         goto error;
 
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
-        return -1;
-
     if (repl.cmd != 0x3D)
     {
         fprintf(stderr, "Bad answer %02X\n", repl.cmd);
@@ -589,13 +522,9 @@ int loader_send_binary_noact(struct sp_port *port, const char *loader_name)
     // printf("Send body ...\n");
     if (loader_send_encoded_cmd_and_data(port, 0x3C, qd00, qd_size) < 0)
         goto error;
-    rcv_len = serial_read(port, resp, sizeof(resp), 3 * TIMEOUT);
-    if (rcv_len <= 0)
+    if (serial_recv_packet(port, &repl, 3 * TIMEOUT) != 0)
         goto error;
 
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
-        return -1;
-
     if (repl.cmd != 0x3D)
     {
         fprintf(stderr, "Bad answer %02X\n", repl.cmd);
@@ -606,14 +535,9 @@ int loader_send_binary_noact(struct sp_port *port, const char *loader_name)
     serial_send_ack(port);
 
     // --- Read hello response from loader
-    uint8_t hello_buf[256];
-    rcv_len = serial_read(port, hello_buf, sizeof(hello_buf), 20 * TIMEOUT);
-    if (rcv_len <= 0)
+    if (serial_recv_packet(port, &repl, 20 * TIMEOUT) != 0)
         goto error;
 
-    if (cmd_decode_packet(hello_buf, rcv_len, &repl) != 0)
-        return -1;
-
     loader_get_hello(&repl);
 
     free(buffer);
@@ -624,7 +548,7 @@ error:
     return -1;
 }
 
-int loader_send_binary(struct sp_port *port, struct phone_info *phone, const char *loader_name)
+int loader_send_binary(struct transport *port, struct phone_info *phone, const char *loader_name)
 {
     if (loader_send_binary_noact(port, loader_name) != 0)
         return -1;
@@ -635,7 +559,7 @@ int loader_send_binary(struct sp_port *port, struct phone_info *phone, const cha
     return 0;
 }
 
-int loader_get_erom_data(struct sp_port *port, struct phone_info *phone)
+int loader_get_erom_data(struct transport *port, struct phone_info *phone)
 {
     uint8_t cmd_buf[32];
     int cmd_len = cmd_encode_binary_packet(0x57, NULL, 0, cmd_buf);
@@ -646,13 +570,8 @@ int loader_get_erom_data(struct sp_port *port, struct phone_info *phone)
     if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
         return -1;
 
-    uint8_t resp[32];
-    int rcv_len = serial_read(port, resp, sizeof(resp), 3 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, 3 * TIMEOUT) != 0)
         return -1;
 
     if (repl.data[1] & 1)
@@ -674,7 +593,7 @@ int loader_get_erom_data(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int loader_get_otp_data(struct sp_port *port, struct phone_info *phone)
+int loader_get_otp_data(struct transport *port, struct phone_info *phone)
 {
     uint8_t cmd_buf[32];
     int cmd_len = cmd_encode_binary_packet(0x24, NULL, 0, cmd_buf);
@@ -685,13 +604,8 @@ int loader_get_otp_data(struct sp_port *port, struct phone_info *phone)
     if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
         return -1;
 
-    uint8_t resp[64];
-    int rcv_len = serial_read(port, resp, sizeof(resp), 3 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, 3 * TIMEOUT) != 0)
         return -1;
 
     phone->otp_status = repl.data[0];
@@ -710,7 +624,7 @@ int loader_get_otp_data(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int loader_get_flash_data(struct sp_port *port, struct phone_info *phone)
+int loader_get_flash_data(struct transport *port, struct phone_info *phone)
 {
     uint8_t cmd_buf[32];
     int cmd_len = cmd_encode_binary_packet(0x0D, NULL, 0, cmd_buf);
@@ -721,13 +635,8 @@ int loader_get_flash_data(struct sp_port *port, struct phone_info *phone)
     if (serial_send_packetdata_ack(port, cmd_buf, cmd_len) < 0)
         return -1;
 
-    uint8_t resp[32];
-    int rcv_len = serial_read(port, resp, sizeof(resp), 3 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, 3 * TIMEOUT) != 0)
         return -1;
 
     if (repl.cmd != 0x0A && repl.length != 2)
@@ -755,7 +664,7 @@ int loader_get_flash_data(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int loader_activate_gdfs(struct sp_port *port)
+int loader_activate_gdfs(struct transport *port)
 {
     printf("Activating GDFS.. ");
 
@@ -769,13 +678,8 @@ int loader_activate_gdfs(struct sp_port *port)
         return -1;
 
     // Wait for reply
-    uint8_t resp[8];
-    int rcv_len = serial_wait_packet(port, resp, sizeof(resp), 5 * TIMEOUT);
-    if (rcv_len <= 0)
-        return -1;
-
     struct packetdata_t repl;
-    if (cmd_decode_packet(resp, rcv_len, &repl) != 0)
+    if (serial_recv_packet(port, &repl, 5 * TIMEOUT) != 0)
         return -1;
 
     if (repl.cmd != 0x1D && repl.data[0] != 0x00)
@@ -788,7 +692,7 @@ int loader_activate_gdfs(struct sp_port *port)
     return 0;
 }
 
-int loader_shutdown(struct sp_port *port)
+int loader_shutdown(struct transport *port)
 {
     printf("Shutdown phone\n");
 
@@ -814,7 +718,7 @@ exit_done:
 }
 
 // should activate flash_mode when success, only for identify action.
-int loader_enter_flashmode(struct sp_port *port, struct phone_info *phone)
+int loader_enter_flashmode(struct transport *port, struct phone_info *phone)
 {
     switch (phone->chip_id)
     {
@@ -837,7 +741,7 @@ int loader_enter_flashmode(struct sp_port *port, struct phone_info *phone)
     }
 }
 
-int loader_send_oflash_ldr_pnx5230(struct sp_port *port, struct phone_info *phone)
+int loader_send_oflash_ldr_pnx5230(struct transport *port, struct phone_info *phone)
 {
     switch (phone->erom_cid)
     {
@@ -853,7 +757,7 @@ int loader_send_oflash_ldr_pnx5230(struct sp_port *port, struct phone_info *phon
     }
 }
 
-int loader_send_csloader_pnx5230(struct sp_port *port, struct phone_info *phone)
+int loader_send_csloader_pnx5230(struct transport *port, struct phone_info *phone)
 {
     if (loader_send_oflash_ldr_pnx5230(port, phone) != 0)
         return -1;
@@ -872,7 +776,7 @@ int loader_send_csloader_pnx5230(struct sp_port *port, struct phone_info *phone)
     }
 }
 
-int loader_send_csloader_db2020(struct sp_port *port, struct phone_info *phone)
+int loader_send_csloader_db2020(struct transport *port, struct phone_info *phone)
 {
     if (loader_send_qhldr(port, phone, DB2020_PILOADER_RED_CID01_P3M) != 0)
         return -1;
@@ -900,7 +804,7 @@ int loader_send_csloader_db2020(struct sp_port *port, struct phone_info *phone)
     }
 }
 
-int loader_send_csloader_db2010(struct sp_port *port, struct phone_info *phone)
+int loader_send_csloader_db2010(struct transport *port, struct phone_info *phone)
 {
     if (phone->erom_cid == 29)
     {
@@ -991,7 +895,7 @@ int loader_send_csloader_db2010(struct sp_port *port, struct phone_info *phone)
     return -1;
 }
 
-int loader_send_csloader_db2000(struct sp_port *port, struct phone_info *phone)
+int loader_send_csloader_db2000(struct transport *port, struct phone_info *phone)
 {
     // TODO CID16
     switch (phone->erom_cid)
@@ -1028,7 +932,7 @@ int loader_send_csloader_db2000(struct sp_port *port, struct phone_info *phone)
     }
 }
 
-int loader_send_csloader(struct sp_port *port, struct phone_info *phone)
+int loader_send_csloader(struct transport *port, struct phone_info *phone)
 {
     switch (phone->chip_id)
     {
@@ -1048,7 +952,7 @@ int loader_send_csloader(struct sp_port *port, struct phone_info *phone)
     return 0;
 }
 
-int loader_send_oflash_ldr_db2000(struct sp_port *port, struct phone_info *phone)
+int loader_send_oflash_ldr_db2000(struct transport *port, struct phone_info *phone)
 {
     // TODO CID16
     // CID29 (both RED and BROWN)
@@ -1089,7 +993,7 @@ int loader_send_oflash_ldr_db2000(struct sp_port *port, struct phone_info *phone
     }
 }
 
-int loader_send_oflash_ldr_db2010(struct sp_port *port, struct phone_info *phone)
+int loader_send_oflash_ldr_db2010(struct transport *port, struct phone_info *phone)
 {
     // K500/K700
     if (phone->erom_cid == 29)
@@ -1167,7 +1071,7 @@ int loader_send_oflash_ldr_db2010(struct sp_port *port, struct phone_info *phone
     }
 }
 
-int loader_send_oflash_ldr_db2020(struct sp_port *port, struct phone_info *phone)
+int loader_send_oflash_ldr_db2020(struct transport *port, struct phone_info *phone)
 {
     if (loader_send_qhldr(port, phone, DB2020_PILOADER_RED_CID01_P3M) != 0)
         return -1;
@@ -1195,7 +1099,7 @@ int loader_send_oflash_ldr_db2020(struct sp_port *port, struct phone_info *phone
     }
 }
 
-int loader_send_oflash_ldr(struct sp_port *port, struct phone_info *phone)
+int loader_send_oflash_ldr(struct transport *port, struct phone_info *phone)
 {
     // Correction if user put wrong args
     phone->anycid = 0;
@@ -1218,7 +1122,7 @@ int loader_send_oflash_ldr(struct sp_port *port, struct phone_info *phone)
     }
 }
 
-int loader_send_bflash_ldr_db2000(struct sp_port *port, struct phone_info *phone)
+int loader_send_bflash_ldr_db2000(struct transport *port, struct phone_info *phone)
 {
     // TODO CID16
     if (phone->erom_cid == 29)
@@ -1305,7 +1209,7 @@ int loader_send_bflash_ldr_db2000(struct sp_port *port, struct phone_info *phone
     return -1;
 }
 
-int loader_send_bflash_ldr_db2010(struct sp_port *port, struct phone_info *phone)
+int loader_send_bflash_ldr_db2010(struct transport *port, struct phone_info *phone)
 {
     // TODO CID16
     if (phone->erom_cid == 29)
@@ -1393,7 +1297,7 @@ int loader_send_bflash_ldr_db2010(struct sp_port *port, struct phone_info *phone
     return -1;
 }
 
-int loader_send_bflash_ldr_db2020(struct sp_port *port, struct phone_info *phone)
+int loader_send_bflash_ldr_db2020(struct transport *port, struct phone_info *phone)
 {
     if (phone->anycid == 1)
     {
@@ -1426,7 +1330,7 @@ int loader_send_bflash_ldr_db2020(struct sp_port *port, struct phone_info *phone
     return -1;
 }
 
-int loader_send_bflash_ldr_pnx5230(struct sp_port *port, struct phone_info *phone)
+int loader_send_bflash_ldr_pnx5230(struct transport *port, struct phone_info *phone)
 {
     phone->anycid = 1;
     phone->skiperrors = 1;
@@ -1443,7 +1347,7 @@ int loader_send_bflash_ldr_pnx5230(struct sp_port *port, struct phone_info *phon
     return 0;
 }
 
-int loader_send_bflash_ldr(struct sp_port *port, struct phone_info *phone)
+int loader_send_bflash_ldr(struct transport *port, struct phone_info *phone)
 {
     switch (phone->chip_id)
     {
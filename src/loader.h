@@ -11,22 +11,22 @@ enum ldr_type_e
     LDR_UNKNOWN,
 };
 
-int loader_send_binary_cmd3e(struct sp_port *port, const char *loader_name);
-int loader_send_binary(struct sp_port *port, struct phone_info *phone, const char *loader_name);
-int loader_send_qhldr(struct sp_port *port, struct phone_info *phone, const char *loader_name);
-int loader_activate_payload(struct sp_port *port, struct phone_info *phone);
+int loader_send_binary_cmd3e(struct transport *port, const char *loader_name);
+int loader_send_binary(struct transport *port, struct phone_info *phone, const char *loader_name);
+int loader_send_qhldr(struct transport *port, struct phone_info *phone, const char *loader_name);
+int loader_activate_payload(struct transport *port, struct phone_info *phone);
 
-int loader_get_erom_data(struct sp_port *port, struct phone_info *phone);
-int loader_get_flash_data(struct sp_port *port, struct phone_info *phone);
-int loader_get_otp_data(struct sp_port *port, struct phone_info *phone);
-int loader_profilephone(struct sp_port *port, struct phone_info *phone);
-int loader_activate_gdfs(struct sp_port *port);
+int loader_get_erom_data(struct transport *port, struct phone_info *phone);
+int loader_get_flash_data(struct transport *port, struct phone_info *phone);
+int loader_get_otp_data(struct transport *port, struct phone_info *phone);
+int loader_profilephone(struct transport *port, struct phone_info *phone);
+int loader_activate_gdfs(struct transport *port);
 
-int loader_enter_flashmode(struct sp_port *port, struct phone_info *phone);
-int loader_send_csloader(struct sp_port *port, struct phone_info *phone);
-int loader_send_oflash_ldr(struct sp_port *port, struct phone_info *phone);
-int loader_send_bflash_ldr(struct sp_port *port, struct phone_info *phone);
+int loader_enter_flashmode(struct transport *port, struct phone_info *phone);
+int loader_send_csloader(struct transport *port, struct phone_info *phone);
+int loader_send_oflash_ldr(struct transport *port, struct phone_info *phone);
+int loader_send_bflash_ldr(struct transport *port, struct phone_info *phone);
 
-int loader_shutdown(struct sp_port *port);
+int loader_shutdown(struct transport *port);
 
 #endif // loader_h
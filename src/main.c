@@ -2,7 +2,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <libserialport.h>
 
 #include <sys/stat.h>
 #include <errno.h>
@@ -15,6 +14,7 @@
 #define MKDIR(path) mkdir(path, 0755)
 #endif
 
+#include "transport.h"
 #include "babe.h"
 #include "common.h"
 #include "connection.h"
@@ -24,6 +24,7 @@
 #include "loader.h"
 #include "serial.h"
 #include "action.h"
+#include "dumpwriter.h"
 
 int loader_type = 0;
 
@@ -53,6 +54,7 @@ static void print_usage(const char *progname)
 {
     printf("Usage: %s -p <port> -b <baud> -a <action> [options]\n\n", progname);
     printf("  -p, --port <name>       Serial port name (e.g. COM2, /dev/ttyUSB0)\n");
+    printf("                          or pty:<path>, tcp:<host>:<port>, replay:<file>\n");
     printf("  -b, --baud <rate>       Baudrate (default: 115200)\n");
     printf("  -a, --action <action>   Action:\n");
     printf("                          identify\n");
@@ -65,9 +67,29 @@ static void print_usage(const char *progname)
     printf("                          unlock <usercode|simlock>\n");
     printf("                          convert babe2raw <filename>\n");
     printf("                          convert raw2babe <filename> <addr>\n");
+    printf("                          convert zdump2raw <filename>\n");
+    printf("                          convert store2raw <manifest>\n");
+    printf("                          convert store2babe <manifest>\n");
+    printf("                          scan <filename>\n");
+    printf("                          apply-vkp <image> [addr] <file1.vkp> [file2.vkp ...]\n");
+    printf("                            [remove] [babe-v4] [header <ref.ssw>]\n");
     printf("\nGlobal options:\n");
     printf("    --anycid              Ignore CID restrictions (DB2012/DB2020/PNX5230)\n");
     printf("    --break-rsa           Break RSA on DB2000 & DB2010 RED49\n");
+    printf("    --window <n>          Data packets in flight while flashing (1-%d, default: %d)\n",
+           FLASH_WINDOW_MAX, FLASH_WINDOW_DEFAULT);
+    printf("    --delta <read|cache>  Flash only blocks that differ from the phone, compared\n");
+    printf("                          by reading back or against the per-IMEI block cache\n");
+    printf("                          (bflash only: CID49 DB2000/DB2010 with --break-rsa)\n");
+    printf("    --resume              Continue an interrupted flash at the first unacknowledged block,\n");
+    printf("                          or an interrupted read-flash where its dump file ends\n");
+    printf("    --dump-format <fmt>   read-flash output: raw (default), sparse (zero blocks\n");
+    printf("                          as holes), zdump (compressed, erased blocks free) or\n");
+    printf("                          store (shared 64 KB block store, one copy per block)\n");
+    printf("    --read-cache <mode>   Blocks read before from this phone: spot (default, checked\n");
+    printf("                          with a small read; version probe only), trust (used\n");
+    printf("                          as is, read-flash and VKP too) or off\n");
+    printf("    --record <file>       Record the session for replay:<file>\n");
     printf("  -h, --help              Show this help message\n");
 }
 
@@ -78,12 +100,18 @@ int main(int argc, char **argv)
     const char *action = NULL;
     const char *unlock_target = NULL;
     const char *gdfs_filename = NULL;
+    const char *scan_filename = NULL;
     const char *flash_mainfw = NULL;
     const char *flash_fsfw = NULL;
     const char *cnv_filename = NULL;
     const char *cnv_mode = NULL;
     const char **script_filenames = NULL;
     int script_count = 0;
+    const char *apply_image = NULL;
+    int apply_has_addr = 0;
+    int apply_remove = 0;
+    int apply_v4 = 0;
+    const char *apply_header = NULL;
 
     uint32_t dump_addr = 0;
     uint32_t dump_size = 0;
@@ -92,6 +120,8 @@ int main(int argc, char **argv)
     int anycid = 0;
     int break_rsa = 0;
     int save_as_babe = 0;
+    int resume = 0;
+    const char *record_filename = NULL;
 
     /* parse args */
     for (int i = 1; i < argc; i++)
@@ -210,6 +240,65 @@ int main(int argc, char **argv)
                     return 1;
                 }
             }
+            else if (strcmp(action, "scan") == 0)
+            {
+                if (i + 1 < argc)
+                {
+                    scan_filename = argv[++i];
+                }
+                else
+                {
+                    fprintf(stderr, "Error: scan requires <filename>\n");
+                    return 1;
+                }
+            }
+            else if (strcmp(action, "apply-vkp") == 0)
+            {
+                // <image> [addr], then VKP files and keywords until a '-' or end
+                if (i + 1 < argc)
+                    apply_image = argv[++i];
+
+                char *end;
+                if (i + 1 < argc && argv[i + 1][0] != '-')
+                {
+                    uint32_t addr = strtoul(argv[i + 1], &end, 0);
+                    if (*end == '\0')
+                    {
+                        mem_addr = addr;
+                        apply_has_addr = 1;
+                        i++;
+                    }
+                }
+
+                int start = i + 1;
+                int count = 0;
+                while (i + 1 < argc && argv[i + 1][0] != '-')
+                {
+                    const char *arg = argv[++i];
+                    if (strcmp(arg, "remove") == 0)
+                        apply_remove = 1;
+                    else if (strcmp(arg, "babe-v4") == 0)
+                        apply_v4 = 1;
+                    else if (strcmp(arg, "header") == 0)
+                    {
+                        if (i + 1 >= argc || argv[i + 1][0] == '-')
+                        {
+                            fprintf(stderr, "Error: header requires <ref.ssw>\n");
+                            return 1;
+                        }
+                        apply_header = argv[++i];
+                    }
+                    else
+                        argv[start + count++] = (char *)arg; // files first, keywords dropped
+                }
+                if (!apply_image || count == 0)
+                {
+                    fprintf(stderr, "Error: apply-vkp requires <image> [addr] <file1.vkp> [file2.vkp ...]\n");
+                    return 1;
+                }
+                script_filenames = (const char **)&argv[start];
+                script_count = count;
+            }
             else if (strcmp(action, "write-script") == 0)
             {
                 // Collect all remaining args until a '-' or end
@@ -248,7 +337,8 @@ int main(int argc, char **argv)
                             return 1;
                         }
                     }
-                    else if (strcmp(mode, "babe2raw") == 0)
+                    else if (strcmp(mode, "babe2raw") == 0 || strcmp(mode, "zdump2raw") == 0 ||
+                             strcmp(mode, "store2raw") == 0 || strcmp(mode, "store2babe") == 0)
                     {
                         if (i + 1 < argc)
                         {
@@ -257,19 +347,19 @@ int main(int argc, char **argv)
                         }
                         else
                         {
-                            fprintf(stderr, "Error: convert babe2raw requires <filename>\n");
+                            fprintf(stderr, "Error: convert %s requires <filename>\n", mode);
                             return 1;
                         }
                     }
                     else
                     {
-                        fprintf(stderr, "Error: convert requires <raw2babe|babe2raw>\n");
+                        fprintf(stderr, "Error: convert requires <raw2babe|babe2raw|zdump2raw|store2raw|store2babe>\n");
                         return 1;
                     }
                 }
                 else
                 {
-                    fprintf(stderr, "Error: convert requires <raw2babe|babe2raw> ...\n");
+                    fprintf(stderr, "Error: convert requires <raw2babe|babe2raw|zdump2raw|store2raw|store2babe> ...\n");
                     return 1;
                 }
             }
@@ -287,6 +377,77 @@ int main(int argc, char **argv)
         {
             break_rsa = 1;
         }
+        else if (strcmp(argv[i], "--window") == 0)
+        {
+            const char *val = i + 1 < argc ? argv[++i] : "";
+            char *end;
+            long window = strtol(val, &end, 10);
+            if (end == val || *end || window < 1 || window > FLASH_WINDOW_MAX)
+            {
+                fprintf(stderr, "Error: --window requires a value between 1 and %d\n", FLASH_WINDOW_MAX);
+                return 1;
+            }
+            flash_window = (int)window;
+        }
+        else if (strcmp(argv[i], "--delta") == 0)
+        {
+            const char *mode = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(mode, "read") == 0)
+                flash_delta = FLASH_DELTA_READ;
+            else if (strcmp(mode, "cache") == 0)
+                flash_delta = FLASH_DELTA_CACHE;
+            else
+            {
+                fprintf(stderr, "Error: --delta requires <read|cache>\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--resume") == 0)
+        {
+            resume = 1;
+        }
+        else if (strcmp(argv[i], "--read-cache") == 0)
+        {
+            const char *mode = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(mode, "off") == 0)
+                flash_read_cache = FLASH_CACHE_OFF;
+            else if (strcmp(mode, "spot") == 0)
+                flash_read_cache = FLASH_CACHE_SPOT;
+            else if (strcmp(mode, "trust") == 0)
+                flash_read_cache = FLASH_CACHE_TRUST;
+            else
+            {
+                fprintf(stderr, "Error: --read-cache requires <off|spot|trust>\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--dump-format") == 0)
+        {
+            const char *fmt = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(fmt, "raw") == 0)
+                flash_dump_format = DUMPWRITER_RAW;
+            else if (strcmp(fmt, "sparse") == 0)
+                flash_dump_format = DUMPWRITER_SPARSE;
+            else if (strcmp(fmt, "zdump") == 0)
+                flash_dump_format = DUMPWRITER_ZDUMP;
+            else if (strcmp(fmt, "store") == 0)
+                flash_dump_format = DUMPWRITER_STORE;
+            else
+            {
+                fprintf(stderr, "Error: --dump-format requires <raw|sparse|zdump|store>\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--record") == 0)
+        {
+            if (i + 1 < argc)
+                record_filename = argv[++i];
+            else
+            {
+                fprintf(stderr, "Error: --record requires an argument\n");
+                return 1;
+            }
+        }
         else
         {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
@@ -316,6 +477,15 @@ int main(int argc, char **argv)
         return action_convert(cnv_mode, cnv_filename, mem_addr);
     }
 
+    /* nor apply-vkp, it patches a firmware file */
+    if (act == ACT_APPLY_VKP)
+        return action_apply_vkp(apply_image, apply_has_addr, mem_addr, script_count, script_filenames,
+                                apply_remove, apply_v4, apply_header) == 0 ? 0 : 1;
+
+    /* neither does scan, it works on a dump file */
+    if (act == ACT_SCAN)
+        return action_scan(scan_filename) == 0 ? 0 : 1;
+
     /* For all other actions, we need a port */
     if (!port_name)
     {
@@ -327,6 +497,7 @@ int main(int argc, char **argv)
     switch (act)
     {
     case ACT_IDENTIFY:
+    case ACT_FLASH:
     case ACT_READ_GDFS:
     case ACT_WRITE_GDFS:
     case ACT_READ_FLASH:
@@ -354,6 +525,20 @@ int main(int argc, char **argv)
         printf("addr: 0x%X, size: 0x%X (%u) bytes\n", dump_addr, dump_size, dump_size);
         if (save_as_babe)
             printf("Output saved as BABE format\n");
+        // save-as-babe writes its own file, it would drop any other format
+        if (flash_dump_format != DUMPWRITER_RAW && save_as_babe)
+        {
+            fprintf(stderr, "Error: --dump-format %s can't be combined with save-as-babe\n",
+                    flash_dump_format == DUMPWRITER_SPARSE  ? "sparse"
+                    : flash_dump_format == DUMPWRITER_ZDUMP ? "zdump"
+                                                            : "store");
+            return 1;
+        }
+        if ((flash_dump_format == DUMPWRITER_ZDUMP || flash_dump_format == DUMPWRITER_STORE || save_as_babe) && resume)
+        {
+            fprintf(stderr, "Error: --resume only continues raw and sparse dumps\n");
+            return 1;
+        }
         break;
     case ACT_UNLOCK:
         printf("%s\n", unlock_target);
@@ -374,13 +559,19 @@ int main(int argc, char **argv)
     printf("\n");
 
     /* open port etc */
-    struct sp_port *port;
-    if (sp_get_port_by_name(port_name, &port) != SP_OK)
+    struct transport *port;
+    if (transport_get_by_name(port_name, &port) != 0)
     {
         fprintf(stderr, "Error: Cannot open %s\n", port_name);
         return 1;
     }
 
+    if (record_filename && transport_record(port, record_filename) != 0)
+    {
+        transport_free(port);
+        return 1;
+    }
+
     struct phone_info phone = {0};
     phone.baudrate = baudrate;
     if (connection_open(port, &phone) != 0)
@@ -410,6 +601,7 @@ int main(int argc, char **argv)
 
     case ACT_FLASH:
         phone.break_rsa = break_rsa;
+        phone.resume = resume;
         if (action_flash_fw(port, &phone, flash_mainfw, flash_fsfw) != 0)
             goto exit_error;
         break;
@@ -418,6 +610,7 @@ int main(int argc, char **argv)
         phone.anycid = anycid;
         phone.break_rsa = break_rsa;
         phone.save_as_babe = save_as_babe;
+        phone.resume = resume;
         if (action_read_flash(port, &phone, dump_addr, dump_size) != 0)
             goto exit_error;
         break;
@@ -445,15 +638,15 @@ int main(int argc, char **argv)
         goto exit_error;
     }
 
+    flash_cache_close();
     if (loader_shutdown(port) != 0)
         goto exit_error;
 
-    sp_close(port);
-    sp_free_port(port);
+    transport_free(port);
     return 0;
 
 exit_error:
-    sp_close(port);
-    sp_free_port(port);
+    flash_cache_close();
+    transport_free(port);
     return -1;
 }
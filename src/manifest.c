@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "blockcache.h"
+#include "manifest.h"
+
+static int manifest_append(struct manifest *m, const struct manifest_entry *e)
+{
+    if (m->count >= m->capacity)
+    {
+        size_t newcap = m->capacity ? m->capacity * 2 : 256;
+        struct manifest_entry *ne = realloc(m->e, newcap * sizeof(*ne));
+        if (!ne)
+            return -1;
+        m->e = ne;
+        m->capacity = newcap;
+    }
+    m->e[m->count++] = *e;
+    return 0;
+}
+
+int manifest_create(struct manifest *m, const char *path)
+{
+    memset(m, 0, sizeof(*m));
+
+    m->f = fopen(path, "w");
+    if (!m->f)
+    {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        return -1;
+    }
+    fprintf(m->f, "# addr size sha1 erased\n");
+    return 0;
+}
+
+// hashes one block and writes its line
+int manifest_add(struct manifest *m, uint32_t addr, const uint8_t *data, size_t size)
+{
+    struct manifest_entry e;
+    e.addr = addr;
+    e.size = (uint32_t)size;
+    blockcache_digest(data, size, e.sha1);
+
+    e.erased = 1;
+    for (size_t i = 0; i < size && e.erased; i++)
+        e.erased = data[i] == 0xFF;
+
+    if (manifest_append(m, &e) != 0)
+        return -1;
+
+    fprintf(m->f, "%08X %X ", e.addr, e.size);
+    for (int j = 0; j < 20; j++)
+        fprintf(m->f, "%02x", e.sha1[j]);
+    fprintf(m->f, " %d\n", e.erased);
+    return ferror(m->f) ? -1 : 0;
+}
+
+// the dump is complete: writes the end line and closes the file
+int manifest_finish(struct manifest *m)
+{
+    uint64_t size = 0;
+    for (size_t i = 0; i < m->count; i++)
+        size += m->e[i].size;
+
+    fprintf(m->f, "# end %zu %llX\n", m->count, (unsigned long long)size);
+    int rc = ferror(m->f) ? -1 : 0;
+    if (manifest_close(m) != 0)
+        rc = -1;
+    return rc;
+}
+
+// only a finished manifest whose lines all parse and add up to its end line
+int manifest_load(struct manifest *m, const char *path)
+{
+    memset(m, 0, sizeof(*m));
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    char line[128];
+    int lineno = 0, ended = 0;
+    uint64_t total = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        if (ended)
+            goto bad; // nothing after the end line
+
+        size_t count;
+        unsigned long long size;
+        if (sscanf(line, "# end %zu %llx", &count, &size) == 2)
+        {
+            if (count != m->count || size != total)
+                goto bad;
+            ended = 1;
+            continue;
+        }
+        if (line[0] == '#')
+            continue;
+
+        unsigned addr, size32;
+        int erased;
+        char hex[41];
+        if (sscanf(line, "%x %x %40s %d", &addr, &size32, hex, &erased) != 4 || strlen(hex) != 40)
+            goto bad;
+        total += size32;
+
+        struct manifest_entry e;
+        e.addr = addr;
+        e.size = size32;
+        e.erased = erased;
+        for (int i = 0; i < 20; i++)
+        {
+            unsigned b;
+            sscanf(hex + i * 2, "%2x", &b);
+            e.sha1[i] = (uint8_t)b;
+        }
+        if (manifest_append(m, &e) != 0)
+        {
+            fclose(f);
+            manifest_free(m);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    if (!ended)
+    {
+        fprintf(stderr, "%s: incomplete, the dump was cut short\n", path);
+        manifest_free(m);
+        return -1;
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "%s: bad line %d\n", path, lineno);
+    fclose(f);
+    manifest_free(m);
+    return -1;
+}
+
+// closes the file, the entries stay until manifest_free()
+int manifest_close(struct manifest *m)
+{
+    int rc = 0;
+    if (m->f && fclose(m->f) != 0)
+        rc = -1;
+    m->f = NULL;
+    return rc;
+}
+
+void manifest_free(struct manifest *m)
+{
+    manifest_close(m);
+    free(m->e);
+    m->e = NULL;
+    m->count = m->capacity = 0;
+}
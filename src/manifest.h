@@ -0,0 +1,36 @@
+#ifndef manifest_h
+#define manifest_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Block manifest written next to every flash dump, one line per 64 KB block:
+//   addr size sha1 erased
+// so dumps can be compared, deduplicated and fed to the block cache
+// without hashing them again. A complete dump ends in "# end <blocks> <size>";
+// without it (an interrupted read) the manifest doesn't load.
+struct manifest_entry
+{
+    uint32_t addr;
+    uint32_t size;
+    uint8_t sha1[20];
+    int erased; // all 0xFF
+};
+
+struct manifest
+{
+    FILE *f; // open while a dump is written
+    struct manifest_entry *e;
+    size_t count;
+    size_t capacity;
+};
+
+int manifest_create(struct manifest *m, const char *path);
+int manifest_add(struct manifest *m, uint32_t addr, const uint8_t *data, size_t size);
+int manifest_finish(struct manifest *m);
+int manifest_load(struct manifest *m, const char *path);
+int manifest_close(struct manifest *m);
+void manifest_free(struct manifest *m);
+
+#endif // manifest_h
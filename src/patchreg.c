@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "patchreg.h"
+#include "sha1.h"
+
+// backup/patches_<imei>.txt: per patch a "patch <sha1> <bytes> <name>"
+// line, then one line per range: addr size
+
+void patchreg_digest(const vkp_patch_t *patch, uint8_t sha1[20])
+{
+    SHA1_CTX sha;
+    sha1_init(&sha);
+    for (size_t i = 0; i < patch->patch.count; i++)
+    {
+        const vkp_line_t *ln = &patch->patch.lines[i];
+        uint8_t rec[6] = {(uint8_t)ln->addr, (uint8_t)(ln->addr >> 8),
+                          (uint8_t)(ln->addr >> 16), (uint8_t)(ln->addr >> 24),
+                          ln->data[0], ln->data[1]};
+        sha1_update(&sha, rec, sizeof(rec));
+    }
+    sha1_final(&sha, sha1);
+}
+
+static struct patchreg_entry *patchreg_new(struct patchreg *r, const uint8_t sha1[20],
+                                           const char *name, size_t bytes)
+{
+    if (r->count >= r->capacity)
+    {
+        size_t newcap = r->capacity ? r->capacity * 2 : 16;
+        struct patchreg_entry *ne = realloc(r->e, newcap * sizeof(*ne));
+        if (!ne)
+            return NULL;
+        r->e = ne;
+        r->capacity = newcap;
+    }
+
+    struct patchreg_entry *e = &r->e[r->count++];
+    memset(e, 0, sizeof(*e));
+    memcpy(e->sha1, sha1, 20);
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->bytes = bytes;
+    return e;
+}
+
+static int patchreg_add_range(struct patchreg_entry *e, uint32_t addr, uint32_t size)
+{
+    // room for 4, then doubled whenever a power of two is full
+    if (e->nrange == 0 || (e->nrange >= 4 && (e->nrange & (e->nrange - 1)) == 0))
+    {
+        size_t newcap = e->nrange ? e->nrange * 2 : 4;
+        struct patchreg_range *nr = realloc(e->range, newcap * sizeof(*nr));
+        if (!nr)
+            return -1;
+        e->range = nr;
+    }
+    e->range[e->nrange].addr = addr;
+    e->range[e->nrange].size = size;
+    e->nrange++;
+    return 0;
+}
+
+static void patchreg_drop(struct patchreg *r, size_t i)
+{
+    free(r->e[i].range);
+    memmove(&r->e[i], &r->e[i + 1], (r->count - i - 1) * sizeof(*r->e));
+    r->count--;
+}
+
+// 0 = ready (a missing file is an empty registry), -1 = error
+int patchreg_open(struct patchreg *r, const char *imei)
+{
+    memset(r, 0, sizeof(*r));
+    snprintf(r->path, sizeof(r->path), "./backup/patches_%s.txt", imei);
+
+    FILE *f = fopen(r->path, "r");
+    if (!f)
+        return 0;
+
+    char line[512];
+    struct patchreg_entry *e = NULL;
+    while (fgets(line, sizeof(line), f))
+    {
+        char hex[41];
+        size_t bytes;
+        int name_at = 0;
+        if (sscanf(line, "patch %40s %zu %n", hex, &bytes, &name_at) == 2 &&
+            strlen(hex) == 40 && name_at > 0)
+        {
+            uint8_t sha1[20];
+            for (int i = 0; i < 20; i++)
+            {
+                unsigned b;
+                sscanf(hex + i * 2, "%2x", &b);
+                sha1[i] = (uint8_t)b;
+            }
+            line[strcspn(line, "\r\n")] = 0;
+            e = patchreg_new(r, sha1, line + name_at, bytes);
+            if (!e)
+                goto fail;
+            continue;
+        }
+
+        unsigned addr, size;
+        if (!e || sscanf(line, "%x %x", &addr, &size) != 2)
+            continue;
+        if (patchreg_add_range(e, addr, size) != 0)
+            goto fail;
+    }
+
+    fclose(f);
+    return 0;
+
+fail:
+    fclose(f);
+    patchreg_close(r);
+    return -1;
+}
+
+const struct patchreg_entry *patchreg_find(const struct patchreg *r, const uint8_t sha1[20])
+{
+    for (size_t i = 0; i < r->count; i++)
+        if (memcmp(r->e[i].sha1, sha1, 20) == 0)
+            return &r->e[i];
+    return NULL;
+}
+
+// records patch as installed, replacing an entry with the same digest
+int patchreg_add(struct patchreg *r, const uint8_t sha1[20], const char *name,
+                 const vkp_patch_t *patch)
+{
+    patchreg_remove(r, sha1);
+
+    // the name only, the same file may be given from anywhere
+    const char *base = name;
+    for (const char *p = name; *p; p++)
+        if (*p == '/' || *p == '\\')
+            base = p + 1;
+
+    struct patchreg_entry *e = patchreg_new(r, sha1, base, patch->patch.count);
+    if (!e)
+        return -1;
+
+    const vkp_set_t *s = &patch->patch;
+    for (size_t i = 0; i < s->count;)
+    {
+        size_t j = i + 1;
+        while (j < s->count && s->lines[j].addr == s->lines[j - 1].addr + 1)
+            j++;
+        if (patchreg_add_range(e, s->lines[i].addr, (uint32_t)(j - i)) != 0)
+        {
+            patchreg_drop(r, r->count - 1);
+            return -1;
+        }
+        i = j;
+    }
+    return 0;
+}
+
+void patchreg_remove(struct patchreg *r, const uint8_t sha1[20])
+{
+    for (size_t i = 0; i < r->count; i++)
+    {
+        if (memcmp(r->e[i].sha1, sha1, 20) == 0)
+        {
+            patchreg_drop(r, i);
+            return;
+        }
+    }
+}
+
+// drops the entries that patch writes over, their bytes won't be theirs
+// any more; returns how many
+int patchreg_drop_overlaps(struct patchreg *r, const vkp_patch_t *patch)
+{
+    const vkp_set_t *s = &patch->patch;
+    if (s->count == 0)
+        return 0;
+    uint32_t lo = s->lines[0].addr;
+    uint32_t hi = s->lines[s->count - 1].addr;
+
+    int dropped = 0;
+    for (size_t i = 0; i < r->count;)
+    {
+        const struct patchreg_entry *e = &r->e[i];
+        int hit = 0;
+
+        // ranges and lines are both sorted, walk them side by side
+        size_t k = 0;
+        for (size_t j = 0; j < e->nrange && !hit; j++)
+        {
+            uint32_t start = e->range[j].addr;
+            uint32_t end = start + e->range[j].size;
+            if (end <= lo || start > hi)
+                continue;
+            while (k < s->count && s->lines[k].addr < start)
+                k++;
+            hit = k < s->count && s->lines[k].addr < end;
+        }
+
+        if (hit)
+        {
+            patchreg_drop(r, i);
+            dropped++;
+        }
+        else
+            i++;
+    }
+    return dropped;
+}
+
+int patchreg_save(const struct patchreg *r)
+{
+    FILE *f = fopen(r->path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Error: Cannot write %s\n", r->path);
+        return -1;
+    }
+
+    for (size_t i = 0; i < r->count; i++)
+    {
+        const struct patchreg_entry *e = &r->e[i];
+        fprintf(f, "patch ");
+        for (int j = 0; j < 20; j++)
+            fprintf(f, "%02x", e->sha1[j]);
+        fprintf(f, " %zu %s\n", e->bytes, e->name);
+        for (size_t j = 0; j < e->nrange; j++)
+            fprintf(f, "%08X %X\n", e->range[j].addr, e->range[j].size);
+    }
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void patchreg_close(struct patchreg *r)
+{
+    for (size_t i = 0; i < r->count; i++)
+        free(r->e[i].range);
+    free(r->e);
+    r->e = NULL;
+    r->count = r->capacity = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef patchreg_h
+#define patchreg_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vkp.h"
+
+// The VKP patches installed on a phone, per IMEI, as seftool last flashed
+// or found them. A patch is known by the SHA1 of its sorted lines, so a
+// renamed or reformatted file is still the same patch; its ranges are the
+// runs of addresses it writes. An entry only says what was true after the
+// last write, a few bytes are read to confirm it before it is relied on.
+struct patchreg_range
+{
+    uint32_t addr;
+    uint32_t size;
+};
+
+struct patchreg_entry
+{
+    uint8_t sha1[20];
+    char name[128];
+    size_t bytes; // lines in the patch
+    struct patchreg_range *range;
+    size_t nrange;
+};
+
+struct patchreg
+{
+    char path[64];
+    struct patchreg_entry *e;
+    size_t count;
+    size_t capacity;
+};
+
+// patch lines must be sorted by address (vkp_index_blocks())
+void patchreg_digest(const vkp_patch_t *patch, uint8_t sha1[20]);
+
+int patchreg_open(struct patchreg *r, const char *imei);
+const struct patchreg_entry *patchreg_find(const struct patchreg *r, const uint8_t sha1[20]);
+int patchreg_add(struct patchreg *r, const uint8_t sha1[20], const char *name,
+                 const vkp_patch_t *patch);
+void patchreg_remove(struct patchreg *r, const uint8_t sha1[20]);
+int patchreg_drop_overlaps(struct patchreg *r, const vkp_patch_t *patch);
+int patchreg_save(const struct patchreg *r);
+void patchreg_close(struct patchreg *r);
+
+#endif // patchreg_h
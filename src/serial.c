@@ -1,42 +1,112 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <libserialport.h>
 
+#include "transport.h"
 #include "common.h"
+#include "cmd.h"
 #include "serial.h"
 
-int serial_open(struct sp_port *port)
+static int serial_baudrate = 9600;
+
+// overrides the chunk size passed to serial_write_chunks(), 0 = caller's choice
+int serial_chunk_size = 0;
+
+// --- receive ring ---
+// Everything read from the port goes through this ring. The framer parses
+// in place and consumes bytes only once a frame is complete, so plain
+// serial_read() callers still see every byte the framer has not claimed.
+#define RX_RING_SIZE 0x4000 // power of two, larger than any frame
+
+enum rx_state_e
 {
-    if (sp_open(port, SP_MODE_READ_WRITE) != SP_OK)
-        return -1;
-    if (sp_set_baudrate(port, 9600) != SP_OK)
-        return -1;
-    if (sp_set_bits(port, 8) != SP_OK)
-        return -1;
-    if (sp_set_parity(port, SP_PARITY_NONE) != SP_OK)
-        return -1;
-    if (sp_set_stopbits(port, 1) != SP_OK)
-        return -1;
-    if (sp_set_flowcontrol(port, SP_FLOWCONTROL_NONE) != SP_OK)
-        return -1;
+    RX_SYNC,
+    RX_CMD,
+    RX_LEN_LO,
+    RX_LEN_HI,
+    RX_DATA,
+    RX_CHECKSUM,
+};
+
+static struct
+{
+    uint8_t buf[RX_RING_SIZE];
+    size_t head; // free-running write index
+    size_t tail; // free-running read index
+
+    // framer state, relative to tail
+    enum rx_state_e state;
+    size_t scan;
+    uint16_t length;
+    uint8_t sum;
+    uint8_t ack;
+} rx;
+
+static size_t rx_count(void)
+{
+    return rx.head - rx.tail;
+}
 
-    sp_set_rts(port, SP_RTS_OFF);
-    sp_set_dtr(port, SP_DTR_OFF);
-    sp_set_dtr(port, SP_DTR_ON);
-    sp_set_rts(port, SP_RTS_ON);
+static uint8_t rx_peek(size_t offset)
+{
+    return rx.buf[(rx.tail + offset) & (RX_RING_SIZE - 1)];
+}
 
-    return SP_OK;
+static void rx_consume(size_t len)
+{
+    rx.tail += len;
+    rx.state = RX_SYNC;
+    rx.scan = 0;
 }
 
-int serial_set_baudrate(struct sp_port *port, int baudrate)
+static void rx_reset(void)
+{
+    rx.head = rx.tail = 0;
+    rx.state = RX_SYNC;
+    rx.scan = 0;
+    rx.ack = 0;
+}
+
+// copy up to len buffered bytes out of the ring
+static size_t rx_take(uint8_t *buf, size_t len)
+{
+    size_t n = rx_count();
+    if (n > len)
+        n = len;
+
+    for (size_t i = 0; i < n; i++)
+        buf[i] = rx_peek(i);
+
+    if (n)
+    {
+        rx_consume(n);
+        rx.ack = 0;
+    }
+    return n;
+}
+
+int serial_open(struct transport *port)
+{
+    // the backend opens at 9600 8N1
+    if (transport_open(port) != 0)
+        return -1;
+
+    rx_reset();
+    serial_baudrate = 9600;
+    return 0;
+}
+
+int serial_set_baudrate(struct transport *port, int baudrate)
 {
     struct timespec ts = {0, 1500000}; // 15 ms sleep
     // sleep until phone accepts new baudrate
     nanosleep(&ts, NULL);
 
-    int rc = sp_set_baudrate(port, baudrate);
+    int rc = transport_set_baud(port, baudrate);
+    if (rc == 0)
+        serial_baudrate = baudrate;
 
     // sleep until phone accepts new baudrate
     nanosleep(&ts, NULL);
@@ -44,22 +114,36 @@ int serial_set_baudrate(struct sp_port *port, int baudrate)
     return rc;
 }
 
+int serial_get_baudrate(void)
+{
+    return serial_baudrate;
+}
+
+// time in ms to put len bytes on the wire (8N1 = 10 bits per byte)
+int serial_wire_time_ms(size_t len)
+{
+    return (int)((len * 10 * 1000 + serial_baudrate - 1) / serial_baudrate);
+}
+
 // --- Write helpers ---
-int serial_write(struct sp_port *port, const uint8_t *buf, size_t len)
+int serial_write(struct transport *port, const uint8_t *buf, size_t len)
 {
-    int written = sp_blocking_write(port, buf, len, TIMEOUT);
+    struct transport_iov iov = {buf, len};
+    int written = transport_write(port, &iov, 1);
     if (written < 0)
     {
         fprintf(stderr, "Serial write failed\n");
         return -1;
     }
 
-    // sp_flush(port, SP_BUF_OUTPUT);
     return written;
 }
 
-int serial_write_chunks(struct sp_port *port, const uint8_t *buf, size_t len, size_t chunk_size)
+int serial_write_chunks(struct transport *port, const uint8_t *buf, size_t len, size_t chunk_size)
 {
+    if (serial_chunk_size > 0)
+        chunk_size = serial_chunk_size;
+
     for (size_t i = 0; i < len; i += chunk_size)
     {
         int chunk = (i + chunk_size < len) ? chunk_size : (len - i);
@@ -72,7 +156,57 @@ int serial_write_chunks(struct sp_port *port, const uint8_t *buf, size_t len, si
     return len;
 }
 
-int serial_send_ack(struct sp_port *port)
+// --- serial_send_packet ---
+// ack     = prefix the packet with 0x06
+// cmd     = command ID
+// payload = payload segments, sent straight from the caller's memory
+// The checksum is taken in the same pass that sizes the payload, and
+// header, payload and trailer go out as one write.
+int serial_send_packet(struct transport *port, int ack, uint8_t cmd,
+                       const struct transport_iov *payload, int count)
+{
+    if (count > TRANSPORT_IOV_MAX - 2)
+        return -1;
+
+    size_t datasize = 0;
+    for (int i = 0; i < count; i++)
+        datasize += payload[i].len;
+    if (datasize > 0xFFFF)
+    {
+        fprintf(stderr, "Packet payload too large (%zu bytes)\n", datasize);
+        return -1;
+    }
+
+    uint8_t hdr[5];
+    int num = 0;
+    if (ack)
+        hdr[num++] = SERIAL_ACK;
+    hdr[num++] = SERIAL_HDR89;
+    hdr[num++] = cmd;
+    hdr[num++] = datasize & 0xFF;
+    hdr[num++] = (datasize >> 8) & 0xFF;
+
+    uint8_t checksum = 0;
+    for (int i = ack ? 1 : 0; i < num; i++)
+        checksum ^= hdr[i];
+    for (int i = 0; i < count; i++)
+        for (size_t j = 0; j < payload[i].len; j++)
+            checksum ^= payload[i].base[j];
+
+    uint8_t trailer = (checksum + 7) & 0xFF;
+
+    struct transport_iov vec[TRANSPORT_IOV_MAX];
+    vec[0].base = hdr;
+    vec[0].len = num;
+    for (int i = 0; i < count; i++)
+        vec[i + 1] = payload[i];
+    vec[count + 1].base = &trailer;
+    vec[count + 1].len = 1;
+
+    return transport_write(port, vec, count + 2);
+}
+
+int serial_send_ack(struct transport *port)
 {
     uint8_t packetdata = SERIAL_ACK;
     if (serial_write(port, &packetdata, 1) < 0)
@@ -81,22 +215,160 @@ int serial_send_ack(struct sp_port *port)
     return 0;
 }
 
-int serial_send_packetdata_ack(struct sp_port *port, const uint8_t *data, size_t len)
+int serial_send_packetdata_ack(struct transport *port, const uint8_t *data, size_t len)
 {
     uint8_t packetdata = SERIAL_ACK;
-    if (serial_write(port, &packetdata, 1) < 0)
-        return -1;
+    struct transport_iov iov[2] = {{&packetdata, 1}, {data, len}};
 
-    return serial_write(port, data, len);
+    return transport_write(port, iov, 2);
 }
 
 // --- Read helpers ---
-int serial_read(struct sp_port *port, uint8_t *buf, size_t bufsize, int timeout_ms)
+int serial_read(struct transport *port, uint8_t *buf, size_t bufsize, int timeout_ms)
+{
+    // bytes the framer already pulled in come first
+    size_t got = rx_take(buf, bufsize);
+    if (got == bufsize)
+        return (int)got;
+
+    int r = transport_read(port, buf + got, bufsize - got, timeout_ms);
+    if (r < 0)
+        return r;
+
+    return (int)got + r;
+}
+
+// wait for the port to become readable, then pull whatever is there into the ring
+static int rx_fill(struct transport *port, int timeout_ms)
+{
+    if (timeout_ms <= 0)
+        return 0;
+
+    int ready = transport_wait(port, timeout_ms);
+    if (ready <= 0)
+        return ready;
+
+    size_t head = rx.head & (RX_RING_SIZE - 1);
+    size_t space = RX_RING_SIZE - rx_count();
+    if (space > RX_RING_SIZE - head)
+        space = RX_RING_SIZE - head; // contiguous part only, the next fill wraps
+
+    int r = transport_read(port, &rx.buf[head], space, 0);
+    if (r < 0)
+        return -1;
+
+    rx.head += r;
+    return r;
+}
+
+// run the framer over what is buffered
+static int rx_parse(struct packetdata_t *out)
+{
+    while (rx.scan < rx_count())
+    {
+        uint8_t b = rx_peek(rx.scan);
+
+        switch (rx.state)
+        {
+        case RX_SYNC:
+            if (b == SERIAL_HDR89)
+            {
+                rx.sum = b;
+                rx.scan++;
+                rx.state = RX_CMD;
+                break;
+            }
+
+            // 06 = ACK of our command, 00/3E/23 = loader noise in front of a frame
+            rx_consume(1);
+            if (b == SERIAL_ACK)
+                rx.ack = 1;
+            else if (b == SERIAL_NAK)
+                return SERIAL_RX_NAK;
+            break;
+
+        case RX_CMD:
+            rx.sum ^= b;
+            rx.scan++;
+            rx.state = RX_LEN_LO;
+            break;
+
+        case RX_LEN_LO:
+            rx.length = b;
+            rx.sum ^= b;
+            rx.scan++;
+            rx.state = RX_LEN_HI;
+            break;
+
+        case RX_LEN_HI:
+            rx.length |= b << 8;
+            rx.sum ^= b;
+            rx.scan++;
+            if (rx.length > sizeof(out->data))
+            {
+                rx_consume(1); // not a frame header, resync after the 0x89
+                break;
+            }
+            rx.state = rx.length ? RX_DATA : RX_CHECKSUM;
+            break;
+
+        case RX_DATA:
+            rx.sum ^= b;
+            rx.scan++;
+            if (rx.scan == 4 + (size_t)rx.length)
+                rx.state = RX_CHECKSUM;
+            break;
+
+        case RX_CHECKSUM:
+        {
+            size_t framelen = rx.scan + 1;
+            if (((rx.sum + 7) & 0xFF) != b)
+            {
+                fprintf(stderr, "Checksum mismatch: got 0x%02X expected 0x%02X\n",
+                        b, (rx.sum + 7) & 0xFF);
+                rx_consume(framelen);
+                rx.ack = 0;
+                return SERIAL_RX_BADSUM;
+            }
+
+            out->ack = rx.ack ? SERIAL_ACK : 0x00;
+            out->hdr = SERIAL_HDR89;
+            out->cmd = rx_peek(1);
+            out->length = rx.length;
+            for (size_t i = 0; i < rx.length; i++)
+                out->data[i] = rx_peek(4 + i);
+            out->checksum = b;
+
+            rx_consume(framelen);
+            rx.ack = 0;
+            return SERIAL_RX_OK;
+        }
+        }
+    }
+
+    return SERIAL_RX_AGAIN;
+}
+
+int serial_recv_packet(struct transport *port, struct packetdata_t *out, int timeout_ms)
 {
-    return sp_blocking_read(port, buf, bufsize, timeout_ms);
+    double deadline = get_time_sec() + timeout_ms / 1000.0;
+
+    while (1)
+    {
+        int rc = rx_parse(out);
+        if (rc != SERIAL_RX_AGAIN)
+            return rc;
+
+        int remaining = (int)((deadline - get_time_sec()) * 1000);
+        if (remaining <= 0)
+            return SERIAL_RX_TIMEOUT;
+
+        if (rx_fill(port, remaining) < 0)
+            return SERIAL_RX_ERROR;
+    }
 }
 
-int serial_wait_packet(struct sp_port *port, uint8_t *buf, size_t bufsize, int timeout_ms)
+int serial_wait_packet(struct transport *port, uint8_t *buf, size_t bufsize, int timeout_ms)
 {
     size_t total = 0;
     int r;
@@ -117,7 +389,20 @@ int serial_wait_packet(struct sp_port *port, uint8_t *buf, size_t bufsize, int t
     return (int)total;
 }
 
-int serial_wait_ack(struct sp_port *port, int timeout_ms)
+// discard everything the phone still sends until the line is quiet
+int serial_drain_input(struct transport *port, int quiet_ms)
+{
+    uint8_t junk[256];
+    int total = 0;
+    int r;
+
+    while ((r = serial_read(port, junk, sizeof(junk), quiet_ms)) > 0)
+        total += r;
+
+    return r < 0 ? r : total;
+}
+
+int serial_wait_ack(struct transport *port, int timeout_ms)
 {
     uint8_t resp;
     size_t rcv_len = serial_read(port, &resp, 1, timeout_ms);
@@ -136,7 +421,7 @@ int serial_wait_ack(struct sp_port *port, int timeout_ms)
     return 0;
 }
 
-int serial_wait_e3_answer(struct sp_port *port, const char *expected, int timeout_ms, int skiperrors)
+int serial_wait_e3_answer(struct transport *port, const char *expected, int timeout_ms, int skiperrors)
 {
     uint8_t buf[3];
     size_t received = 0;
@@ -3,19 +3,38 @@
 
 #include <stdint.h>
 
-int serial_open(struct sp_port *port);
-int serial_set_baudrate(struct sp_port *port, int baudrate);
+#include "cmd.h"
+#include "transport.h"
+
+// serial_recv_packet() results
+#define SERIAL_RX_OK 0
+#define SERIAL_RX_AGAIN 1
+#define SERIAL_RX_TIMEOUT -1
+#define SERIAL_RX_ERROR -2
+#define SERIAL_RX_NAK -3
+#define SERIAL_RX_BADSUM -4
+
+extern int serial_chunk_size;
+
+int serial_open(struct transport *port);
+int serial_set_baudrate(struct transport *port, int baudrate);
+int serial_get_baudrate(void);
+int serial_wire_time_ms(size_t len);
 
 // --- Write helpers ---
-int serial_write(struct sp_port *port, const uint8_t *buf, size_t len);
-int serial_write_chunks(struct sp_port *port, const uint8_t *buf, size_t len, size_t chunk_size);
-int serial_send_packetdata_ack(struct sp_port *port, const uint8_t *data, size_t len);
-int serial_send_ack(struct sp_port *port);
+int serial_write(struct transport *port, const uint8_t *buf, size_t len);
+int serial_write_chunks(struct transport *port, const uint8_t *buf, size_t len, size_t chunk_size);
+int serial_send_packet(struct transport *port, int ack, uint8_t cmd,
+                       const struct transport_iov *payload, int count);
+int serial_send_packetdata_ack(struct transport *port, const uint8_t *data, size_t len);
+int serial_send_ack(struct transport *port);
 
 // --- Read helpers ---
-int serial_read(struct sp_port *port, uint8_t *buf, size_t bufsize, int timeout_ms);
-int serial_wait_ack(struct sp_port *port, int timeout_ms);
-int serial_wait_packet(struct sp_port *port, uint8_t *buf, size_t bufsize, int timeout_ms);
-int serial_wait_e3_answer(struct sp_port *port, const char *expected, int timeout_ms, int skiperrors);
+int serial_read(struct transport *port, uint8_t *buf, size_t bufsize, int timeout_ms);
+int serial_wait_ack(struct transport *port, int timeout_ms);
+int serial_drain_input(struct transport *port, int quiet_ms);
+int serial_wait_packet(struct transport *port, uint8_t *buf, size_t bufsize, int timeout_ms);
+int serial_recv_packet(struct transport *port, struct packetdata_t *out, int timeout_ms);
+int serial_wait_e3_answer(struct transport *port, const char *expected, int timeout_ms, int skiperrors);
 
 #endif // serial_h
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+#include "sigscan.h"
+
+#define SIG(name, s) {name, s, sizeof(s) - 1}
+
+const struct sigscan_pattern sigscan_fw_ids[] = {
+    SIG("fw id", "prgCXC"), // DB20XX
+    SIG("fw id", "prg120"), // PNX5230
+};
+const int sigscan_fw_ids_count = sizeof(sigscan_fw_ids) / sizeof(sigscan_fw_ids[0]);
+
+const struct sigscan_pattern sigscan_inventory[] = {
+    SIG("fw id", "prgCXC"),
+    SIG("fw id", "prg120"),
+    SIG("article", "CXC1"),
+    SIG("babe v2", "\xBA\xBE\x00\x02"),
+    SIG("babe v3", "\xBA\xBE\x00\x03"),
+    SIG("babe v4", "\xBA\xBE\x00\x04"),
+    // loader hello strings, as told apart by loader_get_hello()
+    SIG("loader", "CS_LOADER"),
+    SIG("loader", "CSLOADER"),
+    SIG("loader", "FILESYSTEMLOADER"),
+    SIG("loader", "FILE_SYSTEM_LOADER"),
+    SIG("loader", "PRODUCTION_ID"),
+    SIG("loader", "PRODUCTIONID"),
+    SIG("loader", "CERTLOADER"),
+    SIG("loader", "FLASHLOADER"),
+    SIG("loader", "MEM_PATCHER"),
+};
+const int sigscan_inventory_count = sizeof(sigscan_inventory) / sizeof(sigscan_inventory[0]);
+
+int sigscan_init(struct sigscan *s, const struct sigscan_pattern *pat, int count)
+{
+    memset(s, 0, sizeof(*s));
+    if (count < 1 || count > SIGSCAN_MAX)
+        return -1;
+
+    s->pat = pat;
+    s->count = count;
+    for (int k = 0; k < count; k++)
+    {
+        if (pat[k].len == 0 || pat[k].len > SIGSCAN_MAXLEN)
+            return -1;
+        if (pat[k].len > s->maxlen)
+            s->maxlen = pat[k].len;
+
+        uint8_t c = (uint8_t)pat[k].bytes[0];
+        if (!s->by_first[c])
+            s->firsts[s->nfirsts++] = c;
+        s->by_first[c] |= 1u << k;
+    }
+    return 0;
+}
+
+// patterns starting at buf[0 .. limit) that fit in size and end past
+// min_end; 1 = stopped by hit()
+static int sigscan_range(const struct sigscan *s, const uint8_t *buf, size_t size,
+                         size_t limit, size_t min_end, size_t base,
+                         sigscan_hit_fn hit, void *ctx)
+{
+#ifdef __SSE2__
+    __m128i first[SIGSCAN_MAX];
+    for (int k = 0; k < s->nfirsts; k++)
+        first[k] = _mm_set1_epi8((char)s->firsts[k]);
+#endif
+
+    size_t i = 0;
+    while (i < limit)
+    {
+        // skip to the next byte that can start a pattern
+        if (s->nfirsts == 1)
+        {
+            const uint8_t *p = memchr(buf + i, s->firsts[0], limit - i);
+            if (!p)
+                break;
+            i = p - buf;
+        }
+        else
+        {
+#ifdef __SSE2__
+            int bits = 0;
+            while (!bits && i + 16 <= limit)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+                __m128i m = _mm_cmpeq_epi8(v, first[0]);
+                for (int k = 1; k < s->nfirsts; k++)
+                    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, first[k]));
+                bits = _mm_movemask_epi8(m);
+                if (!bits)
+                    i += 16;
+            }
+            for (; bits && !(bits & 1); bits >>= 1)
+                i++;
+#endif
+            while (i < limit && !s->by_first[buf[i]])
+                i++;
+            if (i == limit)
+                break;
+        }
+
+        uint32_t m = s->by_first[buf[i]];
+        for (int k = 0; m; k++, m >>= 1)
+        {
+            size_t len = s->pat[k].len;
+            if ((m & 1) && len <= size - i && i + len > min_end &&
+                memcmp(buf + i, s->pat[k].bytes, len) == 0 &&
+                hit(ctx, k, base + i))
+                return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+int sigscan_buf(const struct sigscan *s, const uint8_t *buf, size_t size,
+                sigscan_hit_fn hit, void *ctx)
+{
+    return sigscan_range(s, buf, size, size, 0, 0, hit, ctx);
+}
+
+// chunks of one stream, e.g. 0x33 frames; a match may span chunks
+int sigscan_feed(struct sigscan *s, const uint8_t *data, size_t len,
+                 sigscan_hit_fn hit, void *ctx)
+{
+    uint8_t joint[2 * SIGSCAN_MAXLEN];
+    size_t keep = s->maxlen - 1;
+    size_t take = len < keep ? len : keep;
+
+    // matches that start in the carried tail and end in this chunk
+    memcpy(joint, s->carry, s->carry_len);
+    memcpy(joint + s->carry_len, data, take);
+    if (s->carry_len &&
+        sigscan_range(s, joint, s->carry_len + take, s->carry_len, s->carry_len,
+                      s->pos - s->carry_len, hit, ctx))
+        return 1;
+
+    if (sigscan_range(s, data, len, len, 0, s->pos, hit, ctx))
+        return 1;
+
+    if (len >= keep)
+    {
+        memcpy(s->carry, data + len - keep, keep);
+        s->carry_len = keep;
+    }
+    else
+    {
+        size_t total = s->carry_len + take;
+        s->carry_len = total < keep ? total : keep;
+        memcpy(s->carry, joint + total - s->carry_len, s->carry_len);
+    }
+    s->pos += len;
+    return 0;
+}
+
+int sigscan_first_hit(void *ctx, int pattern, size_t offset)
+{
+    (void)pattern;
+    *(size_t *)ctx = offset;
+    return 1;
+}
+
+// --- inventory report ---
+
+struct sigscan_report
+{
+    const uint8_t *buf;
+    size_t size;
+    size_t hits[SIGSCAN_MAX];
+};
+
+static int sigscan_report_hit(void *ctx, int pattern, size_t offset)
+{
+    struct sigscan_report *r = ctx;
+    const struct sigscan_pattern *p = &sigscan_inventory[pattern];
+    r->hits[pattern]++;
+
+    // strings show the printable run from the match on, babe headers nothing
+    size_t end = offset;
+    while (!(p->bytes[0] & 0x80) && end < r->size && end - offset < 64 &&
+           r->buf[end] >= 0x20 && r->buf[end] < 0x7F)
+        end++;
+
+    if (end > offset)
+        printf("0x%08zX  %-8s %.*s\n", offset, p->name, (int)(end - offset), (const char *)r->buf + offset);
+    else
+        printf("0x%08zX  %s\n", offset, p->name);
+    return 0;
+}
+
+int sigscan_report(const char *path)
+{
+    size_t size;
+    const uint8_t *buf = map_file(path, &size);
+    if (!buf)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        return -1;
+    }
+
+    struct sigscan s;
+    if (sigscan_init(&s, sigscan_inventory, sigscan_inventory_count) != 0)
+    {
+        unmap_file(buf, size);
+        return -1;
+    }
+
+    printf("%s: 0x%zX bytes\n", path, size);
+
+    struct sigscan_report r;
+    memset(&r, 0, sizeof(r));
+    r.buf = buf;
+    r.size = size;
+
+    double start = get_time_sec();
+    sigscan_buf(&s, buf, size, sigscan_report_hit, &r);
+    double elapsed = get_time_sec() - start;
+
+    // per name, the patterns sharing one are counted together
+    printf("\n");
+    for (int k = 0; k < sigscan_inventory_count; k++)
+    {
+        if (k > 0 && strcmp(sigscan_inventory[k].name, sigscan_inventory[k - 1].name) == 0)
+            continue;
+        size_t n = 0;
+        for (int j = k; j < sigscan_inventory_count && strcmp(sigscan_inventory[j].name, sigscan_inventory[k].name) == 0; j++)
+            n += r.hits[j];
+        printf("%-8s %zu\n", sigscan_inventory[k].name, n);
+    }
+    printf("scanned in %.3f s (%.1f MB/s)\n", elapsed,
+           elapsed > 0 ? size / elapsed / (1024 * 1024) : 0.0);
+
+    unmap_file(buf, size);
+    return 0;
+}
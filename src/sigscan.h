@@ -0,0 +1,59 @@
+#ifndef sigscan_h
+#define sigscan_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Multi-pattern signature scanner: every pattern is looked for in one pass
+// over the data. Offsets whose byte can't start any pattern are skipped 16
+// at a time with SSE2 (or memchr() when all patterns share a first byte),
+// so whole dumps scan at memory speed.
+#define SIGSCAN_MAX 32    // patterns per scanner
+#define SIGSCAN_MAXLEN 32 // bytes per pattern
+
+struct sigscan_pattern
+{
+    const char *name;
+    const char *bytes;
+    size_t len;
+};
+
+// offset is from the start of the scanned data (or stream);
+// return nonzero to stop the scan
+typedef int (*sigscan_hit_fn)(void *ctx, int pattern, size_t offset);
+
+struct sigscan
+{
+    const struct sigscan_pattern *pat;
+    int count;
+    size_t maxlen;
+    uint32_t by_first[256]; // patterns starting with this byte, bit per pattern
+    uint8_t firsts[SIGSCAN_MAX];
+    int nfirsts;
+
+    // streaming: the last maxlen - 1 bytes of the previous chunk
+    uint8_t carry[SIGSCAN_MAXLEN];
+    size_t carry_len;
+    size_t pos; // stream offset of the next chunk
+};
+
+// the firmware id markers, see scan_fw_version()
+extern const struct sigscan_pattern sigscan_fw_ids[];
+extern const int sigscan_fw_ids_count;
+
+// fw ids, CXC article numbers, BABE headers and loader hello strings
+extern const struct sigscan_pattern sigscan_inventory[];
+extern const int sigscan_inventory_count;
+
+int sigscan_init(struct sigscan *s, const struct sigscan_pattern *pat, int count);
+int sigscan_buf(const struct sigscan *s, const uint8_t *buf, size_t size,
+                sigscan_hit_fn hit, void *ctx);
+int sigscan_feed(struct sigscan *s, const uint8_t *data, size_t len,
+                 sigscan_hit_fn hit, void *ctx);
+
+// hit callback that stops at the first match, ctx = size_t * for its offset
+int sigscan_first_hit(void *ctx, int pattern, size_t offset);
+
+int sigscan_report(const char *path);
+
+#endif // sigscan_h
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <direct.h> // _mkdir
+#define MKDIR(path) _mkdir(path)
+#else
+#define MKDIR(path) mkdir(path, 0755)
+#endif
+
+#include "babe.h"
+#include "blockcache.h"
+#include "common.h"
+#include "manifest.h"
+#include "store.h"
+
+static int store_mkdir(const char *path)
+{
+    if (MKDIR(path) == 0 || errno == EEXIST)
+        return 0;
+    perror(path);
+    return -1;
+}
+
+static void store_path(const char *dir, const uint8_t sha1[20], char *path, size_t n)
+{
+    char hex[41];
+    for (int i = 0; i < 20; i++)
+        sprintf(hex + i * 2, "%02x", sha1[i]);
+    snprintf(path, n, "%s/%.2s/%s", dir, hex, hex);
+}
+
+// 1 = stored, 0 = was already there, -1 = error
+int store_put(const char *dir, const uint8_t sha1[20], const uint8_t *data, size_t size)
+{
+    char path[1024];
+    store_path(dir, sha1, path, sizeof(path));
+
+    struct stat st;
+    if (stat(path, &st) == 0 && (size_t)st.st_size == size)
+        return 0;
+
+    // backup/store/ab/
+    char sub[1024];
+    snprintf(sub, sizeof(sub), "%s", path);
+    *strrchr(sub, '/') = '\0';
+    if (store_mkdir(dir) != 0 || store_mkdir(sub) != 0)
+        return -1;
+
+    // written under a temporary name, a block file is either whole or missing
+    char tmp[1040];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f)
+    {
+        perror(tmp);
+        return -1;
+    }
+    int ok = fwrite(data, 1, size, f) == size;
+    if (fclose(f) != 0)
+        ok = 0;
+
+    remove(path); // rename() doesn't replace on Windows
+    if (!ok || rename(tmp, path) != 0)
+    {
+        perror(path);
+        remove(tmp);
+        return -1;
+    }
+    return 1;
+}
+
+int store_get(const char *dir, const uint8_t sha1[20], uint8_t *out, size_t size)
+{
+    char path[1024];
+    store_path(dir, sha1, path, sizeof(path));
+
+    // a missing block is no error here, the block cache just reads the phone
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    int ok = fread(out, 1, size, f) == size;
+    fclose(f);
+    if (!ok)
+    {
+        fprintf(stderr, "store: short block %s\n", path);
+        return -1;
+    }
+
+    // the name is the content, a damaged block file shows here
+    uint8_t check[20];
+    blockcache_digest(out, size, check);
+    if (memcmp(check, sha1, 20) != 0)
+    {
+        fprintf(stderr, "store: block %s is damaged\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// <manifest dir>/store, so a recipe can be rebuilt from anywhere
+static void store_dir_of(const char *manifest_filename, char *dir, size_t n)
+{
+    const char *slash = strrchr(manifest_filename, '/');
+#ifdef _WIN32
+    const char *bslash = strrchr(manifest_filename, '\\');
+    if (bslash > slash)
+        slash = bslash;
+#endif
+    if (slash)
+        snprintf(dir, n, "%.*s/store", (int)(slash - manifest_filename), manifest_filename);
+    else
+        snprintf(dir, n, "store");
+}
+
+static int store_block(const char *dir, const struct manifest_entry *e, uint8_t *buf)
+{
+    if (e->size > 0x10000)
+    {
+        fprintf(stderr, "store: block at 0x%08X too large\n", e->addr);
+        return -1;
+    }
+    if (e->erased)
+    {
+        memset(buf, 0xFF, e->size);
+        return 0;
+    }
+    if (store_get(dir, e->sha1, buf, e->size) != 0)
+    {
+        fprintf(stderr, "store: no good copy of the block at 0x%08X\n", e->addr);
+        return -1;
+    }
+    return 0;
+}
+
+int store_to_raw_file(const char *manifest_filename, const char *raw_filename)
+{
+    struct manifest m;
+    if (manifest_load(&m, manifest_filename) != 0)
+    {
+        fprintf(stderr, "can't read %s\n", manifest_filename);
+        return -1;
+    }
+
+    char dir[1024];
+    store_dir_of(manifest_filename, dir, sizeof(dir));
+
+    FILE *out = fopen(raw_filename, "wb");
+    uint8_t *buf = malloc(0x10000);
+    int rc = out && buf ? 0 : -1;
+
+    for (size_t i = 0; rc == 0 && i < m.count; i++)
+    {
+        if (store_block(dir, &m.e[i], buf) != 0 || fwrite(buf, 1, m.e[i].size, out) != m.e[i].size)
+            rc = -1;
+    }
+
+    if (out && fclose(out) != 0)
+        rc = -1;
+    free(buf);
+    manifest_free(&m);
+
+    if (rc == 0)
+        printf("saved %s\n", raw_filename);
+    return rc;
+}
+
+// same unsigned v3 BABE as flash_convert_raw_to_babe(), straight from the store
+int store_to_babe_file(const char *manifest_filename, const char *babe_filename)
+{
+    struct manifest m;
+    if (manifest_load(&m, manifest_filename) != 0)
+    {
+        fprintf(stderr, "can't read %s\n", manifest_filename);
+        return -1;
+    }
+
+    char dir[1024];
+    store_dir_of(manifest_filename, dir, sizeof(dir));
+
+    FILE *out = fopen(babe_filename, "wb");
+    uint8_t *buf = malloc(0x10000);
+    int rc = out && buf ? 0 : -1;
+
+    if (rc == 0)
+    {
+        struct babehdr_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.sig = 0xBEBA;
+        hdr.ver = 3;
+        hdr.payloadsize1 = (uint32_t)m.count;
+        if (fwrite(&hdr, 1, sizeof(hdr), out) != sizeof(hdr))
+            rc = -1;
+        for (size_t i = 0; rc == 0 && i < m.count; i++)
+            if (fputc(0, out) == EOF)
+                rc = -1;
+    }
+
+    for (size_t i = 0; rc == 0 && i < m.count; i++)
+    {
+        uint8_t blockhdr[8];
+        set_word(blockhdr, m.e[i].addr);
+        set_word(blockhdr + 4, m.e[i].size);
+        if (store_block(dir, &m.e[i], buf) != 0 ||
+            fwrite(blockhdr, 1, sizeof(blockhdr), out) != sizeof(blockhdr) ||
+            fwrite(buf, 1, m.e[i].size, out) != m.e[i].size)
+            rc = -1;
+    }
+
+    if (out && fclose(out) != 0)
+        rc = -1;
+    free(buf);
+    manifest_free(&m);
+
+    if (rc == 0)
+        printf("saved %s\n", babe_filename);
+    return rc;
+}
@@ -0,0 +1,19 @@
+#ifndef store_h
+#define store_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Content addressed block store shared by all dumps: every 64 KB block is
+// kept once, as backup/store/<2 hex>/<sha1 hex>. A dump is its manifest
+// (see manifest.h), which lists the blocks in order; erased blocks are not
+// stored at all. A manifest finds its blocks in store/ next to it.
+#define STORE_DIR "./backup/store"
+
+int store_put(const char *dir, const uint8_t sha1[20], const uint8_t *data, size_t size);
+int store_get(const char *dir, const uint8_t sha1[20], uint8_t *out, size_t size);
+
+int store_to_raw_file(const char *manifest_filename, const char *raw_filename);
+int store_to_babe_file(const char *manifest_filename, const char *babe_filename);
+
+#endif // store_h
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#include "transport.h"
+#include "common.h"
+
+#define WRITE_STALL_MS (10 * TIMEOUT) // no room in the output buffer for this long = dead link
+
+static const struct
+{
+    const char *prefix;
+    const struct transport_ops *ops;
+} backends[] = {
+    {"pty:", &transport_pty_ops},
+    {"tcp:", &transport_tcp_ops},
+    {"replay:", &transport_replay_ops},
+};
+
+// --- transport_get_by_name ---
+// name = "pty:<path>", "tcp:<host>:<port>", "replay:<file>" or a serial port name
+// The transport is not opened here, see transport_open()
+int transport_get_by_name(const char *name, struct transport **out)
+{
+    const struct transport_ops *ops = &transport_serial_ops;
+    const char *path = name;
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        size_t n = strlen(backends[i].prefix);
+        if (strncmp(name, backends[i].prefix, n) == 0)
+        {
+            ops = backends[i].ops;
+            path = name + n;
+            break;
+        }
+    }
+
+    if (*path == '\0')
+    {
+        fprintf(stderr, "Empty %s port name\n", ops->name);
+        return -1;
+    }
+
+    struct transport *t = calloc(1, sizeof(*t));
+    if (!t)
+        return -1;
+
+    t->path = malloc(strlen(path) + 1);
+    if (!t->path)
+    {
+        free(t);
+        return -1;
+    }
+    strcpy(t->path, path);
+
+    t->ops = ops;
+    t->fd = -1;
+    *out = t;
+    return 0;
+}
+
+void transport_free(struct transport *t)
+{
+    if (!t)
+        return;
+
+    if (t->is_open)
+        transport_close(t);
+    if (t->ops->release)
+        t->ops->release(t);
+    if (t->record)
+        fclose(t->record);
+
+    free(t->path);
+    free(t);
+}
+
+// capture everything read and written, for replay:<file> later
+int transport_record(struct transport *t, const char *filename)
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot create %s\n", filename);
+        return -1;
+    }
+
+    if (t->record)
+        fclose(t->record);
+    t->record = f;
+    return 0;
+}
+
+// one record per read/write call
+static void record_chunk(struct transport *t, uint8_t type, const struct transport_iov *iov, int count)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += iov[i].len;
+
+    uint8_t hdr[5];
+    hdr[0] = type;
+    set_word(&hdr[1], total);
+
+    int ok = fwrite(hdr, 1, sizeof(hdr), t->record) == sizeof(hdr);
+    for (int i = 0; ok && i < count; i++)
+        ok = fwrite(iov[i].base, 1, iov[i].len, t->record) == iov[i].len;
+
+    if (!ok)
+    {
+        fprintf(stderr, "Session record write failed, recording stopped\n");
+        fclose(t->record);
+        t->record = NULL;
+    }
+}
+
+int transport_open(struct transport *t)
+{
+    if (t->is_open)
+        return 0;
+
+    if (t->ops->open(t) != 0)
+        return -1;
+
+    t->is_open = 1;
+    return 0;
+}
+
+int transport_close(struct transport *t)
+{
+    if (!t->is_open)
+        return 0;
+
+    t->is_open = 0;
+    if (t->record)
+        fflush(t->record);
+    return t->ops->close(t);
+}
+
+int transport_read(struct transport *t, uint8_t *buf, size_t len, int timeout_ms)
+{
+    int r = t->ops->read(t, buf, len, timeout_ms);
+    if (r > 0 && t->record)
+    {
+        struct transport_iov iov = {buf, r};
+        record_chunk(t, TRANSPORT_REC_READ, &iov, 1);
+    }
+    return r;
+}
+
+int transport_write(struct transport *t, const struct transport_iov *iov, int count)
+{
+    if (count > TRANSPORT_IOV_MAX)
+        return -1;
+
+    int r = t->ops->write(t, iov, count);
+    if (r > 0 && t->record)
+        record_chunk(t, TRANSPORT_REC_WRITE, iov, count);
+    return r;
+}
+
+int transport_wait(struct transport *t, int timeout_ms)
+{
+    return t->ops->wait(t, timeout_ms);
+}
+
+int transport_set_baud(struct transport *t, int baudrate)
+{
+    if (t->ops->set_baud(t, baudrate) != 0)
+        return -1;
+
+    if (t->record)
+    {
+        uint8_t baud[4];
+        set_word(baud, baudrate);
+        struct transport_iov iov = {baud, sizeof(baud)};
+        record_chunk(t, TRANSPORT_REC_BAUD, &iov, 1);
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+// --- fd helpers ---
+// The fd is non-blocking, poll() provides the timeouts.
+int transport_fd_wait(struct transport *t, int timeout_ms)
+{
+    struct pollfd pfd = {t->fd, POLLIN, 0};
+
+    while (1)
+    {
+        int r = poll(&pfd, 1, timeout_ms);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            return 0;
+        if (pfd.revents & POLLIN)
+            return 1;
+        return -1; // POLLHUP / POLLERR without data
+    }
+}
+
+int transport_fd_read(struct transport *t, uint8_t *buf, size_t len, int timeout_ms)
+{
+    double deadline = get_time_sec() + timeout_ms / 1000.0;
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t r = read(t->fd, buf + got, len - got);
+        if (r > 0)
+        {
+            got += r;
+            continue;
+        }
+        if (r == 0)
+        {
+            fprintf(stderr, "%s: connection closed\n", t->ops->name);
+            return got ? (int)got : -1;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+
+        int remaining = (int)((deadline - get_time_sec()) * 1000);
+        if (timeout_ms == 0 || remaining <= 0)
+            break;
+
+        int w = transport_fd_wait(t, remaining);
+        if (w < 0)
+            return -1;
+        if (w == 0)
+            break;
+    }
+
+    return (int)got;
+}
+
+int transport_fd_write(struct transport *t, const struct transport_iov *iov, int count)
+{
+    struct iovec vec[TRANSPORT_IOV_MAX];
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        vec[i].iov_base = (void *)iov[i].base;
+        vec[i].iov_len = iov[i].len;
+        total += iov[i].len;
+    }
+
+    // wait for room while the kernel buffer is full
+    size_t done = 0;
+    int idx = 0;
+    while (done < total)
+    {
+        ssize_t r = writev(t->fd, &vec[idx], count - idx);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            struct pollfd pfd = {t->fd, POLLOUT, 0};
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || poll(&pfd, 1, WRITE_STALL_MS) <= 0)
+            {
+                fprintf(stderr, "%s write failed\n", t->ops->name);
+                return -1;
+            }
+            continue;
+        }
+
+        done += r;
+        while (idx < count && (size_t)r >= vec[idx].iov_len)
+            r -= vec[idx++].iov_len;
+        if (idx < count)
+        {
+            vec[idx].iov_base = (uint8_t *)vec[idx].iov_base + r;
+            vec[idx].iov_len -= r;
+        }
+    }
+
+    return (int)total;
+}
+
+int transport_fd_close(struct transport *t)
+{
+    int rc = close(t->fd);
+    t->fd = -1;
+    return rc;
+}
+#endif
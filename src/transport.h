@@ -0,0 +1,79 @@
+#ifndef transport_h
+#define transport_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define TRANSPORT_IOV_MAX 8
+
+// one segment of a scatter-gather write
+struct transport_iov
+{
+    const uint8_t *base;
+    size_t len;
+};
+
+struct transport;
+
+// --- backend vtable ---
+// open     = open the device named in t->path (also used to reopen after close)
+// read     = read up to len bytes, block until len bytes or timeout_ms (0 = don't block)
+// write    = write all segments, returns total bytes written
+// wait     = wait until input is available, returns 1 = readable, 0 = timeout
+// set_baud = change line speed (no-op where there is no line)
+// close    = close the device, the transport can be opened again
+// release  = free backend state (optional)
+// All return -1 on error.
+struct transport_ops
+{
+    const char *name;
+    int (*open)(struct transport *t);
+    int (*read)(struct transport *t, uint8_t *buf, size_t len, int timeout_ms);
+    int (*write)(struct transport *t, const struct transport_iov *iov, int count);
+    int (*wait)(struct transport *t, int timeout_ms);
+    int (*set_baud)(struct transport *t, int baudrate);
+    int (*close)(struct transport *t);
+    void (*release)(struct transport *t);
+};
+
+struct transport
+{
+    const struct transport_ops *ops;
+    char *path;     // device name without the backend prefix
+    void *priv;     // backend state
+    int fd;         // POSIX fd for fd-based backends, -1 otherwise
+    int is_open;
+    FILE *record;   // session capture for the replay backend
+};
+
+extern const struct transport_ops transport_serial_ops; // COM port / tty via libserialport
+extern const struct transport_ops transport_pty_ops;    // pty:/dev/pts/N
+extern const struct transport_ops transport_tcp_ops;    // tcp:host:port (ser2net)
+extern const struct transport_ops transport_replay_ops; // replay:session.rec
+
+// --- replay records: type(1) length(4 LE) data ---
+#define TRANSPORT_REC_READ 'R'
+#define TRANSPORT_REC_WRITE 'W'
+#define TRANSPORT_REC_BAUD 'B'
+
+int transport_get_by_name(const char *name, struct transport **out);
+void transport_free(struct transport *t);
+int transport_record(struct transport *t, const char *filename);
+
+int transport_open(struct transport *t);
+int transport_close(struct transport *t);
+int transport_read(struct transport *t, uint8_t *buf, size_t len, int timeout_ms);
+int transport_write(struct transport *t, const struct transport_iov *iov, int count);
+int transport_wait(struct transport *t, int timeout_ms);
+int transport_set_baud(struct transport *t, int baudrate);
+
+#ifndef _WIN32
+// shared by the fd-based backends
+int transport_fd_read(struct transport *t, uint8_t *buf, size_t len, int timeout_ms);
+int transport_fd_write(struct transport *t, const struct transport_iov *iov, int count);
+int transport_fd_wait(struct transport *t, int timeout_ms);
+int transport_fd_close(struct transport *t);
+#endif
+
+#endif // transport_h
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "transport.h"
+#include "common.h"
+
+// Linux pty slave, e.g. the one seftool-emu prints at startup.
+// libserialport refuses ptys (no modem control lines), so this backend
+// talks termios directly. The baudrate is set on the pty too, which is
+// how the other side learns about S0..S7 speed changes.
+//
+// A pty swallows whole loader images at once, while a UART write returns
+// about when the bytes have left, and the reply timeouts count from there.
+// Writes are held for their 8N1 wire time at the set rate to match.
+
+#ifndef _WIN32
+struct pty_priv
+{
+    int baudrate;
+    double line_free; // when the last byte written is off the wire
+};
+static const struct
+{
+    int baudrate;
+    speed_t speed;
+} pty_speeds[] = {
+    {9600, B9600},
+    {19200, B19200},
+    {38400, B38400},
+    {57600, B57600},
+    {115200, B115200},
+    {230400, B230400},
+    {460800, B460800},
+    {921600, B921600},
+};
+
+static int pty_set_baud(struct transport *t, int baudrate)
+{
+    for (size_t i = 0; i < sizeof(pty_speeds) / sizeof(pty_speeds[0]); i++)
+    {
+        if (pty_speeds[i].baudrate != baudrate)
+            continue;
+
+        struct termios tio;
+        if (tcgetattr(t->fd, &tio) != 0)
+            return -1;
+        cfsetispeed(&tio, pty_speeds[i].speed);
+        cfsetospeed(&tio, pty_speeds[i].speed);
+        if (tcsetattr(t->fd, TCSANOW, &tio) != 0)
+            return -1;
+
+        ((struct pty_priv *)t->priv)->baudrate = baudrate;
+        return 0;
+    }
+
+    fprintf(stderr, "pty: unsupported baudrate %d\n", baudrate);
+    return -1;
+}
+
+static int pty_write(struct transport *t, const struct transport_iov *iov, int count)
+{
+    struct pty_priv *p = t->priv;
+
+    int written = transport_fd_write(t, iov, count);
+    if (written <= 0)
+        return written;
+
+    double now = get_time_sec();
+    if (p->line_free < now)
+        p->line_free = now;
+    p->line_free += written * 10.0 / p->baudrate;
+
+    double d = p->line_free - now;
+    struct timespec ts = {(time_t)d, (long)((d - (time_t)d) * 1e9)};
+    nanosleep(&ts, NULL);
+    return written;
+}
+
+static int pty_open(struct transport *t)
+{
+    if (!t->priv)
+    {
+        t->priv = calloc(1, sizeof(struct pty_priv));
+        if (!t->priv)
+            return -1;
+    }
+
+    t->fd = open(t->path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (t->fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot open %s\n", t->path);
+        return -1;
+    }
+
+    struct termios tio;
+    if (tcgetattr(t->fd, &tio) != 0)
+    {
+        fprintf(stderr, "Error: %s is not a tty\n", t->path);
+        transport_fd_close(t);
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if (tcsetattr(t->fd, TCSANOW, &tio) != 0 || pty_set_baud(t, 9600) != 0)
+    {
+        transport_fd_close(t);
+        return -1;
+    }
+
+    ((struct pty_priv *)t->priv)->line_free = 0;
+    return 0;
+}
+
+static void pty_release(struct transport *t)
+{
+    free(t->priv);
+    t->priv = NULL;
+}
+
+const struct transport_ops transport_pty_ops = {
+    "pty",
+    pty_open,
+    transport_fd_read,
+    pty_write,
+    transport_fd_wait,
+    pty_set_baud,
+    transport_fd_close,
+    pty_release,
+};
+#else
+static int pty_open(struct transport *t)
+{
+    fprintf(stderr, "Error: pty:%s, ptys are not available on Windows\n", t->path);
+    return -1;
+}
+
+const struct transport_ops transport_pty_ops = {
+    "pty",
+    pty_open,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+#endif
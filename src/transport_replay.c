@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "transport.h"
+#include "common.h"
+
+// Plays back a session captured with --record. Reads return the bytes the
+// phone sent, in order; writes must match what was sent back then, so any
+// change in the host side protocol shows up as a divergence error instead
+// of a hung phone. Timing is not reproduced, only byte order.
+
+struct replay_priv
+{
+    FILE *f;
+    uint8_t type;  // type of the current record, 0 = end of recording
+    size_t left;   // bytes left in the current record
+    size_t offset; // position in the host -> phone stream, for error messages
+};
+
+// move on to the next non-empty record
+static void replay_next(struct replay_priv *p)
+{
+    while (p->left == 0)
+    {
+        uint8_t hdr[5];
+        if (fread(hdr, 1, sizeof(hdr), p->f) != sizeof(hdr))
+        {
+            p->type = 0;
+            return;
+        }
+
+        p->type = hdr[0];
+        p->left = get_word(&hdr[1]);
+    }
+}
+
+static const char *replay_expected(struct replay_priv *p)
+{
+    switch (p->type)
+    {
+    case TRANSPORT_REC_READ:
+        return "a read";
+    case TRANSPORT_REC_WRITE:
+        return "a write";
+    case TRANSPORT_REC_BAUD:
+        return "a baudrate change";
+    default:
+        return "end of recording";
+    }
+}
+
+static int replay_open(struct transport *t)
+{
+    struct replay_priv *p = t->priv;
+
+    // reopen (e.g. after break_cid49 reconnects) continues where we left off
+    if (p)
+        return 0;
+
+    p = calloc(1, sizeof(*p));
+    if (!p)
+        return -1;
+
+    p->f = fopen(t->path, "rb");
+    if (!p->f)
+    {
+        fprintf(stderr, "Error: Cannot open %s\n", t->path);
+        free(p);
+        return -1;
+    }
+
+    t->priv = p;
+    return 0;
+}
+
+static int replay_read(struct transport *t, uint8_t *buf, size_t len, int timeout_ms)
+{
+    struct replay_priv *p = t->priv;
+    size_t got = 0;
+    (void)timeout_ms;
+
+    while (got < len)
+    {
+        replay_next(p);
+        if (p->type != TRANSPORT_REC_READ)
+            break; // the phone was silent here, same as a timeout
+
+        size_t n = len - got;
+        if (n > p->left)
+            n = p->left;
+        if (fread(buf + got, 1, n, p->f) != n)
+        {
+            fprintf(stderr, "replay: %s is truncated\n", t->path);
+            return -1;
+        }
+        p->left -= n;
+        got += n;
+    }
+
+    return (int)got;
+}
+
+static int replay_write(struct transport *t, const struct transport_iov *iov, int count)
+{
+    struct replay_priv *p = t->priv;
+    size_t total = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < iov[i].len; j++)
+        {
+            replay_next(p);
+            if (p->type != TRANSPORT_REC_WRITE)
+            {
+                fprintf(stderr, "replay: diverged at write offset 0x%zX, recording expects %s\n",
+                        p->offset, replay_expected(p));
+                return -1;
+            }
+
+            int c = fgetc(p->f);
+            p->left--;
+            if (c != iov[i].base[j])
+            {
+                fprintf(stderr, "replay: diverged at write offset 0x%zX, sent 0x%02X, recorded 0x%02X\n",
+                        p->offset, iov[i].base[j], c & 0xFF);
+                return -1;
+            }
+            p->offset++;
+        }
+        total += iov[i].len;
+    }
+
+    return (int)total;
+}
+
+static int replay_wait(struct transport *t, int timeout_ms)
+{
+    struct replay_priv *p = t->priv;
+
+    replay_next(p);
+    if (p->type == TRANSPORT_REC_READ)
+        return 1;
+
+    // nothing recorded for this read, let the timeout run like it did on the wire
+    struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+    return 0;
+}
+
+static int replay_set_baud(struct transport *t, int baudrate)
+{
+    struct replay_priv *p = t->priv;
+    uint8_t baud[4];
+
+    replay_next(p);
+    if (p->type != TRANSPORT_REC_BAUD || p->left != sizeof(baud) ||
+        fread(baud, 1, sizeof(baud), p->f) != sizeof(baud))
+    {
+        fprintf(stderr, "replay: diverged at baudrate change, recording expects %s\n",
+                replay_expected(p));
+        return -1;
+    }
+    p->left = 0;
+
+    if ((int)get_word(baud) != baudrate)
+    {
+        fprintf(stderr, "replay: diverged, baudrate %d, recorded %d\n", baudrate, (int)get_word(baud));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int replay_close(struct transport *t)
+{
+    (void)t;
+    return 0;
+}
+
+static void replay_release(struct transport *t)
+{
+    struct replay_priv *p = t->priv;
+    if (!p)
+        return;
+
+    fclose(p->f);
+    free(p);
+    t->priv = NULL;
+}
+
+const struct transport_ops transport_replay_ops = {
+    "replay",
+    replay_open,
+    replay_read,
+    replay_write,
+    replay_wait,
+    replay_set_baud,
+    replay_close,
+    replay_release,
+};
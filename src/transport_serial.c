@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <libserialport.h>
+
+#include "transport.h"
+#include "common.h"
+
+struct serial_priv
+{
+    struct sp_port *port;
+    struct sp_event_set *events;
+};
+
+static int serial_port_open(struct transport *t)
+{
+    struct serial_priv *p = t->priv;
+    if (!p)
+    {
+        p = calloc(1, sizeof(*p));
+        if (!p)
+            return -1;
+        t->priv = p;
+    }
+
+    if (!p->port && sp_get_port_by_name(t->path, &p->port) != SP_OK)
+    {
+        fprintf(stderr, "Error: Cannot open %s\n", t->path);
+        return -1;
+    }
+
+    struct sp_port *port = p->port;
+    if (sp_open(port, SP_MODE_READ_WRITE) != SP_OK)
+        return -1;
+    if (sp_set_baudrate(port, 9600) != SP_OK)
+        goto fail;
+    if (sp_set_bits(port, 8) != SP_OK)
+        goto fail;
+    if (sp_set_parity(port, SP_PARITY_NONE) != SP_OK)
+        goto fail;
+    if (sp_set_stopbits(port, 1) != SP_OK)
+        goto fail;
+    if (sp_set_flowcontrol(port, SP_FLOWCONTROL_NONE) != SP_OK)
+        goto fail;
+
+    sp_set_rts(port, SP_RTS_OFF);
+    sp_set_dtr(port, SP_DTR_OFF);
+    sp_set_dtr(port, SP_DTR_ON);
+    sp_set_rts(port, SP_RTS_ON);
+
+    if (p->events)
+        sp_free_event_set(p->events);
+    p->events = NULL;
+    if (sp_new_event_set(&p->events) != SP_OK ||
+        sp_add_port_events(p->events, port, SP_EVENT_RX_READY) != SP_OK)
+        goto fail;
+
+#ifndef _WIN32
+    // writes go through writev() on the raw fd
+    if (sp_get_port_handle(port, &t->fd) != SP_OK)
+        goto fail;
+#endif
+
+    return 0;
+
+fail:
+    sp_close(port);
+    return -1;
+}
+
+static int serial_port_read(struct transport *t, uint8_t *buf, size_t len, int timeout_ms)
+{
+    struct serial_priv *p = t->priv;
+    int r;
+
+    if (timeout_ms > 0)
+        r = sp_blocking_read(p->port, buf, len, timeout_ms);
+    else
+        r = sp_nonblocking_read(p->port, buf, len);
+
+    return r < 0 ? -1 : r;
+}
+
+static int serial_port_write(struct transport *t, const struct transport_iov *iov, int count)
+{
+#ifdef _WIN32
+    // no writev() here, gather into one buffer for a single write
+    struct serial_priv *p = t->priv;
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += iov[i].len;
+
+    uint8_t *buf = malloc(total);
+    if (!buf)
+        return -1;
+
+    size_t pos = 0;
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(buf + pos, iov[i].base, iov[i].len);
+        pos += iov[i].len;
+    }
+
+    int written = sp_blocking_write(p->port, buf, total, TIMEOUT);
+    free(buf);
+    if (written < 0)
+    {
+        fprintf(stderr, "Serial write failed\n");
+        return -1;
+    }
+    return written;
+#else
+    return transport_fd_write(t, iov, count);
+#endif
+}
+
+static int serial_port_wait(struct transport *t, int timeout_ms)
+{
+    struct serial_priv *p = t->priv;
+
+    if (sp_wait(p->events, timeout_ms) != SP_OK)
+        return -1;
+
+    return sp_input_waiting(p->port) > 0;
+}
+
+static int serial_port_set_baud(struct transport *t, int baudrate)
+{
+    struct serial_priv *p = t->priv;
+    return sp_set_baudrate(p->port, baudrate) == SP_OK ? 0 : -1;
+}
+
+static int serial_port_close(struct transport *t)
+{
+    struct serial_priv *p = t->priv;
+    t->fd = -1;
+    return sp_close(p->port) == SP_OK ? 0 : -1;
+}
+
+static void serial_port_release(struct transport *t)
+{
+    struct serial_priv *p = t->priv;
+    if (!p)
+        return;
+
+    if (p->events)
+        sp_free_event_set(p->events);
+    if (p->port)
+        sp_free_port(p->port);
+    free(p);
+    t->priv = NULL;
+}
+
+const struct transport_ops transport_serial_ops = {
+    "serial",
+    serial_port_open,
+    serial_port_read,
+    serial_port_write,
+    serial_port_wait,
+    serial_port_set_baud,
+    serial_port_close,
+    serial_port_release,
+};
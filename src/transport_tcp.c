@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#include "transport.h"
+
+// Raw TCP connection to a ser2net (or similar) port server in raw mode.
+// Line speed is configured on the server side, so set_baud is a no-op:
+// the bench rig has to follow the S0..S7 speed change itself.
+
+#ifndef _WIN32
+static int tcp_open(struct transport *t)
+{
+    // path = host:port, split at the last colon so [v6]:port style hosts work too
+    char *host = malloc(strlen(t->path) + 1);
+    if (!host)
+        return -1;
+    strcpy(host, t->path);
+
+    char *service = strrchr(host, ':');
+    if (!service || service == host || service[1] == '\0')
+    {
+        fprintf(stderr, "Error: expected tcp:<host>:<port>, got tcp:%s\n", t->path);
+        free(host);
+        return -1;
+    }
+    *service++ = '\0';
+
+    if (host[0] == '[' && host[strlen(host) - 1] == ']')
+    {
+        host[strlen(host) - 1] = '\0';
+        memmove(host, host + 1, strlen(host));
+    }
+
+    struct addrinfo hints = {0};
+    struct addrinfo *res, *ai;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rc = getaddrinfo(host, service, &hints, &res);
+    if (rc != 0)
+    {
+        fprintf(stderr, "Error: Cannot resolve %s: %s\n", host, gai_strerror(rc));
+        free(host);
+        return -1;
+    }
+
+    t->fd = -1;
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        t->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (t->fd < 0)
+            continue;
+        if (connect(t->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(t->fd);
+        t->fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (t->fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot connect to %s:%s\n", host, service);
+        free(host);
+        return -1;
+    }
+    free(host);
+
+    // every packet is latency bound, don't let Nagle hold it back
+    int one = 1;
+    setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(t->fd, F_SETFL, fcntl(t->fd, F_GETFL) | O_NONBLOCK);
+
+    // a dropped connection must fail the write, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    return 0;
+}
+
+static int tcp_set_baud(struct transport *t, int baudrate)
+{
+    (void)t;
+    (void)baudrate;
+    return 0;
+}
+
+const struct transport_ops transport_tcp_ops = {
+    "tcp",
+    tcp_open,
+    transport_fd_read,
+    transport_fd_write,
+    transport_fd_wait,
+    tcp_set_baud,
+    transport_fd_close,
+    NULL,
+};
+#else
+static int tcp_open(struct transport *t)
+{
+    fprintf(stderr, "Error: tcp:%s, TCP ports are not supported on Windows (yet)\n", t->path);
+    return -1;
+}
+
+const struct transport_ops transport_tcp_ops = {
+    "tcp",
+    tcp_open,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+#endif
@@ -5,8 +5,24 @@
 
 #include "vkp.h"
 
-static const char *chhexvalues = "0123456789ABCDEFabcdef";
-static const char *chspace = " \t";
+// hex digits are 0x10 | value, anything else 0
+static const uint8_t vkp_hex[256] = {
+    ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+    ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+    ['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D, ['E'] = 0x1E, ['F'] = 0x1F,
+    ['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E, ['f'] = 0x1F,
+};
+
+#define HEXBYTE(p) ((uint8_t)((vkp_hex[(p)[0]] & 0x0F) << 4 | (vkp_hex[(p)[1]] & 0x0F)))
+
+// patched addresses seen so far, for the duplicate check: open addressing
+// over line index + 1, 0 = free slot
+struct vkp_addrset
+{
+    uint32_t *slot;
+    uint32_t mask;
+    int shift;
+};
 
 int vkp_add_line(vkp_patch_t *v, uint32_t addr, uint8_t d0, uint8_t d1)
 {
@@ -28,217 +44,208 @@ int vkp_add_line(vkp_patch_t *v, uint32_t addr, uint8_t d0, uint8_t d1)
     return 1;
 }
 
-static int isthatchar(const char *addr, size_t size, uint32_t position,
-                      uint32_t *elementsize, const char *ch)
+static uint32_t *vkp_addrset_slot(const struct vkp_addrset *set, const vkp_line_t *lines, uint32_t addr)
 {
-    if (position >= size)
-        return 0;
-    if (!strchr(ch, addr[position]))
+    uint32_t h = (addr * 0x9E3779B1u) >> set->shift;
+    while (set->slot[h] && lines[set->slot[h] - 1].addr != addr)
+        h = (h + 1) & set->mask;
+    return &set->slot[h];
+}
+
+// keeps the table at most half full, rebuilt from the lines
+static int vkp_addrset_reserve(struct vkp_addrset *set, const vkp_patch_t *v, size_t count)
+{
+    if (set->slot && count * 2 <= (size_t)set->mask + 1)
         return 0;
-    *elementsize = 1;
-    return 1;
+
+    int bits = 10;
+    while (((size_t)1 << bits) < count * 2)
+        bits++;
+    if (bits > 31)
+        return -1;
+
+    uint32_t *slot = calloc((size_t)1 << bits, sizeof(*slot));
+    if (!slot)
+        return -1;
+    free(set->slot);
+    set->slot = slot;
+    set->mask = (1u << bits) - 1;
+    set->shift = 32 - bits;
+
+    for (size_t i = 0; i < v->patch.count; i++)
+        *vkp_addrset_slot(set, v->patch.lines, v->patch.lines[i].addr) = (uint32_t)i + 1;
+    return 0;
 }
 
-static int space(const char *addr, size_t size, uint32_t position, uint32_t *elementsize)
+// up to max hex digits, returns how many there were
+static int hexrun(const uint8_t *addr, size_t size, size_t position, int max, uint32_t *value)
 {
-    return isthatchar(addr, size, position, elementsize, chspace);
+    int n = 0;
+    *value = 0;
+    while (n < max && position + n < size && vkp_hex[addr[position + n]])
+    {
+        *value = *value << 4 | (vkp_hex[addr[position + n]] & 0x0F);
+        n++;
+    }
+    return n;
 }
 
-static int eol(const char *addr, size_t size, uint32_t position, uint32_t *elementsize)
+// CR, LF or CRLF; the end of the file is one too
+static int eol(const uint8_t *addr, size_t size, size_t position, size_t *elementsize)
 {
     *elementsize = 0;
-    int ret = 0;
     if (position >= size)
         return 1;
-    if (addr[*elementsize + position] == 13)
-    {
+    if (addr[position] == 13)
         (*elementsize)++;
-        ret = 1;
-    }
-    if (position + *elementsize >= size)
-        return ret;
-    if (addr[*elementsize + position] == 10)
-    {
+    if (position + *elementsize < size && addr[position + *elementsize] == 10)
         (*elementsize)++;
-        ret = 1;
-    }
-    return ret;
+    return *elementsize > 0;
 }
 
-static int eos(const char *addr, size_t size, uint32_t position, uint32_t *elementsize)
+// blanks, an optional ;comment, then the end of the line
+static int eos(const uint8_t *addr, size_t size, size_t position, size_t *elementsize)
 {
-    uint32_t t;
-    *elementsize = 0;
-    while (space(addr, size, *elementsize + position, &t))
-        *elementsize += t;
-    if (*elementsize + position >= size)
-        return 1;
-    if (addr[*elementsize + position] == ';')
+    size_t i = position, t;
+    while (i < size && (addr[i] == ' ' || addr[i] == '\t'))
+        i++;
+    if (i >= size)
     {
-        while (!eol(addr, size, *elementsize + position, &t))
-            (*elementsize)++;
+        *elementsize = i - position;
+        return 1;
     }
-    if (eol(addr, size, *elementsize + position, &t))
+    if (addr[i] == ';')
     {
-        *elementsize += t;
-        return 1;
+        while (i < size && addr[i] != 13 && addr[i] != 10)
+            i++;
     }
-    return 0;
+    if (!eol(addr, size, i, &t))
+        return 0;
+    *elementsize = i + t - position;
+    return 1;
 }
 
-static int anyline(const char *addr, size_t size, uint32_t position, uint32_t *elementsize)
+static void anyline(const uint8_t *addr, size_t size, size_t position, size_t *elementsize)
 {
-    uint32_t t;
-    *elementsize = 0;
-    while (!eol(addr, size, *elementsize + position, &t))
-        (*elementsize)++;
-    return 1;
+    size_t i = position;
+    while (i < size && addr[i] != 13 && addr[i] != 10)
+        i++;
+    *elementsize = i - position;
 }
 
-static int deltaoffset(vkp_patch_t *v, const char *addr, uint32_t size,
-                       uint32_t position, uint32_t *elementsize)
+// +offset or -offset, added to the addresses of the lines that follow
+static int deltaoffset(vkp_patch_t *v, const uint8_t *addr, size_t size,
+                       size_t position, size_t *elementsize)
 {
-    if (!isthatchar(addr, size, position, elementsize, "+-"))
+    if (position >= size || (addr[position] != '+' && addr[position] != '-'))
         return 0;
 
-    uint32_t t;
-    int i;
-    char tmp[10];
-    tmp[0] = addr[position];
-    for (i = 0; i < 8; i++)
-    {
-        if (!isthatchar(addr, size, *elementsize + position, &t, chhexvalues))
-            break;
-        tmp[i + 1] = addr[*elementsize + position];
-        *elementsize += t;
-    }
-    if (i == 0)
+    uint32_t value;
+    size_t t;
+    int n = hexrun(addr, size, position + 1, 8, &value);
+    if (n == 0 || !eos(addr, size, position + 1 + n, &t))
         return 0;
-    tmp[i + 1] = 0;
-    if (!eos(addr, size, *elementsize + position, &t))
-        return 0;
-    *elementsize += t;
-    sscanf(tmp, "%x", &t);
-    v->delta = (uint32_t)t;
+
+    v->delta = addr[position] == '-' ? 0u - value : value;
+    *elementsize = 1 + n + t;
     return 1;
 }
 
-static int patchstring(vkp_patch_t *v, const char *addr, size_t size,
-                       uint32_t position, uint32_t *elementsize)
+// "ADDR: OLD NEW", OLD and NEW the same number of hex bytes;
+// 1 = parsed, 0 = not a patch line or a duplicate address, -1 = no memory
+static int patchstring(vkp_patch_t *v, struct vkp_addrset *set, const uint8_t *addr,
+                       size_t size, size_t position, size_t *elementsize)
 {
-    vkp_line_t tmp[256]; // local storage for one line
-
-    *elementsize = 0;
-    int i;
-    uint32_t t;
-    char tmpaddr[9];
     uint32_t addrvalue;
-    char tmpval[3];
-    tmpval[2] = 0;
-
-    for (i = 0; i < 8; i++)
-    {
-        if (!isthatchar(addr, size, *elementsize + position, &t, chhexvalues))
-            break;
-        tmpaddr[i] = addr[*elementsize + position];
-        *elementsize += t;
-    }
-    if (i == 0)
+    size_t t;
+    int n = hexrun(addr, size, position, 8, &addrvalue);
+    if (n == 0)
         return 0;
-    tmpaddr[i] = 0;
-    sscanf(tmpaddr, "%x", &addrvalue);
 
-    if (!isthatchar(addr, size, *elementsize + position, &t, ":"))
+    size_t i = position + n;
+    if (i + 1 >= size || addr[i] != ':' || addr[i + 1] != ' ')
         return 0;
-    *elementsize += t;
-    if (!isthatchar(addr, size, *elementsize + position, &t, " "))
-        return 0;
-    *elementsize += t;
+    i += 2;
 
-    int hcount = 0;
-    while (isthatchar(addr, size, *elementsize + position, &t, chhexvalues))
+    size_t olddata = i;
+    while (i < size && vkp_hex[addr[i]])
     {
-        tmpval[0] = addr[*elementsize + position];
-        *elementsize += t;
-        if (!isthatchar(addr, size, *elementsize + position, &t, chhexvalues))
+        if (i + 1 >= size || !vkp_hex[addr[i + 1]])
             return 0;
-        tmpval[1] = addr[*elementsize + position];
-        *elementsize += t;
-
-        sscanf(tmpval, "%x", &t);
-        tmp[hcount].addr = addrvalue + hcount + v->delta;
-        tmp[hcount].data[0] = (uint8_t)t;
-        hcount++;
+        i += 2;
     }
+    size_t hcount = (i - olddata) / 2;
 
-    if (!isthatchar(addr, size, *elementsize + position, &t, " "))
+    if (i >= size || addr[i] != ' ')
         return 0;
-    *elementsize += t;
+    i++;
 
-    for (int j = 0; j < hcount; j++)
+    size_t newdata = i;
+    for (size_t j = 0; j < hcount; j++, i += 2)
     {
-        if (!isthatchar(addr, size, *elementsize + position, &t, chhexvalues))
+        if (i + 1 >= size || !vkp_hex[addr[i]] || !vkp_hex[addr[i + 1]])
             return 0;
-        tmpval[0] = addr[*elementsize + position];
-        *elementsize += t;
-        if (!isthatchar(addr, size, *elementsize + position, &t, chhexvalues))
-            return 0;
-        tmpval[1] = addr[*elementsize + position];
-        *elementsize += t;
-
-        sscanf(tmpval, "%x", &t);
-        tmp[j].data[1] = (uint8_t)t;
     }
 
-    if (!eos(addr, size, *elementsize + position, &t))
+    if (!eos(addr, size, i, &t))
         return 0;
-    *elementsize += t;
+    *elementsize = i + t - position;
+
+    if (vkp_addrset_reserve(set, v, v->patch.count + hcount) != 0)
+        return -1;
 
-    for (size_t j = 0; j < (size_t)hcount; j++)
+    for (size_t j = 0; j < hcount; j++)
     {
-        // check for duplicates
-        int dup = 0;
-        for (size_t k = 0; k < v->patch.count; k++)
-        {
-            if (v->patch.lines[k].addr == tmp[j].addr)
-            {
-                dup = 1;
-                break;
-            }
-        }
-        if (dup)
-            return 0;
-        vkp_add_line(v, tmp[j].addr, tmp[j].data[0], tmp[j].data[1]);
+        uint32_t a = addrvalue + (uint32_t)j + v->delta;
+        uint32_t *slot = vkp_addrset_slot(set, v->patch.lines, a);
+        if (*slot)
+            return 0; // patched twice
+        if (!vkp_add_line(v, a, HEXBYTE(addr + olddata + j * 2), HEXBYTE(addr + newdata + j * 2)))
+            return -1;
+        *slot = (uint32_t)v->patch.count;
     }
 
     return 1;
 }
 
-int vkp_dovkp(vkp_patch_t *v, const char *addr, uint32_t size)
+// one pass over the text; returns 0 or the number of the first bad line
+int vkp_dovkp(vkp_patch_t *v, const char *text, uint32_t size)
 {
     v->patch.count = 0;
     v->errorline = 0;
     v->errorstring[0] = '\0';
     v->delta = 0;
 
-    uint32_t position;
+    const uint8_t *addr = (const uint8_t *)text;
+    struct vkp_addrset set = {0};
+    size_t position;
     int linenum;
-    uint32_t elementsize;
+    size_t elementsize;
 
     for (position = 0, linenum = 1; position < size; position += elementsize, linenum++)
     {
         if (eos(addr, size, position, &elementsize) ||
-            deltaoffset(v, addr, size, position, &elementsize) ||
-            patchstring(v, addr, size, position, &elementsize))
+            deltaoffset(v, addr, size, position, &elementsize))
+            continue;
+
+        int rc = patchstring(v, &set, addr, size, position, &elementsize);
+        if (rc == 1)
             continue;
 
-        anyline(addr, size, position, &elementsize);
-        snprintf(v->errorstring, sizeof(v->errorstring), "%.*s",
-                 (int)elementsize, addr + position);
+        if (rc < 0)
+            snprintf(v->errorstring, sizeof(v->errorstring), "out of memory");
+        else
+        {
+            anyline(addr, size, position, &elementsize);
+            snprintf(v->errorstring, sizeof(v->errorstring), "%.*s",
+                     (int)elementsize, text + position);
+        }
         v->errorline = linenum;
-        return linenum;
+        break;
     }
-    return 0;
+
+    free(set.slot);
+    return v->errorline;
 }
 
 void vkp_set_init(vkp_set_t *set)
@@ -318,30 +325,57 @@ int vkp_load_file(const char *filename, vkp_patch_t *patch)
     return 0;
 }
 
-// return number of unique blocks
-size_t vkp_collect_unique_blocks(const vkp_patch_t *patch,
-                                 size_t flashblocksize,
-                                 uint32_t *blocks, size_t maxblocks)
+static int vkp_cmp_line(const void *a, const void *b)
 {
-    size_t count = 0;
-    for (size_t i = 0; i < patch->patch.count; i++)
-    {
-        uint32_t block = patch->patch.lines[i].addr & ~(flashblocksize - 1);
+    uint32_t va = ((const vkp_line_t *)a)->addr;
+    uint32_t vb = ((const vkp_line_t *)b)->addr;
 
-        int seen = 0;
-        for (size_t j = 0; j < count; j++)
-        {
-            if (blocks[j] == block)
-            {
-                seen = 1;
-                break;
-            }
-        }
+    if (va < vb)
+        return -1;
+    if (va > vb)
+        return 1;
+    return 0;
+}
 
-        if (!seen && count < maxblocks)
+// Sorts the lines by address, then *blocks gets one entry per erase block
+// that is patched, in address order, each with its slice of the lines.
+// free() *blocks when done.
+int vkp_index_blocks(vkp_patch_t *patch, size_t flashblocksize,
+                     vkp_block_t **blocks, size_t *nblocks)
+{
+    vkp_line_t *lines = patch->patch.lines;
+    size_t count = patch->patch.count;
+    uint32_t mask = ~(uint32_t)(flashblocksize - 1);
+
+    *blocks = NULL;
+    *nblocks = 0;
+    qsort(lines, count, sizeof(vkp_line_t), vkp_cmp_line);
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+        if (i == 0 || (lines[i].addr & mask) != (lines[i - 1].addr & mask))
+            n++;
+    if (n == 0)
+        return 0;
+
+    vkp_block_t *b = malloc(n * sizeof(vkp_block_t));
+    if (!b)
+        return -1;
+
+    n = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i == 0 || (lines[i].addr & mask) != b[n - 1].addr)
         {
-            blocks[count++] = block;
+            b[n].addr = lines[i].addr & mask;
+            b[n].first = i;
+            b[n].count = 0;
+            n++;
         }
+        b[n - 1].count++;
     }
-    return count;
-}
\ No newline at end of file
+
+    *blocks = b;
+    *nblocks = n;
+    return 0;
+}
@@ -25,10 +25,19 @@ typedef struct
     uint32_t delta;
 } vkp_patch_t;
 
+// an erase block and its lines, patch.lines[first .. first + count)
+typedef struct
+{
+    uint32_t addr;
+    size_t first;
+    size_t count;
+} vkp_block_t;
+
 void vkp_patch_init(vkp_patch_t *patch);
 void vkp_patch_free(vkp_patch_t *patch);
 int vkp_load_file(const char *filename, vkp_patch_t *patch);
-size_t vkp_collect_unique_blocks(const vkp_patch_t *patch, size_t flashblocksize,
-                                 uint32_t *blocks, size_t maxblocks);
+int vkp_dovkp(vkp_patch_t *patch, const char *text, uint32_t size);
+int vkp_index_blocks(vkp_patch_t *patch, size_t flashblocksize,
+                     vkp_block_t **blocks, size_t *nblocks);
 
 #endif // vkp_h
\ No newline at end of file
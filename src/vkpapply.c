@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "transport.h"
+#include "babe.h"
+#include "common.h"
+#include "flash.h"
+#include "vkp.h"
+#include "vkpapply.h"
+
+// the file being patched: raw at base, or a BABE
+struct vkpapply_image
+{
+    uint8_t *buf;
+    size_t size;
+    int babe;
+    uint32_t base;
+    struct babe_block *blocks; // BABE: the blocks by address
+    int nblocks;
+};
+
+// a block of the BABE written out
+struct vkpapply_block
+{
+    uint32_t addr;
+    uint32_t size;
+    const uint8_t *data;
+};
+
+static int vkpapply_cmp_block(const void *a, const void *b)
+{
+    uint32_t va = ((const struct babe_block *)a)->addr;
+    uint32_t vb = ((const struct babe_block *)b)->addr;
+
+    if (va < vb)
+        return -1;
+    if (va > vb)
+        return 1;
+    return 0;
+}
+
+static int vkpapply_cmp_u32(const void *a, const void *b)
+{
+    uint32_t va = *(const uint32_t *)a;
+    uint32_t vb = *(const uint32_t *)b;
+
+    if (va < vb)
+        return -1;
+    if (va > vb)
+        return 1;
+    return 0;
+}
+
+// the byte at addr in the image, NULL = not in it
+static uint8_t *vkpapply_byte(const struct vkpapply_image *im, uint32_t addr)
+{
+    if (!im->babe)
+        return addr >= im->base && addr - im->base < im->size ? im->buf + (addr - im->base) : NULL;
+
+    // the last block that starts at or below addr
+    int lo = 0, hi = im->nblocks;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (im->blocks[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    const struct babe_block *b = &im->blocks[lo - 1];
+    if (addr - b->addr >= b->size)
+        return NULL;
+    return im->buf + b->offset + 8 + (addr - b->addr);
+}
+
+// Checks one patch against the image as the patches before it left it, and
+// applies it. 1 = applied, 0 = already in place, -1 = mismatch or outside
+// the image (nothing changed).
+static int vkpapply_patch(struct vkpapply_image *im, const char *filename,
+                          const vkp_patch_t *patch, int remove_flag)
+{
+    size_t outside = 0, unmatched = 0, contrmatched = 0;
+    uint32_t first_outside = 0;
+
+    for (size_t i = 0; i < patch->patch.count; i++)
+    {
+        const vkp_line_t *ln = &patch->patch.lines[i];
+        uint8_t *p = vkpapply_byte(im, ln->addr);
+        if (!p)
+        {
+            if (outside++ == 0)
+                first_outside = ln->addr;
+            continue;
+        }
+        if (*p != ln->data[remove_flag])
+            unmatched++;
+        if (*p == ln->data[remove_flag ^ 1])
+            contrmatched++;
+    }
+
+    if (outside)
+    {
+        fprintf(stderr, "%s: %zu byte(s) not in the image, first at 0x%08X\n",
+                filename, outside, first_outside);
+        return -1;
+    }
+
+    // patch already installed (or, removing, not installed)
+    if (unmatched && contrmatched == patch->patch.count)
+    {
+        printf("%s: %s, skipped\n", filename, remove_flag ? "not installed" : "already installed");
+        return 0;
+    }
+
+    if (unmatched)
+    {
+        fprintf(stderr, "%s: %zu/%zu mismatch\n", filename, unmatched, patch->patch.count);
+        size_t shown = 0;
+        for (size_t i = 0; i < patch->patch.count && shown < 8; i++)
+        {
+            const vkp_line_t *ln = &patch->patch.lines[i];
+            uint8_t actual = *vkpapply_byte(im, ln->addr);
+            if (actual != ln->data[remove_flag])
+            {
+                fprintf(stderr, "  0x%08X: %02X, expected %02X\n", ln->addr, actual, ln->data[remove_flag]);
+                shown++;
+            }
+        }
+        return -1;
+    }
+
+    for (size_t i = 0; i < patch->patch.count; i++)
+    {
+        const vkp_line_t *ln = &patch->patch.lines[i];
+        *vkpapply_byte(im, ln->addr) = ln->data[remove_flag ^ 1];
+    }
+    printf("%s: %s, %zu byte(s)\n", filename, remove_flag ? "removed" : "applied", patch->patch.count);
+    return 1;
+}
+
+static int vkpapply_save(const char *path, const uint8_t *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return -1;
+    }
+    if (fwrite(data, 1, size, f) != size)
+    {
+        fclose(f);
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    if (fclose(f) != 0)
+    {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// header from tmpl, hashes chained over the blocks; the signature is
+// cleared, it can't match any more and a zero one tells flash to refuse
+// the file on the signed loader
+static int vkpapply_write_babe(const char *path, const struct babehdr_t *tmpl, int ver,
+                               const struct vkpapply_block *blocks, int count)
+{
+    size_t hashsize = ver >= 4 ? 20 : 1;
+    size_t size = sizeof(struct babehdr_t) + count * hashsize;
+    for (int b = 0; b < count; b++)
+        size += 8 + blocks[b].size;
+
+    uint8_t *babe = calloc(1, size);
+    if (!babe)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+
+    struct babehdr_t *hdr = (struct babehdr_t *)babe;
+    memcpy(hdr, tmpl, sizeof(*hdr));
+    hdr->sig = 0xBEBA;
+    hdr->ver = (uint8_t)ver;
+    hdr->payloadsize1 = (uint32_t)count;
+    memset(hdr->hash2, 0, sizeof(hdr->hash2));
+
+    size_t pos = sizeof(struct babehdr_t) + count * hashsize;
+    for (int b = 0; b < count; b++)
+    {
+        set_word(babe + pos, blocks[b].addr);
+        set_word(babe + pos + 4, blocks[b].size);
+        memcpy(babe + pos + 8, blocks[b].data, blocks[b].size);
+        pos += 8 + blocks[b].size;
+    }
+
+    int rc = -1;
+    struct babe_index idx;
+    if (babe_index_build(babe, size, &idx) != CHECKBABE_OK)
+        fprintf(stderr, "Failed to build %s\n", path);
+    else if (babe_rehash(babe, &idx) != CHECKBABE_OK)
+        fprintf(stderr, "No certificate for platform 0x%08X cid %u color 0x%X, flash could not check %s\n",
+                hdr->platform, hdr->cid, hdr->color, path);
+    else
+        rc = vkpapply_save(path, babe, size);
+    babe_index_free(&idx);
+    free(babe);
+
+    if (rc == 0)
+        printf("saved %s (BABE v%d, %d blocks)\n", path, ver, count);
+    return rc;
+}
+
+// The patches go in order, each checked against what the ones before it
+// left. Any mismatch, or a byte outside the image, and nothing is written.
+// babe_v4: 20 byte SHA1 per block in the BABE written (else v3, or the
+// version of a BABE image). header: a BABE whose header (platform, cid,
+// color, flags) the raw image's BABE takes, none and only the raw file is
+// written.
+int vkpapply_file(const char *image, int has_addr, uint32_t addr, int nfiles,
+                  const char **filenames, int remove_flag, int babe_v4, const char *header)
+{
+    int rc = -1;
+    int parsed = 0;
+    struct vkpapply_image im = {0};
+    struct babe_index idx = {0};
+    struct vkpapply_block *out = NULL;
+    uint32_t *erase = NULL;
+    size_t nerase = 0, erasecap = 0;
+    char outname[512];
+    uint8_t *tmpl = NULL;
+
+    vkp_patch_t *patches = calloc(nfiles, sizeof(vkp_patch_t));
+    if (!patches)
+    {
+        fprintf(stderr, "malloc failed\n");
+        return -1;
+    }
+
+    im.buf = load_file(image, &im.size);
+    if (!im.buf)
+    {
+        fprintf(stderr, "can't read %s\n", image);
+        goto out;
+    }
+
+    int brc = babe_index_build(im.buf, im.size, &idx);
+    im.babe = brc != CHECKBABE_NOTBABE;
+    if (im.babe)
+    {
+        if (brc != CHECKBABE_OK)
+        {
+            fprintf(stderr, "%s: incomplete or damaged BABE file\n", image);
+            goto out;
+        }
+        if (header)
+        {
+            fprintf(stderr, "%s is a BABE file, it keeps its own header\n", image);
+            goto out;
+        }
+        im.nblocks = idx.count;
+        im.blocks = malloc((idx.count ? idx.count : 1) * sizeof(struct babe_block));
+        if (!im.blocks)
+        {
+            fprintf(stderr, "malloc failed\n");
+            goto out;
+        }
+        memcpy(im.blocks, idx.block, idx.count * sizeof(struct babe_block));
+        qsort(im.blocks, im.nblocks, sizeof(struct babe_block), vkpapply_cmp_block);
+        printf("%s: BABE v%u, %d blocks\n", image, ((struct babehdr_t *)im.buf)->ver, idx.count);
+    }
+    else
+    {
+        if (!has_addr)
+        {
+            fprintf(stderr, "%s is not a BABE file, a raw image needs <addr>\n", image);
+            goto out;
+        }
+        im.base = addr;
+
+        size_t tsize;
+        if (header && !(tmpl = load_file(header, &tsize)))
+        {
+            fprintf(stderr, "can't read %s\n", header);
+            goto out;
+        }
+        if (tmpl && (tsize < sizeof(struct babehdr_t) || tmpl[0] != 0xBA || tmpl[1] != 0xBE))
+        {
+            fprintf(stderr, "%s is not a BABE file\n", header);
+            goto out;
+        }
+        printf("%s: raw, 0x%08X size 0x%zX\n", image, addr, im.size);
+    }
+
+    for (int i = 0; i < nfiles; i++)
+    {
+        vkp_patch_init(&patches[i]);
+        parsed++;
+        if (vkp_load_file(filenames[i], &patches[i]) != 0)
+            goto out;
+        if (patches[i].patch.count == 0)
+        {
+            fprintf(stderr, "%s: empty patch\n", filenames[i]);
+            goto out;
+        }
+    }
+
+    int applied = 0, failed = 0;
+    for (int i = 0; i < nfiles; i++)
+    {
+        // sorts the lines, and gives the erase blocks for a raw image's BABE
+        vkp_block_t *blocks;
+        size_t nblocks;
+        if (vkp_index_blocks(&patches[i], VKPAPPLY_ERASE_BLOCK, &blocks, &nblocks) != 0)
+        {
+            fprintf(stderr, "malloc failed\n");
+            goto out;
+        }
+
+        int prc = vkpapply_patch(&im, filenames[i], &patches[i], remove_flag);
+        if (prc < 0)
+            failed = 1;
+        if (prc > 0)
+        {
+            applied++;
+            if (nerase + nblocks > erasecap)
+            {
+                size_t cap = (nerase + nblocks) * 2;
+                uint32_t *e = realloc(erase, cap * sizeof(uint32_t));
+                if (!e)
+                {
+                    free(blocks);
+                    fprintf(stderr, "malloc failed\n");
+                    goto out;
+                }
+                erase = e;
+                erasecap = cap;
+            }
+            for (size_t b = 0; b < nblocks; b++)
+                erase[nerase++] = blocks[b].addr;
+        }
+        free(blocks);
+    }
+
+    if (failed)
+    {
+        fprintf(stderr, "nothing written\n");
+        goto out;
+    }
+    if (applied == 0)
+    {
+        printf("nothing to do\n");
+        rc = 0;
+        goto out;
+    }
+
+    if (im.babe)
+    {
+        // every block, in file order
+        out = malloc(idx.count * sizeof(*out));
+        if (!out)
+        {
+            fprintf(stderr, "malloc failed\n");
+            goto out;
+        }
+        for (int b = 0; b < idx.count; b++)
+        {
+            out[b].addr = idx.block[b].addr;
+            out[b].size = idx.block[b].size;
+            out[b].data = im.buf + idx.block[b].offset + 8;
+        }
+
+        const struct babehdr_t *hdr = (const struct babehdr_t *)im.buf;
+        int ver = babe_v4 ? 4 : hdr->ver < 3 ? 3 : hdr->ver;
+        snprintf(outname, sizeof(outname), "%s.patched.ssw", image);
+        rc = vkpapply_write_babe(outname, hdr, ver, out, idx.count);
+    }
+    else
+    {
+        qsort(erase, nerase, sizeof(uint32_t), vkpapply_cmp_u32);
+        size_t n = 0;
+        for (size_t k = 0; k < nerase; k++)
+            if (n == 0 || erase[k] != erase[n - 1])
+                erase[n++] = erase[k];
+        nerase = n;
+
+        // whole erase blocks only, flashing part of one loses the rest
+        size_t chunks = VKPAPPLY_ERASE_BLOCK / BLOCK_SIZE;
+        out = malloc(nerase * chunks * sizeof(*out));
+        if (!out)
+        {
+            fprintf(stderr, "malloc failed\n");
+            goto out;
+        }
+        for (size_t e = 0; e < nerase; e++)
+        {
+            if (im.size < VKPAPPLY_ERASE_BLOCK || erase[e] < im.base ||
+                erase[e] - im.base > im.size - VKPAPPLY_ERASE_BLOCK)
+            {
+                fprintf(stderr, "erase block 0x%08X is not all in the image\n", erase[e]);
+                goto out;
+            }
+            for (size_t c = 0; c < chunks; c++)
+            {
+                struct vkpapply_block *b = &out[e * chunks + c];
+                b->addr = erase[e] + (uint32_t)(c * BLOCK_SIZE);
+                b->size = BLOCK_SIZE;
+                b->data = im.buf + (b->addr - im.base);
+            }
+        }
+
+        // the BABE first, no certificate for the header and nothing is written
+        if (tmpl)
+        {
+            snprintf(outname, sizeof(outname), "%s.patched.ssw", image);
+            if (vkpapply_write_babe(outname, (const struct babehdr_t *)tmpl, babe_v4 ? 4 : 3, out,
+                                    (int)(nerase * chunks)) != 0)
+                goto out;
+        }
+
+        snprintf(outname, sizeof(outname), "%s.patched.bin", image);
+        if (vkpapply_save(outname, im.buf, im.size) != 0)
+            goto out;
+        printf("saved %s\n", outname);
+        if (!tmpl)
+            printf("no BABE written, give header <ref.ssw> to stamp one\n");
+        rc = 0;
+    }
+
+out:
+    for (int i = 0; i < parsed; i++)
+        vkp_patch_free(&patches[i]);
+    free(patches);
+    free(out);
+    free(erase);
+    free(tmpl);
+    free(im.blocks);
+    babe_index_free(&idx);
+    free(im.buf);
+    return rc;
+}
@@ -0,0 +1,18 @@
+#ifndef vkpapply_h
+#define vkpapply_h
+
+#include <stdint.h>
+
+// Applies VKP patches to a firmware file instead of a phone. A raw image
+// (at addr) gives <image>.patched.bin, and with a header BABE also
+// <image>.patched.ssw of the erase blocks that changed; a BABE gives
+// <image>.patched.ssw with every block and the per block hashes chained
+// again. Either BABE is unsigned, only the bflash loader takes it.
+// The largest erase block seftool flashes (loader.c), the raw BABE carries
+// whole ones so it fits every chip.
+#define VKPAPPLY_ERASE_BLOCK 0x40000
+
+int vkpapply_file(const char *image, int has_addr, uint32_t addr, int nfiles,
+                  const char **filenames, int remove_flag, int babe_v4, const char *header);
+
+#endif // vkpapply_h
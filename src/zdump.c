@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "common.h"
+#include "zdump.h"
+
+static uint32_t zdump_block_len(const struct zdump *z, uint32_t n)
+{
+    uint32_t left = z->size - n * ZDUMP_BLOCK_SIZE;
+    return left < ZDUMP_BLOCK_SIZE ? left : ZDUMP_BLOCK_SIZE;
+}
+
+static int zdump_write_header(struct zdump *z, uint32_t indexoff)
+{
+    uint8_t hdr[ZDUMP_HDR_SIZE] = {0};
+    memcpy(hdr, ZDUMP_MAGIC, 4);
+    set_word(hdr + 4, ZDUMP_VERSION);
+    set_word(hdr + 8, z->addr);
+    set_word(hdr + 12, z->size);
+    set_word(hdr + 16, ZDUMP_BLOCK_SIZE);
+    set_word(hdr + 20, z->nblocks);
+    set_word(hdr + 24, indexoff);
+
+    if (fseek(z->f, 0, SEEK_SET) != 0 || fwrite(hdr, 1, sizeof(hdr), z->f) != sizeof(hdr))
+        return -1;
+    return 0;
+}
+
+static int zdump_is_erased(const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (data[i] != 0xFF)
+            return 0;
+    return 1;
+}
+
+// ------------- writer -------------
+
+// f = empty file opened for writing, the caller closes it after zdump_finish()
+int zdump_begin(struct zdump *z, FILE *f, uint32_t addr, uint32_t size)
+{
+    memset(z, 0, sizeof(*z));
+    z->f = f;
+    z->addr = addr;
+    z->size = size;
+    z->nblocks = (size + ZDUMP_BLOCK_SIZE - 1) / ZDUMP_BLOCK_SIZE;
+
+    z->index = calloc(z->nblocks ? z->nblocks : 1, sizeof(*z->index));
+#ifdef HAVE_ZLIB
+    z->cbuf_size = compressBound(ZDUMP_BLOCK_SIZE);
+    z->cbuf = malloc(z->cbuf_size);
+#else
+    z->cbuf = malloc(1);
+#endif
+    if (!z->index || !z->cbuf)
+    {
+        free(z->index);
+        free(z->cbuf);
+        return -1;
+    }
+
+    // index offset 0 until zdump_finish(): an interrupted dump reads as incomplete
+    return zdump_write_header(z, 0);
+}
+
+// blocks come in order, each ZDUMP_BLOCK_SIZE except the last
+int zdump_add_block(struct zdump *z, const uint8_t *data, size_t len)
+{
+    if (z->next >= z->nblocks || len != zdump_block_len(z, z->next))
+    {
+        fprintf(stderr, "zdump: unexpected block %u (0x%zX bytes)\n", z->next, len);
+        return -1;
+    }
+
+    struct zdump_entry *e = &z->index[z->next];
+    e->offset = (uint32_t)ftell(z->f);
+
+    if (zdump_is_erased(data, len))
+    {
+        e->type = ZDUMP_ERASED;
+        e->csize = 0;
+        z->next++;
+        return 0;
+    }
+
+    const uint8_t *out = data;
+    e->type = ZDUMP_STORED;
+    e->csize = len;
+
+#ifdef HAVE_ZLIB
+    uLongf clen = z->cbuf_size;
+    if (compress2(z->cbuf, &clen, data, len, Z_DEFAULT_COMPRESSION) == Z_OK && clen < len)
+    {
+        out = z->cbuf;
+        e->type = ZDUMP_ZLIB;
+        e->csize = clen;
+    }
+#endif
+
+    if (fwrite(out, 1, e->csize, z->f) != e->csize)
+        return -1;
+
+    z->next++;
+    return 0;
+}
+
+// writes the index and patches the header; a short dump gets neither and
+// keeps index offset 0, so it reads as incomplete instead of as a smaller dump
+int zdump_finish(struct zdump *z)
+{
+    int rc = 0;
+
+    if (z->next < z->nblocks)
+    {
+        free(z->index);
+        free(z->cbuf);
+        z->index = NULL;
+        z->cbuf = NULL;
+        return 0;
+    }
+
+    long indexoff = ftell(z->f);
+    for (uint32_t n = 0; n < z->nblocks && rc == 0; n++)
+    {
+        uint8_t ent[ZDUMP_ENTRY_SIZE] = {0};
+        set_word(ent, z->index[n].offset);
+        set_word(ent + 4, z->index[n].csize);
+        set_word(ent + 8, z->index[n].type);
+        if (fwrite(ent, 1, sizeof(ent), z->f) != sizeof(ent))
+            rc = -1;
+    }
+
+    if (rc == 0)
+        rc = zdump_write_header(z, (uint32_t)indexoff);
+    if (rc == 0 && fseek(z->f, 0, SEEK_END) != 0)
+        rc = -1;
+
+    free(z->index);
+    free(z->cbuf);
+    z->index = NULL;
+    z->cbuf = NULL;
+    return rc;
+}
+
+// ------------- reader -------------
+
+int zdump_open(struct zdump *z, const char *path)
+{
+    memset(z, 0, sizeof(*z));
+
+    z->f = fopen(path, "rb");
+    if (!z->f)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        return -1;
+    }
+
+    uint8_t hdr[ZDUMP_HDR_SIZE];
+    if (fread(hdr, 1, sizeof(hdr), z->f) != sizeof(hdr) || memcmp(hdr, ZDUMP_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "%s: not a zdump file\n", path);
+        goto fail;
+    }
+    if (get_word(hdr + 4) != ZDUMP_VERSION || get_word(hdr + 16) != ZDUMP_BLOCK_SIZE)
+    {
+        fprintf(stderr, "%s: unsupported zdump version %u\n", path, get_word(hdr + 4));
+        goto fail;
+    }
+
+    z->addr = get_word(hdr + 8);
+    z->size = get_word(hdr + 12);
+    z->nblocks = get_word(hdr + 20);
+    uint32_t indexoff = get_word(hdr + 24);
+    if (indexoff == 0)
+    {
+        fprintf(stderr, "%s: incomplete dump, no index\n", path);
+        goto fail;
+    }
+    if (z->nblocks != ((uint64_t)z->size + ZDUMP_BLOCK_SIZE - 1) / ZDUMP_BLOCK_SIZE)
+    {
+        fprintf(stderr, "%s: incomplete dump, %u blocks for 0x%X bytes\n", path, z->nblocks, z->size);
+        goto fail;
+    }
+
+    z->index = calloc(z->nblocks ? z->nblocks : 1, sizeof(*z->index));
+    z->cbuf_size = ZDUMP_BLOCK_SIZE + 0x100;
+    z->cbuf = malloc(z->cbuf_size);
+    if (!z->index || !z->cbuf || fseek(z->f, indexoff, SEEK_SET) != 0)
+        goto fail;
+
+    for (uint32_t n = 0; n < z->nblocks; n++)
+    {
+        uint8_t ent[ZDUMP_ENTRY_SIZE];
+        if (fread(ent, 1, sizeof(ent), z->f) != sizeof(ent))
+        {
+            fprintf(stderr, "%s: truncated index\n", path);
+            goto fail;
+        }
+        z->index[n].offset = get_word(ent);
+        z->index[n].csize = get_word(ent + 4);
+        z->index[n].type = get_word(ent + 8);
+        if (z->index[n].csize > z->cbuf_size)
+        {
+            fprintf(stderr, "%s: bad index entry %u\n", path, n);
+            goto fail;
+        }
+    }
+
+    return 0;
+
+fail:
+    zdump_close(z);
+    return -1;
+}
+
+// block n into out (ZDUMP_BLOCK_SIZE bytes), returns its length or -1
+int zdump_read_block(struct zdump *z, uint32_t n, uint8_t *out)
+{
+    if (n >= z->nblocks)
+        return -1;
+
+    const struct zdump_entry *e = &z->index[n];
+    uint32_t len = zdump_block_len(z, n);
+
+    if (e->type == ZDUMP_ERASED)
+    {
+        memset(out, 0xFF, len);
+        return len;
+    }
+
+    if (fseek(z->f, e->offset, SEEK_SET) != 0)
+        return -1;
+
+    if (e->type == ZDUMP_STORED)
+        return (e->csize == len && fread(out, 1, len, z->f) == len) ? (int)len : -1;
+
+    if (e->type != ZDUMP_ZLIB)
+    {
+        fprintf(stderr, "zdump: unknown block type %u\n", e->type);
+        return -1;
+    }
+
+#ifdef HAVE_ZLIB
+    if (fread(z->cbuf, 1, e->csize, z->f) != e->csize)
+        return -1;
+
+    uLongf dlen = len;
+    if (uncompress(out, &dlen, z->cbuf, e->csize) != Z_OK || dlen != len)
+    {
+        fprintf(stderr, "zdump: block %u is corrupt\n", n);
+        return -1;
+    }
+    return len;
+#else
+    fprintf(stderr, "zdump: block %u is compressed, this build has no zlib\n", n);
+    return -1;
+#endif
+}
+
+void zdump_close(struct zdump *z)
+{
+    if (z->f)
+        fclose(z->f);
+    free(z->index);
+    free(z->cbuf);
+    memset(z, 0, sizeof(*z));
+}
+
+int zdump_to_raw_file(const char *zdump_filename, const char *raw_filename)
+{
+    struct zdump z;
+    if (zdump_open(&z, zdump_filename) != 0)
+        return -1;
+
+    printf("zdump 0x%08X size 0x%X, %u blocks\n", z.addr, z.size, z.nblocks);
+
+    FILE *out = fopen(raw_filename, "wb");
+    uint8_t *buf = malloc(ZDUMP_BLOCK_SIZE);
+    if (!out || !buf)
+    {
+        fprintf(stderr, "Failed to open raw file (%s)\n", raw_filename);
+        if (out)
+            fclose(out);
+        free(buf);
+        zdump_close(&z);
+        return -1;
+    }
+
+    int rc = 0;
+    for (uint32_t n = 0; n < z.nblocks; n++)
+    {
+        int len = zdump_read_block(&z, n, buf);
+        if (len < 0 || fwrite(buf, 1, len, out) != (size_t)len)
+        {
+            fprintf(stderr, "failed at block %u\n", n);
+            rc = -1;
+            break;
+        }
+    }
+
+    if (fclose(out) != 0)
+        rc = -1;
+    free(buf);
+    zdump_close(&z);
+
+    if (rc == 0)
+        printf("saved %s\n", raw_filename);
+    return rc;
+}
@@ -0,0 +1,56 @@
+#ifndef zdump_h
+#define zdump_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Compressed flash dump, random access per 64 KB block. Little endian:
+//   header  "ZDMP" ver addr size blocksize nblocks indexoff 0  (8 x u32)
+//   blocks  in dump order, erased ones take no space
+//   index   nblocks x { offset csize type 0 } (4 x u32), at indexoff
+// The header is written first and patched at the end, so the blocks can be
+// appended as they come off the wire.
+#define ZDUMP_MAGIC "ZDMP"
+#define ZDUMP_VERSION 1
+#define ZDUMP_HDR_SIZE 32
+#define ZDUMP_ENTRY_SIZE 16
+#define ZDUMP_BLOCK_SIZE 0x10000
+
+enum
+{
+    ZDUMP_ERASED, // all 0xFF
+    ZDUMP_STORED,
+    ZDUMP_ZLIB
+};
+
+struct zdump_entry
+{
+    uint32_t offset;
+    uint32_t csize;
+    uint32_t type;
+};
+
+struct zdump
+{
+    FILE *f;
+    uint32_t addr;
+    uint32_t size;
+    uint32_t nblocks;
+    uint32_t next; // writer: blocks added so far
+    struct zdump_entry *index;
+    uint8_t *cbuf; // compressed block
+    size_t cbuf_size;
+};
+
+int zdump_begin(struct zdump *z, FILE *f, uint32_t addr, uint32_t size);
+int zdump_add_block(struct zdump *z, const uint8_t *data, size_t len);
+int zdump_finish(struct zdump *z);
+
+int zdump_open(struct zdump *z, const char *path);
+int zdump_read_block(struct zdump *z, uint32_t n, uint8_t *out);
+void zdump_close(struct zdump *z);
+
+int zdump_to_raw_file(const char *zdump_filename, const char *raw_filename);
+
+#endif // zdump_h